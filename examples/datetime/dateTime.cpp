@@ -86,5 +86,17 @@ int main()
 	cout << "today + 365 days: " << ulYear << "/" << ulMonth << "/" << ulDay << " " << ulHour << ":" << ulMinutes << ":" << ulSeconds
 		 << ", daylight saving time: " << bDaylightSavingTime << endl;
 
+	const Datetime::CivilDateTime today{
+		tmDateTime.tm_year + 1900,
+		static_cast<uint8_t>(tmDateTime.tm_mon + 1),
+		static_cast<uint8_t>(tmDateTime.tm_mday),
+		static_cast<uint8_t>(tmDateTime.tm_hour),
+		static_cast<uint8_t>(tmDateTime.tm_min),
+		static_cast<uint8_t>(tmDateTime.tm_sec)
+	};
+	const Datetime::CivilDateTime nextMonth = Datetime::addMonths(today, 1);
+	cout << "today + 1 month: " << nextMonth.year << "/" << +nextMonth.month << "/" << +nextMonth.day << " " << +nextMonth.hour << ":"
+		 << +nextMonth.minute << ":" << +nextMonth.second << ", daylight saving time: " << +nextMonth.isDst << endl;
+
 	return 0;
 }
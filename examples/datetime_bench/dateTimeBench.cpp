@@ -0,0 +1,815 @@
+/*
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either
+ version 2 of the License, or (at your option) any later
+ version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ Commercial use other than under the terms of the GNU General Public
+ License is allowed only after express negotiation of conditions
+ with the authors.
+*/
+
+/*
+	Microbenchmarks of the Datetime entry points.
+	Usage: datetime_bench [--filter=<substring>] [--threads=1,4,16,64] [--time-ms=100] [--stats]
+	Every function is run by 1, 4, 16 and 64 threads (each thread calls it in a loop)
+	and a CSV line is printed on stdout for each run:
+		group,name,threads,calls,ns_per_op,allocs_per_op,items_per_s,checksum
+	ns_per_op is the latency of a call seen by a single thread (wall time * threads / calls),
+	items_per_s the aggregated throughput, allocs_per_op the operator new calls per item.
+	--stats prints at the end the Datetime::stats() counters (library built with DATETIME_STATS):
+		function,calls,failures,latency_samples,avg_ns
+*/
+
+#include "Datetime.h"
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <format>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+// allocations made by the current thread, counted by the replaced operator new
+thread_local uint64_t threadAllocations = 0;
+} // namespace
+
+void *operator new(size_t size)
+{
+	threadAllocations++;
+	if (void *pointer = malloc(size != 0 ? size : 1))
+		return pointer;
+	throw bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept { free(pointer); }
+
+void operator delete(void *pointer, size_t) noexcept { free(pointer); }
+
+namespace
+{
+// the parsers as they were before the allocation-free fast path, kept as reference
+time_t legacyParseStringToUtcInSecs(const string &datetime)
+{
+	tm tm = {};
+	istringstream ss(datetime);
+	ss >> get_time(&tm, "%Y-%m-%dT%H:%M:%SZ");
+	if (ss.fail())
+		throw runtime_error("Parsing datetime failed");
+	return timegm(&tm);
+}
+
+int64_t legacyParseUtcStringToUtcInMillisecs(const string &datetime)
+{
+	tm tm = {};
+	int millis = 0;
+	char discard;
+	istringstream ss(datetime);
+	ss >> get_time(&tm, "%Y-%m-%dT%H:%M:%S");
+	ss >> discard;
+	ss >> millis;
+	if (ss.fail())
+		throw runtime_error("Parsing datetime failed");
+	return static_cast<int64_t>(timegm(&tm)) * 1000 + millis;
+}
+
+string legacyDateTimeFormat(const uint64_t milliSecondsSinceEpoch, const string &outputFormat)
+{
+	const chrono::system_clock::time_point timePoint{chrono::milliseconds{milliSecondsSinceEpoch}};
+	const string &_format = format("{{:{}}}", outputFormat);
+	const auto _timePoint = floor<chrono::seconds>(timePoint);
+	return vformat(_format, make_format_args(_timePoint));
+}
+
+// next daily occurrences at hour:minute as a scheduler loop with localtime_r/mktime does
+void legacyNextDailyOccurrences(const int64_t afterUtcInMilliSecs, const int hour, const int minute, const span<int64_t> occurrences)
+{
+	const time_t after = static_cast<time_t>(afterUtcInMilliSecs / 1000);
+	tm localTime;
+	localtime_r(&after, &localTime);
+	size_t count = 0;
+	for (int day = localTime.tm_mday - 1; count < occurrences.size(); day++)
+	{
+		tm occurrence = localTime;
+		occurrence.tm_mday = day;
+		occurrence.tm_hour = hour;
+		occurrence.tm_min = minute;
+		occurrence.tm_sec = 0;
+		occurrence.tm_isdst = -1;
+		const int64_t utcInMilliSecs = static_cast<int64_t>(mktime(&occurrence)) * 1000;
+		if (utcInMilliSecs > afterUtcInMilliSecs)
+			occurrences[count++] = utcInMilliSecs;
+	}
+}
+
+struct Options
+{
+	string filter;
+	vector<size_t> threads = {1, 4, 16, 64};
+	double timeMs = 100;
+	bool stats = false;
+};
+
+Options options;
+
+// keeps the probe results alive
+volatile int64_t probeSink;
+
+/*
+	Runs function(index) callsPerThread times in each thread (index is the call number, used to pick the input).
+	callsPerThread is estimated by a single-threaded probe so that a run lasts about options.timeMs.
+	itemsPerCall > 1 for the batch functions, ns/op, allocs/op and items/s are reported per item.
+*/
+void bench(const string &group, const string &name, const function<int64_t(size_t)> &function, const size_t itemsPerCall = 1)
+{
+	if (!options.filter.empty() && format("{}/{}", group, name).find(options.filter) == string::npos)
+		return;
+
+	try
+	{
+		function(0);
+	}
+	catch (exception &e)
+	{
+		cerr << format("{}/{} skipped: {}", group, name, e.what()) << endl;
+		return;
+	}
+
+	double probeNs;
+	{
+		size_t calls = 16;
+		int64_t sink = 0;
+		for (;; calls *= 4)
+		{
+			const auto start = chrono::steady_clock::now();
+			for (size_t call = 0; call < calls; call++)
+				sink += function(call);
+			probeNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+			if (probeNs > 1e6 || calls > 1e7)
+				break;
+		}
+		probeSink = sink;
+		probeNs /= static_cast<double>(calls);
+	}
+
+	for (const size_t threads : options.threads)
+	{
+		const double totalCalls = options.timeMs * 1e6 / max(probeNs, 1.0);
+		const size_t callsPerThread = max<size_t>(static_cast<size_t>(totalCalls / static_cast<double>(threads)), 10);
+
+		vector<int64_t> sinks(threads);
+		vector<uint64_t> allocations(threads);
+		atomic<size_t> ready = 0;
+		atomic<bool> go = false;
+		vector<thread> workers;
+		workers.reserve(threads);
+		for (size_t index = 0; index < threads; index++)
+			workers.emplace_back(
+				[&, index]()
+				{
+					ready++;
+					while (!go.load(memory_order_acquire))
+						this_thread::yield();
+					const uint64_t allocationsBefore = threadAllocations;
+					int64_t sink = 0;
+					for (size_t call = 0; call < callsPerThread; call++)
+						sink += function(index * callsPerThread + call);
+					allocations[index] = threadAllocations - allocationsBefore;
+					sinks[index] = sink;
+				}
+			);
+		while (ready.load() < threads)
+			this_thread::yield();
+		const auto start = chrono::steady_clock::now();
+		go.store(true, memory_order_release);
+		for (thread &worker : workers)
+			worker.join();
+		const double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+
+		int64_t sink = 0;
+		uint64_t totalAllocations = 0;
+		for (size_t index = 0; index < threads; index++)
+		{
+			sink += sinks[index];
+			totalAllocations += allocations[index];
+		}
+		const double items = static_cast<double>(threads * callsPerThread * itemsPerCall);
+		cout << format(
+					"{},{},{},{},{:.1f},{:.2f},{:.0f},{}", group, name, threads, threads * callsPerThread, elapsed * threads / items,
+					static_cast<double>(totalAllocations) / items, items * 1e9 / elapsed, sink
+				)
+			 << endl;
+	}
+}
+
+constexpr size_t inputsCount = 4096;
+
+vector<string> buildInputs(const bool milliSeconds, const bool offset)
+{
+	vector<string> inputs;
+	inputs.reserve(inputsCount);
+	int64_t utcInMillisecs = 1614354075765;
+	for (size_t index = 0; index < inputsCount; index++, utcInMillisecs += 7777777)
+	{
+		const string seconds = Datetime::dateTimeFormat(utcInMillisecs, "%Y-%m-%dT%H:%M:%S");
+		if (!milliSeconds)
+			inputs.push_back(seconds + "Z");
+		else if (!offset)
+			inputs.push_back(format("{}.{:03}Z", seconds, utcInMillisecs % 1000));
+		else
+			inputs.push_back(format("{}.{:03}{}{:02}{:02}", seconds, utcInMillisecs % 1000, index % 2 ? '+' : '-', index % 14, index % 4 * 15));
+	}
+	return inputs;
+}
+
+void parseOptions(const int argc, char **argv)
+{
+	for (int index = 1; index < argc; index++)
+	{
+		const string_view argument = argv[index];
+		if (argument.starts_with("--filter="))
+			options.filter = argument.substr(9);
+		else if (argument.starts_with("--time-ms="))
+			options.timeMs = stod(string(argument.substr(10)));
+		else if (argument == "--stats")
+			options.stats = true;
+		else if (argument.starts_with("--threads="))
+		{
+			options.threads.clear();
+			istringstream threads{string(argument.substr(10))};
+			for (string thread; getline(threads, thread, ',');)
+				options.threads.push_back(stoul(thread));
+		}
+		else
+		{
+			cerr << "Usage: " << argv[0] << " [--filter=<substring>] [--threads=1,4,16,64] [--time-ms=100] [--stats]" << endl;
+			exit(1);
+		}
+	}
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+	parseOptions(argc, argv);
+
+	const vector<string> secondsInputs = buildInputs(false, false);
+	const vector<string> milliSecondsInputs = buildInputs(true, false);
+	const vector<string> offsetInputs = buildInputs(true, true);
+	vector<string> malformedInputs = offsetInputs;
+	for (size_t index = 0; index < inputsCount; index++)
+		malformedInputs[index][index % malformedInputs[index].size()] = 'x';
+	vector<time_t> utcTimes;
+	vector<tm> utcTms;
+	vector<tm> localTms;
+	for (size_t index = 0; index < inputsCount; index++)
+	{
+		utcTimes.push_back(1614354075 + static_cast<time_t>(index) * 7777);
+		tm tmDateTime;
+		Datetime::convertFromUTCInSecondsToBreakDownUTC(utcTimes.back(), &tmDateTime);
+		utcTms.push_back(tmDateTime);
+		localTms.push_back(Datetime::utcSecondsToLocalTime(utcTimes.back()));
+	}
+	const auto utcTime = [&](const size_t index) { return utcTimes[index % inputsCount]; };
+	const auto utcInMillisecs = [&](const size_t index) { return static_cast<uint64_t>(utcTimes[index % inputsCount]) * 1000 + index % 1000; };
+	const auto timePoint = [&](const size_t index) { return chrono::system_clock::time_point{chrono::milliseconds{utcInMillisecs(index)}}; };
+
+	cout << "group,name,threads,calls,ns_per_op,allocs_per_op,items_per_s,checksum" << endl;
+
+	// parsers
+	bench("legacy", "parseStringToUtcInSecs", [&](size_t index) { return legacyParseStringToUtcInSecs(secondsInputs[index % inputsCount]); });
+	bench("legacy", "parseUtcStringToUtcInMillisecs", [&](size_t index) {
+		return legacyParseUtcStringToUtcInMillisecs(milliSecondsInputs[index % inputsCount]);
+	});
+	bench("parse", "parseStringToUtcInSecs", [&](size_t index) {
+		return static_cast<int64_t>(Datetime::parseStringToUtcInSecs(secondsInputs[index % inputsCount]));
+	});
+	bench("parse", "parseStringToUtcInSecs (get_time)", [&](size_t index) {
+		return static_cast<int64_t>(Datetime::parseStringToUtcInSecs(secondsInputs[index % inputsCount], "%Y-%m-%dT%H:%M"));
+	});
+	bench("parse", "parseUtcStringToUtcInMillisecs", [&](size_t index) {
+		return Datetime::parseUtcStringToUtcInMillisecs(milliSecondsInputs[index % inputsCount]);
+	});
+	bench("parse", "parseIsoUtcInSecs", [&](size_t index) {
+		time_t utcInSecs = 0;
+		Datetime::parseIsoUtcInSecs(secondsInputs[index % inputsCount], &utcInSecs);
+		return static_cast<int64_t>(utcInSecs);
+	});
+	bench("parse", "parseIsoUtcInMillisecs", [&](size_t index) {
+		int64_t utcInMillisecs = 0;
+		Datetime::parseIsoUtcInMillisecs(milliSecondsInputs[index % inputsCount], &utcInMillisecs);
+		return utcInMillisecs;
+	});
+	bench("parse", "sDateMilliSecondsToUtc", [&](size_t index) { return Datetime::sDateMilliSecondsToUtc(milliSecondsInputs[index % inputsCount]); });
+	bench("parse", "sDateMilliSecondsToUtc (offset)", [&](size_t index) { return Datetime::sDateMilliSecondsToUtc(offsetInputs[index % inputsCount]); });
+	bench("parse", "iso8610ToUtc", [&](size_t index) {
+		return static_cast<int64_t>(Datetime::iso8610ToUtc(offsetInputs[index % inputsCount], true));
+	});
+	bench("parse", "tryParseStringToUtcInSecs", [&](size_t index) {
+		return Datetime::tryParseStringToUtcInSecs(secondsInputs[index % inputsCount]).value_or(-1);
+	});
+	bench("parse", "trySDateMilliSecondsToUtc", [&](size_t index) {
+		return Datetime::trySDateMilliSecondsToUtc(offsetInputs[index % inputsCount]).value_or(-1);
+	});
+	bench("parse", "trySDateMilliSecondsToUtc (malformed)", [&](size_t index) {
+		return Datetime::trySDateMilliSecondsToUtc(malformedInputs[index % inputsCount]).value_or(-1);
+	});
+	bench("parse", "tryIso8610ToUtc", [&](size_t index) { return Datetime::tryIso8610ToUtc(offsetInputs[index % inputsCount], true).value_or(-1); });
+	bench("parse", "parseIso8601ToUtcInNanosecs", [&](size_t index) {
+		return Datetime::parseIso8601ToUtcInNanosecs(milliSecondsInputs[index % inputsCount]).value_or(-1);
+	});
+	bench("parse", "parseIso8601ToUtc (micros)", [&](size_t index) {
+		return Datetime::parseIso8601ToUtc(milliSecondsInputs[index % inputsCount], Datetime::Precision::Micros).value_or(-1);
+	});
+	bench("parse", "parseIso8601ToUtcInNanosecs (offset)", [&](size_t index) {
+		return Datetime::parseIso8601ToUtcInNanosecs(offsetInputs[index % inputsCount]).value_or(-1);
+	});
+	bench("parse", "sTimeToMilliSecs", [&](size_t index) {
+		return static_cast<int64_t>(Datetime::sTimeToMilliSecs(secondsInputs[index % inputsCount].substr(11, 5)));
+	});
+	for (const auto &[name, inputs, fieldWidth] :
+		 {make_tuple("parseUtcInMillisecsBatch (24)", &milliSecondsInputs, 24), make_tuple("parseUtcInMillisecsBatch (28)", &offsetInputs, 28)})
+	{
+		string column;
+		for (const string &input : *inputs)
+			column += input;
+		bench(
+			"parse", name,
+			[&column, fieldWidth](size_t)
+			{
+				thread_local vector<int64_t> utcInMillisecs(inputsCount);
+				thread_local vector<uint8_t> valid(inputsCount);
+				return static_cast<int64_t>(Datetime::parseUtcInMillisecsBatch(column, fieldWidth, utcInMillisecs, valid));
+			},
+			inputsCount
+		);
+	}
+
+	// format
+	{
+		const Datetime::Formatter formatter("%Y-%m-%dT%H:%M:%SZ", "seconds");
+		const Datetime::Formatter millisFormatter("%Y-%m-%dT%H:%M:%SZ", "millis");
+
+		bench("legacy", "dateTimeFormat", [&](size_t index) {
+			return static_cast<int64_t>(legacyDateTimeFormat(utcInMillisecs(index), "%Y-%m-%dT%H:%M:%SZ").size());
+		});
+		bench("format", "dateTimeFormat (ms)", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::dateTimeFormat(utcInMillisecs(index)).size());
+		});
+		bench("format", "dateTimeFormat (ms millis)", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::dateTimeFormat(utcInMillisecs(index), "%Y-%m-%dT%H:%M:%SZ", "millis").size());
+		});
+		bench("format", "dateTimeFormat (ms Precision::Seconds)", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::dateTimeFormat(utcInMillisecs(index), "%Y-%m-%dT%H:%M:%SZ", Datetime::Precision::Seconds).size());
+		});
+		bench("format", "dateTimeFormat (time_point Precision::Micros)", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::dateTimeFormat(timePoint(index), "%Y-%m-%dT%H:%M:%SZ", Datetime::Precision::Micros).size());
+		});
+		bench("format", "dateTimeFormat (time_point Precision::Nanos)", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::dateTimeFormat(timePoint(index), "%Y-%m-%dT%H:%M:%SZ", Datetime::Precision::Nanos).size());
+		});
+		bench("format", "dateTimeFormat (ms %a %b)", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::dateTimeFormat(utcInMillisecs(index), "%a %d %b %Y %H:%M:%S").size());
+		});
+		bench("format", "dateTimeFormat (time_point)", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::dateTimeFormat(timePoint(index)).size());
+		});
+		bench("format", "dateTimeFormat (tm)", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::dateTimeFormat(localTms[index % inputsCount]).size());
+		});
+		bench("format", "dateTimeFormat (buffer ms)", [&](size_t index) {
+			char buffer[64];
+			return static_cast<int64_t>(Datetime::dateTimeFormat(buffer, utcInMillisecs(index)));
+		});
+		bench("format", "dateTimeFormat (buffer time_point)", [&](size_t index) {
+			char buffer[64];
+			return static_cast<int64_t>(Datetime::dateTimeFormat(buffer, timePoint(index)));
+		});
+		bench("format", "dateTimeFormat (buffer tm)", [&](size_t index) {
+			char buffer[64];
+			return static_cast<int64_t>(Datetime::dateTimeFormat(buffer, localTms[index % inputsCount]));
+		});
+		bench("format", "Formatter::format", [&](size_t index) { return static_cast<int64_t>(formatter.format(utcInMillisecs(index)).size()); });
+		bench("format", "Formatter::format (millis)", [&](size_t index) {
+			return static_cast<int64_t>(millisFormatter.format(utcInMillisecs(index)).size());
+		});
+		bench("format", "Formatter::format (buffer)", [&](size_t index) {
+			char buffer[64];
+			return static_cast<int64_t>(formatter.format(buffer, utcInMillisecs(index)));
+		});
+		bench("format", "utcToUtcString", [&](size_t index) { return static_cast<int64_t>(Datetime::utcToUtcString(utcTime(index)).size()); });
+		bench("format", "utcToUtcString (buffer)", [&](size_t index) {
+			char buffer[64];
+			return static_cast<int64_t>(Datetime::utcToUtcString(buffer, utcTime(index)));
+		});
+		bench("format", "utcToLocalString", [&](size_t index) { return static_cast<int64_t>(Datetime::utcToLocalString(utcTime(index)).size()); });
+		bench("format", "utcToLocalString (buffer)", [&](size_t index) {
+			char buffer[64];
+			return static_cast<int64_t>(Datetime::utcToLocalString(buffer, utcTime(index)));
+		});
+		bench("format", "timePointAsUtcString", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::timePointAsUtcString(timePoint(index)).size());
+		});
+		bench("format", "timePointAsUtcString (buffer)", [&](size_t index) {
+			char buffer[64];
+			return static_cast<int64_t>(Datetime::timePointAsUtcString(buffer, timePoint(index)));
+		});
+		bench("format", "timePointAsLocalString", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::timePointAsLocalString(timePoint(index)).size());
+		});
+		bench("format", "timePointAsLocalString (buffer)", [&](size_t index) {
+			char buffer[64];
+			return static_cast<int64_t>(Datetime::timePointAsLocalString(buffer, timePoint(index)));
+		});
+		bench("format", "localToUtcString", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::localToUtcString(utcTms[index % inputsCount]).size());
+		});
+
+		// sorted time series, a value every 250 ms
+		vector<uint64_t> column(inputsCount);
+		for (size_t index = 0; index < inputsCount; index++)
+			column[index] = 1614354075765 + index * 250;
+		for (const auto &[name, columnFormatter] : {pair{"Formatter::format (column loop)", &formatter}, pair{"Formatter::format (column loop millis)", &millisFormatter}})
+			bench("format", name, [&, columnFormatter](size_t) {
+				thread_local string chars;
+				thread_local vector<int32_t> offsets;
+				chars.clear();
+				offsets.assign(1, 0);
+				char buffer[64];
+				for (const uint64_t value : column)
+				{
+					chars.append(buffer, columnFormatter->format(buffer, value));
+					offsets.push_back(static_cast<int32_t>(chars.size()));
+				}
+				return static_cast<int64_t>(chars.size());
+			}, inputsCount);
+		for (const auto &[name, columnFormatter] : {pair{"Formatter::formatColumn", &formatter}, pair{"Formatter::formatColumn (millis)", &millisFormatter}})
+			bench("format", name, [&, columnFormatter](size_t) {
+				thread_local string chars;
+				thread_local vector<int32_t> offsets;
+				chars.clear();
+				offsets.clear();
+				columnFormatter->formatColumn(column, chars, offsets);
+				return static_cast<int64_t>(chars.size());
+			}, inputsCount);
+	}
+
+	// timestamp codec: a value about every second (jitter of some ms)
+	{
+		vector<int64_t> series(inputsCount);
+		for (size_t index = 0; index < inputsCount; index++)
+			series[index] = 1614354075765 + static_cast<int64_t>(index) * 1000 + static_cast<int64_t>(index * 7919 % 50);
+		const Datetime::TimestampColumn timestampColumn(series);
+		const Datetime::Formatter millisFormatter("%Y-%m-%dT%H:%M:%SZ", Datetime::Precision::Millis);
+
+		bench("codec", "TimestampColumn (encode)", [&](size_t) {
+			const Datetime::TimestampColumn encoded(series);
+			return static_cast<int64_t>(encoded.bytes());
+		}, inputsCount);
+		bench("codec", "TimestampColumn::decode", [&](size_t) {
+			thread_local vector<int64_t> decoded(inputsCount);
+			timestampColumn.decode(decoded);
+			return decoded.back();
+		}, inputsCount);
+		bench("codec", "TimestampColumn::operator[]", [&](size_t index) { return timestampColumn[index * 7919 % inputsCount]; });
+		bench("codec", "TimestampColumn::formatBlock (millis)", [&](size_t) {
+			thread_local string chars;
+			thread_local vector<int32_t> offsets;
+			chars.clear();
+			offsets.clear();
+			for (size_t block = 0; block < timestampColumn.blocks(); block++)
+				timestampColumn.formatBlock(block, millisFormatter, chars, offsets);
+			return static_cast<int64_t>(chars.size());
+		}, inputsCount);
+	}
+
+	// durations of a playlist: up to about 3 hours, millisecond precision
+	{
+		vector<chrono::nanoseconds> durations(inputsCount);
+		vector<string> clockInputs;
+		vector<string> isoInputs;
+		for (size_t index = 0; index < inputsCount; index++)
+		{
+			durations[index] = chrono::milliseconds(static_cast<int64_t>(index * 7919 % 10800000));
+			clockInputs.push_back(Datetime::formatDuration(durations[index]));
+			isoInputs.push_back(Datetime::formatDuration(durations[index], Datetime::DurationFormat::Iso8601));
+		}
+		string clockColumn;
+		vector<int32_t> clockOffsets;
+		Datetime::formatDurationColumn(durations, clockColumn, clockOffsets);
+
+		bench("duration", "parseDuration (clock)", [&](size_t index) {
+			return Datetime::parseDuration(clockInputs[index % inputsCount]).value_or(chrono::nanoseconds(-1)).count();
+		});
+		bench("duration", "parseDuration (ISO 8601)", [&](size_t index) {
+			return Datetime::parseDuration(isoInputs[index % inputsCount]).value_or(chrono::nanoseconds(-1)).count();
+		});
+		bench("duration", "parseDurationColumn (clock)", [&](size_t) {
+			thread_local vector<chrono::nanoseconds> parsed(inputsCount);
+			thread_local vector<uint8_t> valid(inputsCount);
+			return static_cast<int64_t>(Datetime::parseDurationColumn(clockColumn, clockOffsets, parsed, valid));
+		}, inputsCount);
+		bench("duration", "formatDuration (buffer clock)", [&](size_t index) {
+			char buffer[64];
+			return static_cast<int64_t>(Datetime::formatDuration(buffer, durations[index % inputsCount]));
+		});
+		bench("duration", "formatDuration (buffer ISO 8601)", [&](size_t index) {
+			char buffer[64];
+			return static_cast<int64_t>(Datetime::formatDuration(buffer, durations[index % inputsCount], Datetime::DurationFormat::Iso8601));
+		});
+		bench("duration", "formatDurationColumn (clock)", [&](size_t) {
+			thread_local string chars;
+			thread_local vector<int32_t> offsets;
+			chars.clear();
+			offsets.clear();
+			Datetime::formatDurationColumn(durations, chars, offsets);
+			return static_cast<int64_t>(chars.size());
+		}, inputsCount);
+	}
+
+	// schedules: the next 16 slots of the channels, a rule per channel
+	{
+		constexpr size_t occurrencesCount = 16;
+		const int64_t after = 1614354075765;
+		vector<Datetime::Recurrence> recurrences;
+		for (size_t index = 0; index < inputsCount; index++)
+		{
+			Datetime::Recurrence::Rule rule;
+			rule.frequency = static_cast<Datetime::Recurrence::Frequency>(index % 3);
+			rule.hour = static_cast<uint8_t>(index % 24);
+			rule.minute = static_cast<uint8_t>(index * 7 % 60);
+			rule.weekDays = static_cast<uint8_t>(1 + index % 127);
+			rule.monthDays = static_cast<uint32_t>(1 + index * 7919 % 0xFFFF) << 1;
+			recurrences.emplace_back(rule);
+		}
+
+		bench("legacy", "next daily occurrences (localtime_r mktime)", [&](size_t index) {
+			int64_t occurrences[occurrencesCount];
+			legacyNextDailyOccurrences(after + static_cast<int64_t>(index) * 60000, 20, 30, occurrences);
+			return occurrences[occurrencesCount - 1];
+		}, occurrencesCount);
+		bench("schedule", "Recurrence::next (daily)", [&](size_t index) {
+			int64_t occurrences[occurrencesCount];
+			recurrences[0].next(after + static_cast<int64_t>(index) * 60000, occurrences);
+			return occurrences[occurrencesCount - 1];
+		}, occurrencesCount);
+		bench("schedule", "Recurrence::next (batch)", [&](size_t) {
+			thread_local vector<int64_t> occurrences(inputsCount * occurrencesCount);
+			Datetime::Recurrence::next(recurrences, after, occurrencesCount, occurrences);
+			return occurrences.back();
+		}, inputsCount * occurrencesCount);
+	}
+
+	// now clocks
+	bench("clock", "nowUTCInMilliSecs (secs millis)", [](size_t) {
+		unsigned long long nowUTCInSecs;
+		unsigned long additionalMilliSecs;
+		Datetime::nowUTCInMilliSecs(&nowUTCInSecs, &additionalMilliSecs, nullptr);
+		return static_cast<int64_t>(nowUTCInSecs + additionalMilliSecs);
+	});
+	bench("clock", "nowUTCInMilliSecs", [](size_t) {
+		unsigned long long nowUTCInMilliSecs;
+		Datetime::nowUTCInMilliSecs(&nowUTCInMilliSecs, nullptr);
+		return static_cast<int64_t>(nowUTCInMilliSecs);
+	});
+	bench("clock", "nowLocalInMilliSecs", [](size_t) {
+		unsigned long long nowLocalInMilliSecs;
+		Datetime::nowLocalInMilliSecs(&nowLocalInMilliSecs);
+		return static_cast<int64_t>(nowLocalInMilliSecs);
+	});
+	bench("clock", "nowLocalTime", [](size_t) { return static_cast<int64_t>(Datetime::nowLocalTime("%Y-%m-%d %H:%M:%S_", true).size()); });
+	bench("clock", "nowLocalTime (buffer)", [](size_t) {
+		char buffer[64];
+		return static_cast<int64_t>(Datetime::nowLocalTime(buffer, "%Y-%m-%d %H:%M:%S_", true));
+	});
+	bench("clock", "get_tm_LocalTime", [](size_t) {
+		tm tmDateTime;
+		unsigned long milliSecs;
+		Datetime::get_tm_LocalTime(&tmDateTime, &milliSecs);
+		return static_cast<int64_t>(tmDateTime.tm_sec + milliSecs);
+	});
+	bench("clock", "getTimeZoneInformation", [](size_t) { return static_cast<int64_t>(Datetime::getTimeZoneInformation()); });
+	bench("clock", "utcOffsetInMinutes", [](size_t) { return static_cast<int64_t>(Datetime::utcOffsetInMinutes()); });
+	Datetime::CachedClock::start();
+	bench("clock", "CachedClock::nowUTCInMilliSecs", [](size_t) { return Datetime::CachedClock::nowUTCInMilliSecs(); });
+	bench("clock", "CachedClock::now", [](size_t) {
+		Datetime::CachedClock::Snapshot snapshot;
+		Datetime::CachedClock::now(&snapshot);
+		return snapshot.utcInMilliSecs;
+	});
+	bench("clock", "CachedClock::get_tm_LocalTime", [](size_t) {
+		tm tmDateTime;
+		unsigned long milliSecs;
+		Datetime::CachedClock::get_tm_LocalTime(&tmDateTime, &milliSecs);
+		return static_cast<int64_t>(tmDateTime.tm_sec + milliSecs);
+	});
+	Datetime::CachedClock::stop();
+	bench("legacy", "clock_gettime (CLOCK_REALTIME)", [](size_t) {
+		timespec now{};
+		clock_gettime(CLOCK_REALTIME, &now);
+		return static_cast<int64_t>(now.tv_nsec);
+	});
+	bench("clock", "FastClock::now", [](size_t) { return Datetime::FastClock::now().time_since_epoch().count(); });
+	bench("clock", "dateTimeFormat (buffer FastClock::now Precision::Nanos)", [](size_t) {
+		char buffer[64];
+		return static_cast<int64_t>(Datetime::dateTimeFormat(buffer, Datetime::FastClock::now(), "%Y-%m-%dT%H:%M:%SZ", Datetime::Precision::Nanos));
+	});
+
+	// local/UTC conversions
+	bench("legacy", "localtime_r", [&](size_t index) {
+		const time_t utc = utcTime(index);
+		tm localTime;
+		localtime_r(&utc, &localTime);
+		return static_cast<int64_t>(localTime.tm_hour);
+	});
+	bench("convert", "utcSecondsToLocalTime", [&](size_t index) {
+		return static_cast<int64_t>(Datetime::utcSecondsToLocalTime(utcTime(index)).tm_hour);
+	});
+	// serie ordinata (un secondo per riga): stessi giorni, con e senza cache
+	bench("convert", "utcSecondsToLocalTime sorted", [&](size_t index) {
+		return static_cast<int64_t>(Datetime::utcSecondsToLocalTime(1614354075 + static_cast<time_t>(index)).tm_hour);
+	});
+	Datetime::setLocalDayCacheSize(0);
+	bench("convert", "utcSecondsToLocalTime sorted (no day cache)", [&](size_t index) {
+		return static_cast<int64_t>(Datetime::utcSecondsToLocalTime(1614354075 + static_cast<time_t>(index)).tm_hour);
+	});
+	Datetime::setLocalDayCacheSize(64);
+	bench("convert", "convertFromUTCToLocal", [&](size_t index) {
+		tm localTime;
+		Datetime::convertFromUTCToLocal(utcTime(index), &localTime);
+		return static_cast<int64_t>(localTime.tm_hour);
+	});
+	bench("convert", "convertFromUTCInSecondsToBreakDownUTC", [&](size_t index) {
+		tm utcTm;
+		Datetime::convertFromUTCInSecondsToBreakDownUTC(utcTime(index), &utcTm);
+		return static_cast<int64_t>(utcTm.tm_hour);
+	});
+	bench("convert", "localToUTC", [&](size_t index) {
+		tm localTime = localTms[index % inputsCount];
+		return static_cast<int64_t>(Datetime::localToUTC(&localTime));
+	});
+	bench("convert", "convertFromLocalToUTC (tm)", [&](size_t index) {
+		tm localTime = localTms[index % inputsCount];
+		tm utcTm;
+		Datetime::convertFromLocalToUTC(&localTime, &utcTm);
+		return static_cast<int64_t>(utcTm.tm_hour);
+	});
+	bench("convert", "convertFromLocalDateTimeToLocalInSecs", [&](size_t index) {
+		const tm &localTime = localTms[index % inputsCount];
+		unsigned long long localInSecs;
+		Datetime::convertFromLocalDateTimeToLocalInSecs(
+			localTime.tm_year + 1900, localTime.tm_mon + 1, localTime.tm_mday, localTime.tm_hour, localTime.tm_min, localTime.tm_sec, -1,
+			&localInSecs
+		);
+		return static_cast<int64_t>(localInSecs);
+	});
+	bench("convert", "addSeconds", [&](size_t index) {
+		const tm &localTime = localTms[index % inputsCount];
+		unsigned long year, month, day, hour, minutes, seconds;
+		bool daylightSavingTime;
+		Datetime::addSeconds(
+			localTime.tm_year + 1900, localTime.tm_mon + 1, localTime.tm_mday, localTime.tm_hour, localTime.tm_min, localTime.tm_sec, -1, 86400 * 3 + 7,
+			&year, &month, &day, &hour, &minutes, &seconds, &daylightSavingTime
+		);
+		return static_cast<int64_t>(day + seconds);
+	});
+	bench("legacy", "addSeconds (mktime)", [&](size_t index) {
+		tm localTime = localTms[index % inputsCount];
+		localTime.tm_isdst = -1;
+		const time_t utcTime = mktime(&localTime) + 86400 * 3 + 7;
+		localtime_r(&utcTime, &localTime);
+		return static_cast<int64_t>(localTime.tm_mday + localTime.tm_sec);
+	});
+	const auto civilDateTime = [&](const size_t index) {
+		const tm &localTime = localTms[index % inputsCount];
+		return Datetime::CivilDateTime{
+			localTime.tm_year + 1900,
+			static_cast<uint8_t>(localTime.tm_mon + 1),
+			static_cast<uint8_t>(localTime.tm_mday),
+			static_cast<uint8_t>(localTime.tm_hour),
+			static_cast<uint8_t>(localTime.tm_min),
+			static_cast<uint8_t>(localTime.tm_sec)
+		};
+	};
+	bench("convert", "addSeconds (CivilDateTime)", [&](size_t index) {
+		const Datetime::CivilDateTime dateTime = Datetime::addSeconds(civilDateTime(index), 86400 * 3 + 7);
+		return static_cast<int64_t>(dateTime.day + dateTime.second);
+	});
+	bench("convert", "addDays", [&](size_t index) {
+		const Datetime::CivilDateTime dateTime = Datetime::addDays(civilDateTime(index), 3);
+		return static_cast<int64_t>(dateTime.day + dateTime.second);
+	});
+	bench("convert", "addMonths", [&](size_t index) {
+		const Datetime::CivilDateTime dateTime = Datetime::addMonths(civilDateTime(index), 1);
+		return static_cast<int64_t>(dateTime.day + dateTime.second);
+	});
+	bench("convert", "isLeapYear", [](size_t index) {
+		bool leapYear;
+		Datetime::isLeapYear(1900 + index % 400, &leapYear);
+		return static_cast<int64_t>(leapYear);
+	});
+	bench("convert", "getLastDayOfMonth", [](size_t index) {
+		unsigned long lastDayOfMonth;
+		Datetime::getLastDayOfMonth(1900 + index % 400, 1 + index % 12, &lastDayOfMonth);
+		return static_cast<int64_t>(lastDayOfMonth);
+	});
+	bench("convert", "civilToUtcInSecs", [&](size_t index) {
+		const tm &utcTm = utcTms[index % inputsCount];
+		return Datetime::civilToUtcInSecs(utcTm.tm_year + 1900, utcTm.tm_mon + 1, utcTm.tm_mday, utcTm.tm_hour, utcTm.tm_min, utcTm.tm_sec);
+	});
+	bench("convert", "civilFromDays", [&](size_t index) {
+		int64_t year;
+		int month;
+		int day;
+		Datetime::civilFromDays(utcTime(index) / 86400, &year, &month, &day);
+		return year + month + day;
+	});
+
+	// named time zones
+	try
+	{
+		const Datetime::TimeZone timeZone = Datetime::TimeZone::locate("America/New_York");
+
+		bench("timezone", "TimeZone::locate", [](size_t) { return static_cast<int64_t>(Datetime::TimeZone::locate("America/New_York").name().size()); });
+		bench("timezone", "TimeZone::toLocal", [&](size_t index) { return static_cast<int64_t>(timeZone.toLocal(utcTime(index)).tm_hour); });
+		bench("timezone", "TimeZone::toUtc", [&](size_t index) {
+			return static_cast<int64_t>(timeZone.toUtc(utcTms[index % inputsCount]));
+		});
+		bench("timezone", "utcToLocalString (TimeZone)", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::utcToLocalString(utcTime(index), timeZone).size());
+		});
+		bench("timezone", "utcToLocalString (buffer TimeZone)", [&](size_t index) {
+			char buffer[64];
+			return static_cast<int64_t>(Datetime::utcToLocalString(buffer, utcTime(index), timeZone));
+		});
+		bench("timezone", "timePointAsLocalString (TimeZone)", [&](size_t index) {
+			return static_cast<int64_t>(Datetime::timePointAsLocalString(timePoint(index), timeZone).size());
+		});
+		bench("timezone", "timePointAsLocalString (buffer TimeZone)", [&](size_t index) {
+			char buffer[64];
+			return static_cast<int64_t>(Datetime::timePointAsLocalString(buffer, timePoint(index), timeZone));
+		});
+
+		// sorted time series, a value every 10 s
+		vector<int64_t> series(inputsCount);
+		for (size_t index = 0; index < inputsCount; index++)
+			series[index] = 1614354075765 + static_cast<int64_t>(index) * 10000;
+		bench("timezone", "hour bucket (utcSecondsToLocalTime mktime loop)", [&](size_t) {
+			int64_t sum = 0;
+			for (const int64_t utcInMillisecs : series)
+			{
+				tm localTime = Datetime::utcSecondsToLocalTime(utcInMillisecs / 1000);
+				localTime.tm_min = 0;
+				localTime.tm_sec = 0;
+				sum += mktime(&localTime);
+			}
+			return sum;
+		}, inputsCount);
+		for (const auto &[name, bucket] : {pair{"localBuckets (hour)", Datetime::Bucket::Hour}, pair{"localBuckets (iso week)", Datetime::Bucket::IsoWeek}})
+			bench("timezone", name, [&, bucket](size_t) {
+				thread_local vector<int64_t> bucketStarts(inputsCount);
+				thread_local vector<uint8_t> isoWeeks(inputsCount);
+				Datetime::localBuckets(series, timeZone, bucket, bucketStarts, isoWeeks);
+				return bucketStarts.back() + isoWeeks.back();
+			}, inputsCount);
+	}
+	catch (exception &e)
+	{
+		cerr << "timezone benchmarks skipped: " << e.what() << endl;
+	}
+
+	if (options.stats)
+	{
+		const Datetime::Stats stats = Datetime::stats();
+		if (!stats.enabled)
+			cerr << "Datetime is built without DATETIME_STATS" << endl;
+		cout << "function,calls,failures,latency_samples,avg_ns" << endl;
+		for (const Datetime::FunctionStats &function : stats.functions)
+			cout << format(
+						"\"{}\",{},{},{},{:.1f}", function.name, function.calls, function.failures, function.latencySamples,
+						function.latencySamples ? function.sampledNanosecs / function.latencySamples : 0.0
+					)
+				 << endl;
+	}
+
+	return 0;
+}
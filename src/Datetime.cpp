@@ -25,517 +25,4782 @@
 #include "ThreadLogger.h"
 #include "spdlog/spdlog.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iomanip>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <stdexcept>
+#include <thread>
+#include <unordered_map>
 #ifdef _WIN32
 #include <Windows.h>
 #else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 #endif
 #include <format>
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+// SSE4.1/AVX2 kernels, selected at runtime
+#define DATETIME_X86_SIMD
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
 
-// 2021-02-26 15:41:15
-std::string Datetime::timePointAsLocalString(std::chrono::system_clock::time_point t)
+#ifdef DATETIME_STATS
+namespace
 {
-	tm tmDateTime;
-	// char strDateTime[64];
-	time_t utcTime = std::chrono::system_clock::to_time_t(t);
-#ifdef WIN32
-	localtime_s(&tmDateTime, &utcTime);
+// funzioni strumentate: identificatore, nome in Datetime::FunctionStats
+#define DATETIME_STATS_FUNCTIONS(X) \
+	X(timeZoneLocate, "TimeZone::locate") \
+	X(timeZoneUtcOffset, "TimeZone::utcOffset") \
+	X(timeZoneToLocal, "TimeZone::toLocal") \
+	X(timeZoneToUtc, "TimeZone::toUtc") \
+	X(localBuckets, "localBuckets") \
+	X(localBucketsTimeZone, "localBuckets (TimeZone)") \
+	X(timePointAsLocalString, "timePointAsLocalString") \
+	X(timePointAsLocalStringBuffer, "timePointAsLocalString (buffer)") \
+	X(timePointAsLocalStringTimeZone, "timePointAsLocalString (TimeZone)") \
+	X(timePointAsLocalStringBufferTimeZone, "timePointAsLocalString (buffer TimeZone)") \
+	X(timePointAsUtcString, "timePointAsUtcString") \
+	X(timePointAsUtcStringBuffer, "timePointAsUtcString (buffer)") \
+	X(localToUtcString, "localToUtcString") \
+	X(iso8610ToUtc, "iso8610ToUtc") \
+	X(nowUTCInMilliSecsSecsMillis, "nowUTCInMilliSecs (secs millis)") \
+	X(nowUTCInMilliSecs, "nowUTCInMilliSecs") \
+	X(nowLocalInMilliSecs, "nowLocalInMilliSecs") \
+	X(dateTimeFormatMs, "dateTimeFormat (ms)") \
+	X(dateTimeFormatTimePoint, "dateTimeFormat (time_point)") \
+	X(dateTimeFormatMsPrecision, "dateTimeFormat (ms Precision)") \
+	X(dateTimeFormatTimePointPrecision, "dateTimeFormat (time_point Precision)") \
+	X(dateTimeFormatBufferMs, "dateTimeFormat (buffer ms)") \
+	X(dateTimeFormatBufferTimePoint, "dateTimeFormat (buffer time_point)") \
+	X(dateTimeFormatBufferMsPrecision, "dateTimeFormat (buffer ms Precision)") \
+	X(dateTimeFormatBufferTimePointPrecision, "dateTimeFormat (buffer time_point Precision)") \
+	X(dateTimeFormatColumn, "dateTimeFormatColumn") \
+	X(precisionFromString, "precisionFromString") \
+	X(formatterConstructor, "Formatter::Formatter") \
+	X(formatterFormatMs, "Formatter::format (ms)") \
+	X(formatterFormatTimePoint, "Formatter::format (time_point)") \
+	X(formatterFormatBufferMs, "Formatter::format (buffer ms)") \
+	X(formatterFormatBufferTimePoint, "Formatter::format (buffer time_point)") \
+	X(formatterFormatColumn, "Formatter::formatColumn") \
+	X(dateTimeFormatTm, "dateTimeFormat (tm)") \
+	X(dateTimeFormatBufferTm, "dateTimeFormat (buffer tm)") \
+	X(nowLocalTime, "nowLocalTime") \
+	X(nowLocalTimeBuffer, "nowLocalTime (buffer)") \
+	X(getTimeZoneInformationPointer, "getTimeZoneInformation (long *)") \
+	X(getTimeZoneInformation, "getTimeZoneInformation") \
+	X(utcOffsetInMinutes, "utcOffsetInMinutes") \
+	X(getTmLocalTime, "get_tm_LocalTime") \
+	X(convertFromLocalToUTCTimeT, "convertFromLocalToUTC (time_t)") \
+	X(localToUTC, "localToUTC") \
+	X(convertFromLocalToUTCTm, "convertFromLocalToUTC (tm)") \
+	X(convertFromUTCInSecondsToBreakDownUTC, "convertFromUTCInSecondsToBreakDownUTC") \
+	X(convertFromLocalDateTimeToLocalInSecs, "convertFromLocalDateTimeToLocalInSecs") \
+	X(utcSecondsToLocalTime, "utcSecondsToLocalTime") \
+	X(convertFromUTCToLocal, "convertFromUTCToLocal") \
+	X(utcSecondsToLocalTimeTimeZone, "utcSecondsToLocalTime (TimeZone)") \
+	X(convertFromUTCToLocalTimeZone, "convertFromUTCToLocal (TimeZone)") \
+	X(localToUTCTimeZone, "localToUTC (TimeZone)") \
+	X(addSeconds, "addSeconds") \
+	X(addSecondsCivil, "addSeconds (CivilDateTime)") \
+	X(addSecondsCivilTimeZone, "addSeconds (CivilDateTime TimeZone)") \
+	X(addDays, "addDays") \
+	X(addDaysTimeZone, "addDays (TimeZone)") \
+	X(addMonths, "addMonths") \
+	X(addMonthsTimeZone, "addMonths (TimeZone)") \
+	X(isLeapYear, "isLeapYear (bool *)") \
+	X(getLastDayOfMonth, "getLastDayOfMonth (unsigned long *)") \
+	X(parseIsoUtcInSecs, "parseIsoUtcInSecs") \
+	X(parseIsoUtcInMillisecs, "parseIsoUtcInMillisecs") \
+	X(tryParseStringToUtcInSecs, "tryParseStringToUtcInSecs") \
+	X(trySDateMilliSecondsToUtc, "trySDateMilliSecondsToUtc") \
+	X(tryIso8610ToUtc, "tryIso8610ToUtc") \
+	X(parseIso8601ToUtcInNanosecs, "parseIso8601ToUtcInNanosecs") \
+	X(parseIso8601ToUtc, "parseIso8601ToUtc") \
+	X(tryGetLastDayOfMonth, "tryGetLastDayOfMonth") \
+	X(parseUtcInMillisecsBatch, "parseUtcInMillisecsBatch") \
+	X(parseStringToUtcInSecs, "parseStringToUtcInSecs") \
+	X(parseUtcStringToUtcInMillisecs, "parseUtcStringToUtcInMillisecs") \
+	X(sTimeToMilliSecs, "sTimeToMilliSecs") \
+	X(utcToUtcString, "utcToUtcString") \
+	X(utcToUtcStringBuffer, "utcToUtcString (buffer)") \
+	X(utcToUtcStringPrecision, "utcToUtcString (Precision)") \
+	X(utcToUtcStringBufferPrecision, "utcToUtcString (buffer Precision)") \
+	X(utcToLocalString, "utcToLocalString") \
+	X(utcToLocalStringBuffer, "utcToLocalString (buffer)") \
+	X(utcToLocalStringTimeZone, "utcToLocalString (TimeZone)") \
+	X(utcToLocalStringBufferTimeZone, "utcToLocalString (buffer TimeZone)") \
+	X(sDateMilliSecondsToUtc, "sDateMilliSecondsToUtc") \
+	X(cachedClockNow, "CachedClock::now") \
+	X(cachedClockNowUTCInMilliSecs, "CachedClock::nowUTCInMilliSecs") \
+	X(cachedClockGetTmLocalTime, "CachedClock::get_tm_LocalTime") \
+	X(fastClockNow, "FastClock::now") \
+	X(timestampColumnAppend, "TimestampColumn::append") \
+	X(timestampColumnAppendSpan, "TimestampColumn::append (span)") \
+	X(timestampColumnAt, "TimestampColumn::operator[]") \
+	X(timestampColumnDecodeBlock, "TimestampColumn::decodeBlock") \
+	X(timestampColumnDecode, "TimestampColumn::decode") \
+	X(timestampColumnFormatBlock, "TimestampColumn::formatBlock") \
+	X(timestampColumnSerialize, "TimestampColumn::serialize") \
+	X(timestampColumnDeserialize, "TimestampColumn::deserialize") \
+	X(parseDuration, "parseDuration") \
+	X(formatDurationBuffer, "formatDuration (buffer)") \
+	X(formatDuration, "formatDuration") \
+	X(parseDurationColumn, "parseDurationColumn") \
+	X(formatDurationColumn, "formatDurationColumn") \
+	X(recurrenceNext, "Recurrence::next") \
+	X(recurrenceNextSpan, "Recurrence::next (span)") \
+	X(recurrenceNextBatch, "Recurrence::next (batch)")
+
+enum class StatsFunction : uint16_t
+{
+#define DATETIME_STATS_ENUM(id, name) id,
+	DATETIME_STATS_FUNCTIONS(DATETIME_STATS_ENUM)
+#undef DATETIME_STATS_ENUM
+	count
+};
+
+constexpr const char *statsFunctionNames[] = {
+#define DATETIME_STATS_NAME(id, name) name,
+	DATETIME_STATS_FUNCTIONS(DATETIME_STATS_NAME)
+#undef DATETIME_STATS_NAME
+};
+
+constexpr size_t statsFunctionsCount = static_cast<size_t>(StatsFunction::count);
+
+// TSC sugli x86 (pochi ns, convertito in ns da stats()), altrove i ns dello steady_clock
+inline uint64_t statsTicks()
+{
+#ifdef DATETIME_X86_SIMD
+	return __rdtsc();
 #else
-	localtime_r(&utcTime, &tmDateTime);
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 #endif
-
-	return std::format(
-		"{:0>4}-{:0>2}-{:0>2} {:0>2}:{:0>2}:{:0>2}", tmDateTime.tm_year + 1900, tmDateTime.tm_mon + 1, tmDateTime.tm_mday, tmDateTime.tm_hour,
-		tmDateTime.tm_min, tmDateTime.tm_sec
-	);
 }
 
-// 2021-02-26T15:41:15Z
-std::string Datetime::timePointAsUtcString(std::chrono::system_clock::time_point t)
+struct StatsCounters
 {
-	tm tmDateTime;
-	// char strDateTime[64];
-	time_t utcTime = std::chrono::system_clock::to_time_t(t);
-#ifdef _WIN32
-	gmtime_s(&tmDateTime, &utcTime);
-#else
-	gmtime_r(&utcTime, &tmDateTime);
-#endif
+	uint64_t calls;
+	uint64_t samples;
+	uint64_t ticks;
+	std::array<uint64_t, Datetime::statsFailureReasons> failures;
+	std::array<uint64_t, Datetime::statsLatencyBuckets> latency;
+};
 
-	return std::format(
-		"{:0>4}-{:0>2}-{:0>2}T{:0>2}:{:0>2}:{:0>2}Z", tmDateTime.tm_year + 1900, tmDateTime.tm_mon + 1, tmDateTime.tm_mday, tmDateTime.tm_hour,
-		tmDateTime.tm_min, tmDateTime.tm_sec
-	);
-}
+using StatsTotals = std::array<StatsCounters, statsFunctionsCount>;
 
-std::string Datetime::localToUtcString(tm localTime)
-{
-#ifdef _WIN32
-	time_t utcTime = _mkgmtime(&localTime);
-#else
-	time_t utcTime = timegm(&localTime);
-#endif
+class StatsShard;
 
-	return utcToUtcString(utcTime);
+struct StatsRegistry
+{
+	std::mutex mutex;
+	std::vector<const StatsShard *> shards;
+	// contatori dei thread terminati
+	StatsTotals retired{};
+	// calibrazione dei tick
+	const uint64_t startTicks = statsTicks();
+	const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+};
+
+// una chiamata ogni statsSampling misura la latenza: la lettura del TSC costa piu' dei contatori
+std::atomic<uint32_t> statsSampling = 16;
+
+StatsRegistry &statsRegistry()
+{
+	static StatsRegistry registry;
+	return registry;
 }
 
-
-// convert 2021-02-26T15:41:15.477+0100 (ISO8610) to utc
-uint64_t Datetime::iso8610ToUtc(const std::string& datetime, const bool millisecondsPrecision)
+// un solo writer (il thread), stats() legge con atomic_ref: nessun lock e nessun read-modify-write nella chiamata
+class StatsShard
 {
-	if (datetime.size() != 28)
+  public:
+	StatsShard()
 	{
-		const std::string errorMessage = std::format("Invalid datetime format, expected length is 28, but got {}: {}", datetime.length(), datetime);
-		LOG_ERROR(errorMessage);
-		throw std::runtime_error(errorMessage);
+		StatsRegistry &registry = statsRegistry();
+		std::lock_guard lock(registry.mutex);
+		registry.shards.push_back(this);
 	}
 
-	int offsetSeconds;
-	{
-		const char sign = datetime[datetime.size() - 5];
-		std::string offsetStr = datetime.substr(datetime.size() - 4, 4);
-		const int offsetHours = std::stoi(offsetStr.substr(0, 2));
-		const int offsetMinutes = std::stoi(offsetStr.substr(2, 2));
-		offsetSeconds = offsetHours * 3600 + offsetMinutes * 60;
-		if (sign == '-')
-			offsetSeconds = -offsetSeconds;
-	}
+	~StatsShard();
 
-	time_t utcTime = parseStringToUtcInSecs(datetime, "%Y-%m-%dT%H:%M:%S");
-	utcTime -= offsetSeconds;
+	StatsShard(const StatsShard &) = delete;
+	StatsShard &operator=(const StatsShard &) = delete;
 
-	if (millisecondsPrecision)
+	// inizio di uno scope: azzera l'Exception di un helper lanciato fuori da ogni scope e dice se misurare la latenza
+	bool enter()
 	{
-		const int milliSecs = std::stoi(datetime.substr(datetime.size() - 8, 3));
-		return utcTime * 1000 + milliSecs;
+		_exception = false;
+		if (--_sampleCountdown != 0)
+			return false;
+		_sampleCountdown = statsSampling.load(std::memory_order_relaxed);
+		return true;
 	}
-	return utcTime;
-}
-
-void Datetime::nowUTCInMilliSecs(unsigned long long *pullNowUTCInSecs, unsigned long *pulAdditionalMilliSecs, long *plTimeZoneDifferenceInHours)
-{
-#ifdef _WIN32
-	SYSTEMTIME stSystemTime;
-#else
-	struct timeval tvTimeval;
-#endif
 
-#ifdef _WIN32
-	GetLocalTime(&stSystemTime);
+	void record(const StatsFunction function, const int failure)
+	{
+		StatsCounters &counters = _functions[static_cast<size_t>(function)];
+		add(counters.calls, 1);
+		if (failure >= 0)
+			add(counters.failures[failure], 1);
+	}
 
-	(*pullNowUTCInSecs) = time(NULL);
-	(*pulAdditionalMilliSecs) = stSystemTime.wMilliseconds;
+	// throw di un helper senza StatsScope: Exception per il primo scope distrutto dallo unwinding
+	void markException() { _exception = true; }
 
-	if (plTimeZoneDifferenceInHours != (long *)NULL)
-		Datetime::getTimeZoneInformation(plTimeZoneDifferenceInHours);
-#else
-	if (plTimeZoneDifferenceInHours != (long *)NULL)
+	bool takeException()
 	{
-		struct timezone tz;
-
-		gettimeofday(&tvTimeval, &tz);
+		if (!_exception) [[likely]]
+			return false;
+		_exception = false;
+		return true;
+	}
 
-		*plTimeZoneDifferenceInHours = ((tz.tz_minuteswest / 60) * -1);
+	void recordLatency(const StatsFunction function, const uint64_t ticks)
+	{
+		StatsCounters &counters = _functions[static_cast<size_t>(function)];
+		add(counters.samples, 1);
+		add(counters.ticks, ticks);
+		add(counters.latency[std::min<size_t>(std::bit_width(ticks), Datetime::statsLatencyBuckets - 1)], 1);
 	}
-	else
+
+	void addTo(StatsTotals &totals) const
 	{
-		gettimeofday(&tvTimeval, NULL);
+		for (size_t function = 0; function < statsFunctionsCount; function++)
+		{
+			const StatsCounters &counters = _functions[function];
+			StatsCounters &total = totals[function];
+			total.calls += load(counters.calls);
+			total.samples += load(counters.samples);
+			total.ticks += load(counters.ticks);
+			for (size_t reason = 0; reason < Datetime::statsFailureReasons; reason++)
+				total.failures[reason] += load(counters.failures[reason]);
+			for (size_t bucket = 0; bucket < Datetime::statsLatencyBuckets; bucket++)
+				total.latency[bucket] += load(counters.latency[bucket]);
+		}
 	}
 
-	(*pullNowUTCInSecs) = tvTimeval.tv_sec;
-	(*pulAdditionalMilliSecs) = (tvTimeval.tv_usec / 1000);
-#endif
-}
+  private:
+	StatsTotals _functions{};
+	uint32_t _sampleCountdown = 1;
+	bool _exception = false;
 
-void Datetime::nowUTCInMilliSecs(unsigned long long *pullNowUTCInMilliSecs, long *plTimeZoneDifferenceInHours)
-{
-	unsigned long long ullNowUTCInSecs;
-	unsigned long ulAdditionalMilliSecs;
+	static void add(uint64_t &counter, const uint64_t value) { std::atomic_ref(counter).store(counter + value, std::memory_order_relaxed); }
+	static uint64_t load(const uint64_t &counter) { return std::atomic_ref(const_cast<uint64_t &>(counter)).load(std::memory_order_relaxed); }
+};
 
-	Datetime::nowUTCInMilliSecs(&ullNowUTCInSecs, &ulAdditionalMilliSecs, plTimeZoneDifferenceInHours);
+// il puntatore non ha inizializzazione dinamica: l'accesso non passa dal guard del thread_local,
+// lo shard e' creato alla prima chiamata del thread e rimosso (sommato ai retired) alla sua terminazione
+thread_local StatsShard *statsShardPointer = nullptr;
+// lo shard del thread e' stato distrutto: le chiamate dei distruttori thread_local successivi vanno nei retired
+thread_local bool statsShardDestroyed = false;
 
-	(*pullNowUTCInMilliSecs) = ullNowUTCInSecs;
-	(*pullNowUTCInMilliSecs) *= 1000;
-	(*pullNowUTCInMilliSecs) += ulAdditionalMilliSecs;
+StatsShard::~StatsShard()
+{
+	statsShardPointer = nullptr;
+	statsShardDestroyed = true;
+	StatsRegistry &registry = statsRegistry();
+	std::lock_guard lock(registry.mutex);
+	addTo(registry.retired);
+	std::erase(registry.shards, this);
 }
 
-void Datetime::nowLocalInMilliSecs(unsigned long long *pullNowLocalInMilliSecs)
+[[gnu::noinline]] StatsShard *createStatsShard()
 {
-	unsigned long long ullNowUTCInMilliSecs;
-	long lTimeZoneDifferenceInHours;
-
-	Datetime::nowUTCInMilliSecs(&ullNowUTCInMilliSecs, &lTimeZoneDifferenceInHours);
-
-	*pullNowLocalInMilliSecs = ullNowUTCInMilliSecs + (lTimeZoneDifferenceInHours * 3600 * 1000);
+	if (statsShardDestroyed)
+		return nullptr;
+	thread_local StatsShard shard;
+	statsShardPointer = &shard;
+	return &shard;
 }
 
-std::string Datetime::dateTimeFormat(const uint64_t milliSecondsSinceEpoch, const std::string& outputFormat, const std::string& outputPrecision)
+// nullptr dopo la distruzione dello shard del thread
+inline StatsShard *statsShard()
 {
-	// Build time_point from milliseconds
-	const std::chrono::milliseconds milliSeconds{milliSecondsSinceEpoch};
-	std::chrono::system_clock::time_point timePointMilliSecs{milliSeconds};
+	if (StatsShard *shard = statsShardPointer) [[likely]]
+		return shard;
+	return createStatsShard();
+}
 
-	return dateTimeFormat(timePointMilliSecs, outputFormat, outputPrecision);
+// una chiamata dopo la distruzione dello shard, sotto il lock del registry (senza latenza)
+[[gnu::noinline]] void recordRetiredStats(const StatsFunction function, const int failure)
+{
+	StatsRegistry &registry = statsRegistry();
+	std::lock_guard lock(registry.mutex);
+	StatsCounters &counters = registry.retired[static_cast<size_t>(function)];
+	counters.calls++;
+	if (failure >= 0)
+		counters.failures[failure]++;
 }
 
-std::string Datetime::dateTimeFormat(const std::chrono::system_clock::time_point& timePoint, const std::string& outputFormat,
-	const std::string& outputPrecision)
+inline void markStatsException()
 {
-	// https://en.cppreference.com/w/cpp/chrono/system_clock/formatter.html
-	const std::string &_format = std::format("{{:{}}}", outputFormat);
+	if (StatsShard *shard = statsShardPointer)
+		shard->markException();
+}
 
-	if (outputPrecision == "millis" || outputPrecision == "milliseconds")
-		return std::vformat(_format, std::make_format_args(timePoint));
-	if (outputPrecision == "seconds")
+class StatsScope
+{
+  public:
+	explicit StatsScope(const StatsFunction function)
+		: _shard(statsShard()), _function(function), _sampled(_shard != nullptr && _shard->enter()), _start(_sampled ? statsTicks() : 0)
 	{
-		const auto _timePoint = floor<std::chrono::seconds>(timePoint);
-		return std::vformat(_format, std::make_format_args(_timePoint));
 	}
-	if (outputPrecision == "minutes")
+
+	~StatsScope()
 	{
-		const auto _timePoint = floor<std::chrono::minutes>(timePoint);
-		return std::vformat(_format, std::make_format_args(_timePoint));
-	}
-	if (outputPrecision == "hours") {
-		const auto _timePoint = floor<std::chrono::hours>(timePoint);
-		return std::vformat(_format, std::make_format_args(_timePoint));
-	}
-	if (outputPrecision == "days") {
-		const auto _timePoint = floor<std::chrono::days>(timePoint);
-		return std::vformat(_format, std::make_format_args(_timePoint));
+		if (_shard == nullptr) [[unlikely]]
+		{
+			recordRetiredStats(_function, _failure);
+			return;
+		}
+		if (_sampled)
+			_shard->recordLatency(_function, statsTicks() - _start);
+		if (_shard->takeException())
+			_failure = static_cast<int>(Datetime::StatsFailure::Exception);
+		_shard->record(_function, _failure);
 	}
 
-	throw std::runtime_error(std::format("precision '{}' is not supported", outputPrecision));
-}
+	StatsScope(const StatsScope &) = delete;
+	StatsScope &operator=(const StatsScope &) = delete;
 
-std::string Datetime::dateTimeFormat(const tm &tm, const std::string& outputFormat)
-{
-	char buff[128];
-	// https://en.cppreference.com/w/c/chrono/strftime.html
-	if (!strftime(buff, sizeof buff, outputFormat.c_str(), &tm))
+	void fail(const Datetime::StatsFailure failure) { _failure = static_cast<int>(failure); }
+
+	std::expected<int64_t, Datetime::ParseError> result(std::expected<int64_t, Datetime::ParseError> result)
 	{
-		const std::string errorMessage = std::format("strftime failed, outputFormat: {}", outputFormat);
-		LOG_ERROR(errorMessage);
-		throw std::runtime_error(errorMessage);
+		if (!result)
+			fail(static_cast<Datetime::StatsFailure>(result.error().kind));
+		return result;
 	}
 
-	return {buff};
+  private:
+	StatsShard *_shard;
+	StatsFunction _function;
+	bool _sampled;
+	uint64_t _start;
+	int _failure = -1;
+};
+} // namespace
+
+#define DATETIME_STATS_SCOPE(function) StatsScope statsScope(StatsFunction::function)
+#define DATETIME_STATS_FAILURE(failure) statsScope.fail(Datetime::StatsFailure::failure)
+#define DATETIME_STATS_RESULT(...) statsScope.result(__VA_ARGS__)
+// throw di un helper senza scope: Exception per la funzione strumentata che lo chiama
+#define DATETIME_STATS_EXCEPTION() markStatsException()
+#else
+#define DATETIME_STATS_SCOPE(function)
+#define DATETIME_STATS_FAILURE(failure)
+#define DATETIME_STATS_RESULT(...) (__VA_ARGS__)
+#define DATETIME_STATS_EXCEPTION()
+#endif
 
-	// la libc dovrebbe implementare make_format_args(tm), quando sarà implementato il codice sopra
-	// sara sostituito da:
-	/*
-	// https://en.cppreference.com/w/cpp/chrono/system_clock/formatter.html
-	const string &_format = std::format("{{:{}}}", outputFormat);
-	return std::vformat(_format,make_format_args(tm));
-	*/
-}
+namespace
+{
+// "YYYY-MM-DDTHH:MM:SS"
+constexpr size_t isoSecondsLength = 19;
 
-std::string Datetime::nowLocalTime(const std::string& outputFormat, const bool milliSeconds)
+// converte due cifre ASCII, ritorna -1 se non sono cifre
+inline int twoDigits(const char *p)
 {
-	tm tmDateTime{};
-	unsigned long ulMilliSecs;
+	const unsigned d0 = static_cast<unsigned char>(p[0]) - '0';
+	const unsigned d1 = static_cast<unsigned char>(p[1]) - '0';
+	if (d0 > 9 || d1 > 9)
+		return -1;
+	return static_cast<int>(d0 * 10 + d1);
+}
 
-	get_tm_LocalTime(&tmDateTime, &ulMilliSecs);
-	std::string sDateTime = dateTimeFormat(tmDateTime, outputFormat);
+// gmtime_r: il calendario UTC e' solo aritmetica
+inline int64_t floorDiv(const int64_t value, const int64_t divisor) { return value / divisor - (value % divisor < 0); }
 
-	return milliSeconds ? std::format("{}{:03}", sDateTime, ulMilliSecs) : sDateTime ;
+void utcToTm(const int64_t utcTime, tm *ptmDateTime)
+{
+	int64_t days = utcTime / 86400;
+	int64_t secondsOfDay = utcTime % 86400;
+	if (secondsOfDay < 0)
+	{
+		days--;
+		secondsOfDay += 86400;
+	}
+	int64_t year;
+	int month;
+	int day;
+	Datetime::civilFromDays(days, &year, &month, &day);
+
+	ptmDateTime->tm_sec = static_cast<int>(secondsOfDay % 60);
+	ptmDateTime->tm_min = static_cast<int>(secondsOfDay / 60 % 60);
+	ptmDateTime->tm_hour = static_cast<int>(secondsOfDay / 3600);
+	ptmDateTime->tm_mday = day;
+	ptmDateTime->tm_mon = month - 1;
+	ptmDateTime->tm_year = static_cast<int>(year - 1900);
+	ptmDateTime->tm_wday = Datetime::weekDayFromDays(days);
+	ptmDateTime->tm_yday = static_cast<int>(days - Datetime::daysFromCivil(year, 1, 1));
+	ptmDateTime->tm_isdst = 0;
+#ifndef _WIN32
+	ptmDateTime->tm_gmtoff = 0;
+	ptmDateTime->tm_zone = "GMT";
+#endif
 }
 
-void Datetime::getTimeZoneInformation(long *plTimeZoneDifferenceInHours)
+// timegm (tm_wday, tm_yday and tm_isdst are ignored)
+inline int64_t utcFromTm(const tm &tmDateTime)
 {
-#ifdef _WIN32
-	TIME_ZONE_INFORMATION tzInfo;
+	return Datetime::civilToUtcInSecs(
+		static_cast<int64_t>(tmDateTime.tm_year) + 1900, tmDateTime.tm_mon + 1, tmDateTime.tm_mday, tmDateTime.tm_hour, tmDateTime.tm_min,
+		tmDateTime.tm_sec
+	);
+}
 
-	::GetTimeZoneInformation(&tzInfo);
+static_assert(Datetime::civilToUtcInSecs(1970, 1, 1, 0, 0, 0) == 0);
+static_assert(Datetime::civilToUtcInSecs(2021, 2, 26, 15, 41, 15) == 1614354075);
+static_assert(Datetime::civilToUtcInSecs(2020, 14, 0, 0, 0, 0) == Datetime::civilToUtcInSecs(2021, 1, 31, 0, 0, 0));
+static_assert(Datetime::civilToUtcInSecs(1969, 12, 31, 23, 59, 59) == -1);
+static_assert(Datetime::isLeapYear(2000) && !Datetime::isLeapYear(1900) && Datetime::isLeapYear(2024) && !Datetime::isLeapYear(2023));
+static_assert(Datetime::getLastDayOfMonth(2024, 2) == 29 && Datetime::getLastDayOfMonth(2023, 2) == 28 && Datetime::getLastDayOfMonth(2023, 7) == 31);
+static_assert(Datetime::getLastDayOfMonth(2023, 8) == 31 && Datetime::getLastDayOfMonth(2023, 9) == 30 && Datetime::getLastDayOfMonth(2023, 12) == 31);
+static_assert(Datetime::weekDayFromDays(0) == 4 && Datetime::weekDayFromDays(-1) == 3 && Datetime::weekDayFromDays(-5) == 6);
 
-	*plTimeZoneDifferenceInHours = ((tzInfo.Bias / 60) * (-1));
-#else
-	timeval tv{};
-	struct timezone tz{};
+inline char *writeDigits(char *output, unsigned value, int width)
+{
+	for (int index = width - 1; index >= 0; index--, value /= 10)
+		output[index] = static_cast<char>('0' + value % 10);
+	return output + width;
+}
 
-	if (::gettimeofday(&tv, &tz) != 0)
+// "00" "01" ... "99"
+constexpr std::array<char, 200> digitPairs = []
+{
+	std::array<char, 200> pairs{};
+	for (int value = 0; value < 100; value++)
 	{
-		const std::string errorMessage = std::format("gettimeofday failed");
-		LOG_ERROR(errorMessage);
-		throw std::runtime_error(errorMessage);
+		pairs[value * 2] = static_cast<char>('0' + value / 10);
+		pairs[value * 2 + 1] = static_cast<char>('0' + value % 10);
 	}
+	return pairs;
+}();
 
-	*plTimeZoneDifferenceInHours = ((tz.tz_minuteswest / 60) * (-1));
-#endif
+inline char *writeTwoDigits(char *output, const unsigned value)
+{
+	std::memcpy(output, &digitPairs[value * 2], 2);
+	return output + 2;
 }
 
-long Datetime::getTimeZoneInformation()
+inline char *writeFourDigits(char *output, const unsigned value)
 {
-	long lTimeZoneDifferenceInHours;
+	writeTwoDigits(output, value / 100);
+	return writeTwoDigits(output + 2, value % 100);
+}
 
-	getTimeZoneInformation(&lTimeZoneDifferenceInHours);
+// YYYY-MM-DD<separator>HH:MM:SS, year in 0-9999
+inline char *writeIsoDateTime(
+	char *output, const unsigned year, const unsigned month, const unsigned day, const char separator, const unsigned hour, const unsigned minute,
+	const unsigned second
+)
+{
+	output = writeFourDigits(output, year);
+	*output++ = '-';
+	output = writeTwoDigits(output, month);
+	*output++ = '-';
+	output = writeTwoDigits(output, day);
+	*output++ = separator;
+	output = writeTwoDigits(output, hour);
+	*output++ = ':';
+	output = writeTwoDigits(output, minute);
+	*output++ = ':';
+	return writeTwoDigits(output, second);
+}
 
-	return lTimeZoneDifferenceInHours;
+void throwOutputTooSmall(const size_t length, const size_t outputSize)
+{
+	const std::string errorMessage = std::format(
+		"Output buffer too small"
+		", length: {}"
+		", output size: {}",
+		length, outputSize
+	);
+	DATETIME_STATS_EXCEPTION();
+	LOG_ERROR(errorMessage);
+	throw std::runtime_error(errorMessage);
 }
 
-void Datetime::get_tm_LocalTime(tm *ptmDateTime, unsigned long *pulMilliSecs)
+// the last second formatted by a thread
+struct SecondCache
 {
-#ifdef _WIN32
-	time_t tTime;
-	SYSTEMTIME stSystemTime;
+	int64_t second = std::numeric_limits<int64_t>::min();
+	// localTimeZoneGeneration of a local string
+	uint32_t zoneGeneration = 0;
+	size_t length = 0;
+	char text[128];
+};
+
+inline size_t copyToOutput(const std::span<char> output, const std::string_view source)
+{
+	if (source.size() > output.size())
+		throwOutputTooSmall(source.size(), output.size());
+	std::copy(source.begin(), source.end(), output.begin());
+	return source.size();
+}
 
-	tTime = time(NULL);
+// parse "YYYY-MM-DDTHH:MM:SS", the same ranges accepted by std::get_time
+bool parseIsoSeconds(const char *p, int64_t *pUtcInSecs)
+{
+	const int century = twoDigits(p);
+	const int yearOfCentury = twoDigits(p + 2);
+	const int month = twoDigits(p + 5);
+	const int day = twoDigits(p + 8);
+	const int hour = twoDigits(p + 11);
+	const int minute = twoDigits(p + 14);
+	const int second = twoDigits(p + 17);
+
+	if ((century | yearOfCentury | month | day | hour | minute | second) < 0 || p[4] != '-' || p[7] != '-' || p[10] != 'T' || p[13] != ':' ||
+		p[16] != ':')
+		return false;
+	if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+		return false;
+
+	*pUtcInSecs = Datetime::daysFromCivil(century * 100 + yearOfCentury, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+	return true;
+}
 
-	Datetime::convertFromUTCToLocal(tTime, ptmDateTime);
+std::atomic<Datetime::ParseErrorCallback> parseErrorCallback = nullptr;
 
-	GetLocalTime(&stSystemTime);
+// layouts of the try* parsers: 'd' is a digit, 's' the offset sign, the other chars must match
+constexpr std::string_view isoSecondsLayout = "dddd-dd-ddTdd:dd:dd";
+constexpr std::string_view isoSecondsUtcLayout = "dddd-dd-ddTdd:dd:ddZ";
+constexpr std::string_view isoMillisecsUtcLayout = "dddd-dd-ddTdd:dd:dd.dddZ";
+constexpr std::string_view isoMillisecsOffsetLayout = "dddd-dd-ddTdd:dd:dd.dddsdddd";
 
-	*pulMilliSecs = stSystemTime.wMilliseconds;
-#else
-	timeval tvTimeval{};
+inline std::unexpected<Datetime::ParseError> parseError(const Datetime::ParseErrorKind kind, const size_t position)
+{
+	return std::unexpected(Datetime::ParseError{kind, position});
+}
 
-	if (gettimeofday(&tvTimeval, NULL) == -1)
+// only the chars from..layout.size() of datetime are checked
+std::expected<void, Datetime::ParseError> checkLayout(const std::string_view datetime, const std::string_view layout, const size_t from = 0) noexcept
+{
+	for (size_t position = from; position < layout.size(); position++)
 	{
-		const std::string errorMessage = std::format("gettimeofday failed");
-		LOG_ERROR(errorMessage);
-		throw std::runtime_error(errorMessage);
+		const char c = datetime[position];
+		if (layout[position] == 'd')
+		{
+			if (c < '0' || c > '9')
+				return parseError(Datetime::ParseErrorKind::Digit, position);
+		}
+		else if (layout[position] == 's' ? c != '+' && c != '-' : c != layout[position])
+			return parseError(Datetime::ParseErrorKind::Separator, position);
 	}
-
-	convertFromUTCToLocal(tvTimeval.tv_sec, ptmDateTime);
-
-	*pulMilliSecs = tvTimeval.tv_usec / 1000;
-#endif
+	return {};
 }
 
-void Datetime::convertFromLocalToUTC(tm *ptmDateTime, time_t *ptUTCTime) { *ptUTCTime = localToUTC(ptmDateTime); }
+// the first field out of range of "YYYY-MM-DDTHH:MM:SS", already checked by checkLayout
+std::unexpected<Datetime::ParseError> isoSecondsRangeError(const char *p) noexcept
+{
+	const int month = twoDigits(p + 5);
+	const int day = twoDigits(p + 8);
+	if (month < 1 || month > 12)
+		return parseError(Datetime::ParseErrorKind::Range, 5);
+	if (day < 1 || day > 31)
+		return parseError(Datetime::ParseErrorKind::Range, 8);
+	if (twoDigits(p + 11) > 23)
+		return parseError(Datetime::ParseErrorKind::Range, 11);
+	if (twoDigits(p + 14) > 59)
+		return parseError(Datetime::ParseErrorKind::Range, 14);
+	return parseError(Datetime::ParseErrorKind::Range, 17);
+}
 
-time_t Datetime::localToUTC(tm *ptmDateTime) { return mktime(ptmDateTime); }
+// the first layout.size() chars of datetime, layout starts with isoSecondsLayout
+std::expected<int64_t, Datetime::ParseError> isoLayoutToUtcInSecs(const std::string_view datetime, const std::string_view layout) noexcept
+{
+	int64_t utcInSecs;
+	if (!parseIsoSeconds(datetime.data(), &utcInSecs))
+	{
+		// solo per un input sbagliato: cerca il primo carattere o campo errato
+		if (const auto checked = checkLayout(datetime, isoSecondsLayout); !checked)
+			return std::unexpected(checked.error());
+		return isoSecondsRangeError(datetime.data());
+	}
+	if (const auto checked = checkLayout(datetime, layout, isoSecondsLength); !checked)
+		return std::unexpected(checked.error());
+	return utcInSecs;
+}
 
-void Datetime::convertFromLocalToUTC(tm *ptmLocalDateTime, tm *ptmUTCDateTime)
+// 2021-02-26T15:41:15.765Z or 2021-02-26T15:41:15.477+0100, in milliseconds
+std::expected<int64_t, Datetime::ParseError> isoMillisecsToUtc(const std::string_view datetime) noexcept
 {
-	time_t tUTCTime;
+	std::string_view layout;
+	if (datetime.size() == isoMillisecsUtcLayout.size())
+		layout = isoMillisecsUtcLayout;
+	else if (datetime.size() == isoMillisecsOffsetLayout.size())
+		layout = isoMillisecsOffsetLayout;
+	else
+		return parseError(Datetime::ParseErrorKind::Length, std::min(datetime.size(), isoMillisecsUtcLayout.size()));
 
-	convertFromLocalToUTC(ptmLocalDateTime, &tUTCTime);
+	const auto utcInSecs = isoLayoutToUtcInSecs(datetime, layout);
+	if (!utcInSecs)
+		return utcInSecs;
 
-	convertFromUTCInSecondsToBreakDownUTC(tUTCTime, ptmUTCDateTime);
+	int64_t utcInMillisecs = *utcInSecs * 1000 + (datetime[20] - '0') * 100 + twoDigits(datetime.data() + 21);
+	if (layout == isoMillisecsOffsetLayout)
+	{
+		const int hours = twoDigits(datetime.data() + 24);
+		const int minutes = twoDigits(datetime.data() + 26);
+		if (hours > 23)
+			return parseError(Datetime::ParseErrorKind::Range, 24);
+		if (minutes > 59)
+			return parseError(Datetime::ParseErrorKind::Range, 26);
+		const int64_t offsetInMillisecs = (hours * 3600 + minutes * 60) * 1000;
+		utcInMillisecs += datetime[23] == '+' ? -offsetInMillisecs : offsetInMillisecs;
+	}
+	return utcInMillisecs;
 }
 
-void Datetime::convertFromUTCInSecondsToBreakDownUTC(time_t tUTCTime, tm *ptmUTCDateTime)
+// 2021-02-26T15:41:15.477+0100, in seconds or milliseconds as iso8610ToUtc
+std::expected<int64_t, Datetime::ParseError> iso8610ToUtcInSecsOrMillisecs(const std::string_view datetime, const bool millisecondsPrecision) noexcept
 {
-#ifdef _WIN32
-	gmtime_s(ptmUTCDateTime, &tUTCTime);
-#else
-	gmtime_r(&tUTCTime, ptmUTCDateTime);
-#endif
+	if (datetime.size() != isoMillisecsOffsetLayout.size())
+		return parseError(Datetime::ParseErrorKind::Length, std::min(datetime.size(), isoMillisecsOffsetLayout.size()));
+
+	const auto utcInMillisecs = isoMillisecsToUtc(datetime);
+	if (!utcInMillisecs || millisecondsPrecision)
+		return utcInMillisecs;
+	// i millisecondi sono troncati dopo aver applicato l'offset
+	return (*utcInMillisecs - (datetime[20] - '0') * 100 - twoDigits(datetime.data() + 21)) / 1000;
 }
 
-void Datetime::convertFromLocalDateTimeToLocalInSecs(
-	unsigned long ulYear, unsigned long ulMon, unsigned long ulDay, unsigned long ulHour, unsigned long ulMin, unsigned long ulSec,
-	long lDaylightSavingTime, unsigned long long *pullLocalInSecs
-)
+// 2021-02-26T15:41:15.477123+01:00, 2021-02-26 15:41:15Z, ...
+// the time since epoch in the unit of precision
+std::expected<int64_t, Datetime::ParseError> iso8601ToUtc(const std::string_view datetime, const Datetime::Precision precision) noexcept
 {
-	long lTimeZoneDifferenceInHours;
-	time_t tUTCTime;
-	tm tmDateTime;
-
-	tmDateTime.tm_year = ulYear - 1900;
-	tmDateTime.tm_mon = ulMon - 1;
-	tmDateTime.tm_mday = ulDay;
-	tmDateTime.tm_hour = ulHour;
-	tmDateTime.tm_min = ulMin;
-	tmDateTime.tm_sec = ulSec;
-
-	//	Negative value if status of daylight saving time is unknown.
-	// (does it mean it attempt to determine whether Daylight Saving Time is in effect
-	//	for the specified time?)
-	tmDateTime.tm_isdst = lDaylightSavingTime;
-
-	// Simulate as the date is a local date
-	Datetime::convertFromLocalToUTC(&tmDateTime, &tUTCTime);
+	if (datetime.size() < isoSecondsLength)
+		return parseError(Datetime::ParseErrorKind::Length, datetime.size());
+
+	// data e ora con il separatore T, t o spazio normalizzato a T
+	char dateTime[isoSecondsLength];
+	std::memcpy(dateTime, datetime.data(), isoSecondsLength);
+	if (dateTime[10] == 't' || dateTime[10] == ' ')
+		dateTime[10] = 'T';
+	const auto utcInSecs = isoLayoutToUtcInSecs(std::string_view(dateTime, isoSecondsLength), isoSecondsLayout);
+	if (!utcInSecs)
+		return utcInSecs;
+
+	const char *p = datetime.data();
+	size_t position = isoSecondsLength;
+
+	int64_t nanoSecs = 0;
+	if (position < datetime.size() && (p[position] == '.' || p[position] == ','))
+	{
+		constexpr int64_t scale[] = {1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1};
+		const size_t fractionStart = ++position;
+		while (position < datetime.size() && p[position] >= '0' && p[position] <= '9')
+		{
+			if (position - fractionStart == 9)
+				return parseError(Datetime::ParseErrorKind::Range, fractionStart);
+			nanoSecs = nanoSecs * 10 + (p[position++] - '0');
+		}
+		if (position == fractionStart)
+			return parseError(Datetime::ParseErrorKind::Digit, position);
+		nanoSecs *= scale[position - fractionStart];
+	}
 
-	Datetime::getTimeZoneInformation(&lTimeZoneDifferenceInHours);
+	int64_t offsetSecs = 0;
+	if (position < datetime.size())
+	{
+		const char sign = p[position];
+		if (sign == 'Z' || sign == 'z')
+			position++;
+		else if (sign == '+' || sign == '-')
+		{
+			const size_t hoursPosition = position + 1;
+			const size_t minutesPosition = hoursPosition + 2 + (hoursPosition + 2 < datetime.size() && p[hoursPosition + 2] == ':');
+			if (minutesPosition + 2 > datetime.size())
+				return parseError(Datetime::ParseErrorKind::Length, datetime.size());
+			const int hours = twoDigits(p + hoursPosition);
+			const int minutes = twoDigits(p + minutesPosition);
+			if (hours < 0)
+				return parseError(Datetime::ParseErrorKind::Digit, hoursPosition);
+			if (minutes < 0)
+				return parseError(Datetime::ParseErrorKind::Digit, minutesPosition);
+			if (hours > 23)
+				return parseError(Datetime::ParseErrorKind::Range, hoursPosition);
+			if (minutes > 59)
+				return parseError(Datetime::ParseErrorKind::Range, minutesPosition);
+			offsetSecs = (hours * 3600 + minutes * 60) * (sign == '+' ? 1 : -1);
+			position = minutesPosition + 2;
+		}
+		else
+			return parseError(Datetime::ParseErrorKind::Separator, position);
+	}
+	if (position != datetime.size())
+		return parseError(Datetime::ParseErrorKind::Length, position);
 
-	*pullLocalInSecs = ((unsigned long long)tUTCTime) + (((unsigned long long)lTimeZoneDifferenceInHours) * 3600);
+	const int64_t secs = *utcInSecs - offsetSecs;
+	int64_t unitsPerSecond;
+	switch (precision)
+	{
+	case Datetime::Precision::Days:
+		return secs / 86400 - (secs % 86400 < 0);
+	case Datetime::Precision::Hours:
+		return secs / 3600 - (secs % 3600 < 0);
+	case Datetime::Precision::Minutes:
+		return secs / 60 - (secs % 60 < 0);
+	case Datetime::Precision::Seconds:
+		return secs;
+	case Datetime::Precision::Millis:
+		unitsPerSecond = 1000;
+		break;
+	case Datetime::Precision::Micros:
+		unitsPerSecond = 1000000;
+		break;
+	case Datetime::Precision::Nanos:
+		unitsPerSecond = 1000000000;
+		break;
+	default: // Datetime::Precision::Native
+		unitsPerSecond = std::chrono::system_clock::period::den / std::chrono::system_clock::period::num;
+	}
+	// prima del 1970 con frazione: (secs + 1) * unitsPerSecond + fraction - unitsPerSecond, il prodotto resta nell'int64
+	// fino all'ultimo istante rappresentabile (1677-09-21T00:12:43.145224192Z in ns)
+	const int64_t fraction = nanoSecs / (1000000000 / unitsPerSecond);
+	const bool borrow = secs < 0 && fraction > 0;
+	int64_t units;
+	if (__builtin_mul_overflow(secs + borrow, unitsPerSecond, &units) ||
+		__builtin_add_overflow(units, borrow ? fraction - unitsPerSecond : fraction, &units))
+		return parseError(Datetime::ParseErrorKind::Range, 0);
+	return units;
 }
 
-tm Datetime::utcSecondsToLocalTime(time_t utcTime)
+std::expected<int64_t, Datetime::ParseError> reportParseError(
+	const std::string_view function, const std::string_view input, std::expected<int64_t, Datetime::ParseError> result
+) noexcept
 {
-	tm tmDateTime{};
-
-#ifdef _WIN32
-	localtime_s(&tmDateTime, &utcTime);
-#else
-	localtime_r(&utcTime, &tmDateTime);
-#endif
-	return tmDateTime;
+	if (!result)
+		if (const Datetime::ParseErrorCallback callback = parseErrorCallback.load(std::memory_order_relaxed))
+			callback(function, input, result.error());
+	return result;
 }
+} // namespace
 
-void Datetime::convertFromUTCToLocal(time_t tUTCTime, tm *ptmLocalDateTime)
+namespace
 {
-#ifdef _WIN32
-	localtime_s(ptmLocalDateTime, &tUTCTime);
-#else
-	localtime_r(&tUTCTime, ptmLocalDateTime);
-#endif
+/*
+	In-process time zone engine: the TZif file (RFC 8536) is parsed once in an immutable table,
+	UTC -> local is a binary search on the transitions plus arithmetic, without the glibc tz lock.
+	The POSIX TZ rule of the footer (or of the TZ environment variable) is expanded in transitions
+	up to lastPrecomputedYear and evaluated directly after it.
+*/
+constexpr int64_t lastPrecomputedYear = 2100;
+
+struct LocalTimeType
+{
+	int32_t utcOffset; // seconds east of UTC
+	bool isDst;
+	std::string abbreviation;
+};
+
+// i.e. CET-1CEST,M3.5.0,M10.5.0/3
+struct PosixTimeZoneRule
+{
+	struct TransitionDate
+	{
+		char kind; // 'J': Julian day 1-365 without Feb 29, 'D': zero based day of year, 'M': Mm.w.d
+		int day;
+		int month;
+		int week;
+		int weekDay;
+		int32_t time; // seconds after local midnight, could be negative or > 24h
+	};
+
+	size_t stdType;
+	size_t dstType;
+	bool hasDst;
+	TransitionDate start;
+	TransitionDate end;
+};
+
+class TimeZoneTable
+{
+  public:
+	// nullptr if data is not a supported TZif file
+	static std::unique_ptr<TimeZoneTable> fromTzif(std::string_view data);
+	// nullptr if rule is not a valid POSIX TZ string
+	static std::unique_ptr<TimeZoneTable> fromPosix(std::string_view rule);
+
+	const LocalTimeType &lookup(const int64_t utcTime) const
+	{
+		// dopo l'ultima transizione del file (e prima di 1970 per una regola senza file) vale la regola POSIX,
+		// in transizioni precalcolate fino a lastPrecomputedYear
+		if (_rule.has_value() && (utcTime >= _ruleFrom || (_ruleOnly && (_transitions.empty() || utcTime < _transitions.front()))))
+		{
+			if (!_rule->hasDst)
+				return _types[_rule->stdType];
+			if (utcTime >= _ruleOnlyFrom || _transitions.empty() || utcTime < _transitions.front())
+				return ruleLookup(utcTime);
+		}
+
+		if (_transitions.empty() || utcTime < _transitions.front())
+			return _types[_initialType];
+
+		const auto next = std::upper_bound(_transitions.begin(), _transitions.end(), utcTime);
+		return _types[_transitionTypes[next - _transitions.begin() - 1]];
+	}
+
+	// lookup plus the UTC interval [*pFrom, *pUntil) around utcTime where the type does not change
+	const LocalTimeType &lookup(const int64_t utcTime, int64_t *pFrom, int64_t *pUntil) const
+	{
+		*pFrom = std::numeric_limits<int64_t>::min();
+		*pUntil = std::numeric_limits<int64_t>::max();
+
+		if (_rule.has_value() && (utcTime >= _ruleFrom || (_ruleOnly && (_transitions.empty() || utcTime < _transitions.front()))))
+		{
+			if (utcTime >= _ruleFrom)
+				*pFrom = _ruleFrom;
+			else if (!_transitions.empty())
+				*pUntil = _transitions.front();
+			if (!_rule->hasDst)
+				return _types[_rule->stdType];
+			if (utcTime >= _ruleOnlyFrom || _transitions.empty() || utcTime < _transitions.front())
+			{
+				if (utcTime >= _ruleOnlyFrom)
+					*pFrom = std::max(*pFrom, _ruleOnlyFrom);
+				// nell'anno UTC la regola cambia solo a start e end
+				int64_t year;
+				int month;
+				int day;
+				Datetime::civilFromDays(utcTime >= 0 ? utcTime / 86400 : (utcTime + 1) / 86400 - 1, &year, &month, &day);
+				int64_t start;
+				int64_t end;
+				ruleTransitions(year, &start, &end);
+				*pFrom = std::max(*pFrom, Datetime::daysFromCivil(year, 1, 1) * 86400);
+				*pUntil = std::min(*pUntil, Datetime::daysFromCivil(year + 1, 1, 1) * 86400);
+				for (const int64_t transition : {start, end})
+					if (transition <= utcTime)
+						*pFrom = std::max(*pFrom, transition);
+					else
+						*pUntil = std::min(*pUntil, transition);
+				return ruleLookup(utcTime);
+			}
+		}
+
+		if (_transitions.empty() || utcTime < _transitions.front())
+		{
+			if (!_transitions.empty())
+				*pUntil = std::min(*pUntil, _transitions.front());
+			return _types[_initialType];
+		}
+
+		const auto next = std::upper_bound(_transitions.begin(), _transitions.end(), utcTime);
+		*pFrom = std::max(*pFrom, *(next - 1));
+		if (next != _transitions.end())
+			*pUntil = std::min(*pUntil, *next);
+		if (_rule.has_value())
+			for (const int64_t ruleStart : {_ruleFrom, _ruleOnlyFrom})
+				if (utcTime < ruleStart)
+					*pUntil = std::min(*pUntil, ruleStart);
+		return _types[_transitionTypes[next - _transitions.begin() - 1]];
+	}
+
+  private:
+	std::vector<int64_t> _transitions;
+	std::vector<uint8_t> _transitionTypes;
+	std::vector<LocalTimeType> _types;
+	size_t _initialType = 0;
+	std::optional<PosixTimeZoneRule> _rule;
+	// no TZif file, only the POSIX rule
+	bool _ruleOnly = false;
+	// the last transition of the TZif file
+	int64_t _ruleFrom = std::numeric_limits<int64_t>::max();
+	// the first second after the precomputed transitions
+	int64_t _ruleOnlyFrom = std::numeric_limits<int64_t>::max();
+
+	bool parsePosixRule(std::string_view rule);
+	void expandPosixRule();
+	// UTC seconds of the rule start/end transitions in year
+	void ruleTransitions(int64_t year, int64_t *pStart, int64_t *pEnd) const;
+
+	const LocalTimeType &ruleLookup(const int64_t utcTime) const
+	{
+		const PosixTimeZoneRule &rule = *_rule;
+		if (!rule.hasDst)
+			return _types[rule.stdType];
+
+		int64_t year;
+		int month;
+		int day;
+		Datetime::civilFromDays(utcTime >= 0 ? utcTime / 86400 : (utcTime + 1) / 86400 - 1, &year, &month, &day);
+		int64_t start;
+		int64_t end;
+		ruleTransitions(year, &start, &end);
+		const bool isDst = start < end ? utcTime >= start && utcTime < end : !(utcTime >= end && utcTime < start);
+		return _types[isDst ? rule.dstType : rule.stdType];
+	}
+};
+
+inline uint32_t bigEndian32(const unsigned char *p) { return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3]; }
+
+inline int64_t bigEndian64(const unsigned char *p) { return static_cast<int64_t>((uint64_t(bigEndian32(p)) << 32) | bigEndian32(p + 4)); }
+
+std::unique_ptr<TimeZoneTable> TimeZoneTable::fromTzif(std::string_view data)
+{
+	constexpr size_t headerLength = 44;
+
+	const auto *bytes = reinterpret_cast<const unsigned char *>(data.data());
+	if (data.size() < headerLength || data.substr(0, 4) != "TZif")
+		return nullptr;
+
+	const char version = data[4];
+	size_t timeLength = 4;
+	if (version >= '2')
+	{
+		// salta il blocco v1 (tempi a 32 bit) e usa quello v2+ (tempi a 64 bit)
+		const size_t v1Length = bigEndian32(bytes + 32) * 5 + bigEndian32(bytes + 36) * 6 + bigEndian32(bytes + 40) + bigEndian32(bytes + 28) * 8 +
+								bigEndian32(bytes + 24) + bigEndian32(bytes + 20);
+		if (data.size() < headerLength * 2 + v1Length)
+			return nullptr;
+		bytes += headerLength + v1Length;
+		data.remove_prefix(headerLength + v1Length);
+		if (data.substr(0, 4) != "TZif")
+			return nullptr;
+		timeLength = 8;
+	}
+
+	const size_t isUtCount = bigEndian32(bytes + 20);
+	const size_t isStdCount = bigEndian32(bytes + 24);
+	const size_t leapCount = bigEndian32(bytes + 28);
+	const size_t timeCount = bigEndian32(bytes + 32);
+	const size_t typeCount = bigEndian32(bytes + 36);
+	const size_t charCount = bigEndian32(bytes + 40);
+
+	// con i leap second (zone "right/...") resta la libc
+	if (leapCount != 0 || typeCount == 0 || typeCount > 256)
+		return nullptr;
+
+	const size_t dataLength =
+		timeCount * (timeLength + 1) + typeCount * 6 + charCount + leapCount * (timeLength + 4) + isStdCount + isUtCount;
+	if (data.size() < headerLength + dataLength)
+		return nullptr;
+
+	auto table = std::make_unique<TimeZoneTable>();
+
+	const unsigned char *current = bytes + headerLength;
+	table->_transitions.reserve(timeCount);
+	for (size_t index = 0; index < timeCount; index++, current += timeLength)
+		table->_transitions.push_back(timeLength == 8 ? bigEndian64(current) : static_cast<int32_t>(bigEndian32(current)));
+	table->_transitionTypes.assign(current, current + timeCount);
+	current += timeCount;
+
+	const char *abbreviations = reinterpret_cast<const char *>(current + typeCount * 6);
+	for (size_t index = 0; index < typeCount; index++, current += 6)
+	{
+		const size_t abbreviationIndex = current[5];
+		if (abbreviationIndex >= charCount)
+			return nullptr;
+		table->_types.push_back(LocalTimeType{
+			static_cast<int32_t>(bigEndian32(current)), current[4] != 0,
+			std::string(abbreviations + abbreviationIndex, strnlen(abbreviations + abbreviationIndex, charCount - abbreviationIndex))
+		});
+	}
+	for (const uint8_t transitionType : table->_transitionTypes)
+		if (transitionType >= typeCount)
+			return nullptr;
+
+	// prima della prima transizione: il primo tipo non DST, come la glibc
+	while (table->_initialType < typeCount && table->_types[table->_initialType].isDst)
+		table->_initialType++;
+	if (table->_initialType == typeCount)
+		table->_initialType = 0;
+
+	// footer v2+: "\n<POSIX TZ>\n"
+	if (timeLength == 8)
+	{
+		std::string_view footer = data.substr(headerLength + dataLength);
+		if (footer.size() >= 2 && footer[0] == '\n')
+		{
+			footer.remove_prefix(1);
+			footer = footer.substr(0, footer.find('\n'));
+			if (!footer.empty() && table->parsePosixRule(footer))
+			{
+				table->_ruleFrom = table->_transitions.empty() ? std::numeric_limits<int64_t>::min() : table->_transitions.back();
+				table->_ruleOnly = table->_transitions.empty();
+				table->expandPosixRule();
+			}
+		}
+	}
+
+	return table;
+}
+
+std::unique_ptr<TimeZoneTable> TimeZoneTable::fromPosix(const std::string_view rule)
+{
+	auto table = std::make_unique<TimeZoneTable>();
+	if (!table->parsePosixRule(rule))
+		return nullptr;
+	table->_initialType = table->_rule->stdType;
+	table->_ruleOnly = true;
+	table->_ruleFrom = std::numeric_limits<int64_t>::min();
+	table->expandPosixRule();
+
+	return table;
+}
+
+bool TimeZoneTable::parsePosixRule(std::string_view rule)
+{
+	size_t position = 0;
+
+	const auto parseName = [&](std::string *pName) -> bool
+	{
+		size_t start = position;
+		if (position < rule.size() && rule[position] == '<')
+		{
+			const size_t close = rule.find('>', position);
+			if (close == std::string_view::npos)
+				return false;
+			*pName = rule.substr(position + 1, close - position - 1);
+			position = close + 1;
+			return pName->size() >= 1;
+		}
+		while (position < rule.size() && std::isalpha(static_cast<unsigned char>(rule[position])))
+			position++;
+		*pName = rule.substr(start, position - start);
+		return pName->size() >= 3;
+	};
+	// [+-]hh[:mm[:ss]]
+	const auto parseTime = [&](int32_t *pSeconds) -> bool
+	{
+		int sign = 1;
+		if (position < rule.size() && (rule[position] == '+' || rule[position] == '-'))
+			sign = rule[position++] == '-' ? -1 : 1;
+		int32_t seconds = 0;
+		for (int32_t component = 0, multiplier = 3600; component < 3; component++, multiplier /= 60)
+		{
+			if (component > 0)
+			{
+				if (position >= rule.size() || rule[position] != ':')
+					break;
+				position++;
+			}
+			if (position >= rule.size() || !std::isdigit(static_cast<unsigned char>(rule[position])))
+				return false;
+			int32_t value = 0;
+			while (position < rule.size() && std::isdigit(static_cast<unsigned char>(rule[position])) && value < 1000)
+				value = value * 10 + (rule[position++] - '0');
+			seconds += value * multiplier;
+		}
+		*pSeconds = sign * seconds;
+		return true;
+	};
+	const auto parseNumber = [&](int *pValue) -> bool
+	{
+		if (position >= rule.size() || !std::isdigit(static_cast<unsigned char>(rule[position])))
+			return false;
+		int value = 0;
+		while (position < rule.size() && std::isdigit(static_cast<unsigned char>(rule[position])) && value < 1000)
+			value = value * 10 + (rule[position++] - '0');
+		*pValue = value;
+		return true;
+	};
+	const auto parseDate = [&](PosixTimeZoneRule::TransitionDate *pDate) -> bool
+	{
+		if (position < rule.size() && rule[position] == 'M')
+		{
+			position++;
+			pDate->kind = 'M';
+			if (!parseNumber(&pDate->month) || position >= rule.size() || rule[position++] != '.' || !parseNumber(&pDate->week) ||
+				position >= rule.size() || rule[position++] != '.' || !parseNumber(&pDate->weekDay))
+				return false;
+			if (pDate->month < 1 || pDate->month > 12 || pDate->week < 1 || pDate->week > 5 || pDate->weekDay > 6)
+				return false;
+		}
+		else if (position < rule.size() && rule[position] == 'J')
+		{
+			position++;
+			pDate->kind = 'J';
+			if (!parseNumber(&pDate->day) || pDate->day < 1 || pDate->day > 365)
+				return false;
+		}
+		else
+		{
+			pDate->kind = 'D';
+			if (!parseNumber(&pDate->day) || pDate->day > 365)
+				return false;
+		}
+		pDate->time = 2 * 3600;
+		if (position < rule.size() && rule[position] == '/')
+		{
+			position++;
+			return parseTime(&pDate->time);
+		}
+		return true;
+	};
+
+	PosixTimeZoneRule posixRule{};
+	std::string stdName;
+	int32_t stdOffset;
+	if (!parseName(&stdName) || !parseTime(&stdOffset))
+		return false;
+
+	_types.push_back(LocalTimeType{-stdOffset, false, stdName});
+	posixRule.stdType = _types.size() - 1;
+	posixRule.hasDst = position < rule.size();
+
+	if (posixRule.hasDst)
+	{
+		std::string dstName;
+		if (!parseName(&dstName))
+			return false;
+		int32_t dstOffset = stdOffset - 3600;
+		if (position < rule.size() && rule[position] != ',' && !parseTime(&dstOffset))
+			return false;
+		_types.push_back(LocalTimeType{-dstOffset, true, dstName});
+		posixRule.dstType = _types.size() - 1;
+
+		if (position < rule.size())
+		{
+			if (rule[position++] != ',' || !parseDate(&posixRule.start) || position >= rule.size() || rule[position++] != ',' ||
+				!parseDate(&posixRule.end))
+				return false;
+		}
+		else
+		{
+			// nessuna regola: quella USA, come la glibc
+			posixRule.start = {'M', 0, 3, 2, 0, 2 * 3600};
+			posixRule.end = {'M', 0, 11, 1, 0, 2 * 3600};
+		}
+	}
+
+	if (position != rule.size())
+		return false;
+
+	_rule = posixRule;
+	return true;
+}
+
+void TimeZoneTable::ruleTransitions(const int64_t year, int64_t *pStart, int64_t *pEnd) const
+{
+	// come la glibc, per gli anni fino al 1970 il giorno dell'anno e' contato dal 1970-01-01
+	const int64_t firstOfYear = year > 1970 ? Datetime::daysFromCivil(year, 1, 1) : 0;
+	const auto localSeconds = [year, firstOfYear](const PosixTimeZoneRule::TransitionDate &date) -> int64_t
+	{
+		int64_t dayOfYear;
+		if (date.kind == 'J')
+			dayOfYear = date.day - 1 + (Datetime::isLeapYear(year) && date.day >= 60);
+		else if (date.kind == 'D')
+			dayOfYear = date.day;
+		else
+		{
+			const int64_t firstOfMonth = Datetime::daysFromCivil(year, date.month, 1);
+			int day = 1 + (date.weekDay - Datetime::weekDayFromDays(firstOfMonth) + 7) % 7 + (date.week - 1) * 7;
+			if (day > Datetime::getLastDayOfMonth(year, date.month))
+				day -= 7;
+			dayOfYear = firstOfMonth + day - 1 - Datetime::daysFromCivil(year, 1, 1);
+		}
+		return (firstOfYear + dayOfYear) * 86400 + date.time;
+	};
+
+	// start e' espresso in ora solare, end in ora legale
+	*pStart = localSeconds(_rule->start) - _types[_rule->stdType].utcOffset;
+	*pEnd = localSeconds(_rule->end) - _types[_rule->dstType].utcOffset;
+}
+
+void TimeZoneTable::expandPosixRule()
+{
+	if (!_rule.has_value() || !_rule->hasDst)
+		return;
+
+	int64_t firstYear = 1970;
+	if (!_transitions.empty())
+	{
+		int month;
+		int day;
+		Datetime::civilFromDays(_transitions.back() >= 0 ? _transitions.back() / 86400 : (_transitions.back() + 1) / 86400 - 1, &firstYear, &month, &day);
+	}
+
+	// come la glibc, ogni anno UTC e' valutato solo con le transizioni di quell'anno
+	// (conta per regole che attraversano il capodanno, i.e. EST5EDT,0/0,J365/25)
+	const auto addTransition = [this](const int64_t transition, const size_t type)
+	{
+		if (!_transitions.empty() && transition <= _transitions.back())
+		{
+			if (transition == _transitions.back())
+				_transitionTypes.back() = static_cast<uint8_t>(type);
+			return;
+		}
+		if (!_transitionTypes.empty() && _transitionTypes.back() == type)
+			return;
+		_transitions.push_back(transition);
+		_transitionTypes.push_back(static_cast<uint8_t>(type));
+	};
+	for (int64_t year = firstYear; year <= lastPrecomputedYear; year++)
+	{
+		const int64_t yearStart = Datetime::daysFromCivil(year, 1, 1) * 86400;
+		const int64_t yearEnd = Datetime::daysFromCivil(year + 1, 1, 1) * 86400;
+		int64_t start;
+		int64_t end;
+		ruleTransitions(year, &start, &end);
+		const auto typeAt = [&](const int64_t utcTime)
+		{
+			const bool isDst = start < end ? utcTime >= start && utcTime < end : !(utcTime >= end && utcTime < start);
+			return isDst ? _rule->dstType : _rule->stdType;
+		};
+		if (_transitions.empty() || yearStart > _transitions.back())
+			addTransition(yearStart, typeAt(yearStart));
+		for (const int64_t transition : {std::min(start, end), std::max(start, end)})
+			if (transition > yearStart && transition < yearEnd)
+				addTransition(transition, typeAt(transition));
+	}
+
+	// oltre l'ultima transizione precalcolata la regola e' valutata anno per anno
+	_ruleOnlyFrom = Datetime::daysFromCivil(lastPrecomputedYear + 1, 1, 1) * 86400;
+}
+
+std::unique_ptr<TimeZoneTable> loadTimeZoneFile(const std::string &path)
+{
+#ifdef _WIN32
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return nullptr;
+	const std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	return TimeZoneTable::fromTzif(data);
+#else
+	// il file e' mappato solo per il parsing, la tabella non lo referenzia
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return nullptr;
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) == -1 || !S_ISREG(fileStat.st_mode) || fileStat.st_size == 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+	const size_t size = static_cast<size_t>(fileStat.st_size);
+	void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return nullptr;
+
+	std::unique_ptr<TimeZoneTable> table = TimeZoneTable::fromTzif(std::string_view(static_cast<const char *>(data), size));
+	munmap(data, size);
+
+	return table;
+#endif
+}
+
+std::string timeZoneDirectory()
+{
+	const char *tzDir = getenv("TZDIR");
+	return tzDir != nullptr && *tzDir != '\0' ? tzDir : "/usr/share/zoneinfo";
+}
+
+#ifndef _WIN32
+// the same zone that localtime_r uses: TZ environment variable or /etc/localtime
+std::unique_ptr<TimeZoneTable> loadLocalTimeZoneTable()
+{
+	const char *tz = getenv("TZ");
+	if (tz == nullptr)
+		return loadTimeZoneFile("/etc/localtime");
+
+	if (*tz == ':')
+		tz++;
+	if (*tz == '\0')
+		return TimeZoneTable::fromPosix("UTC0");
+	if (*tz == '/')
+		return loadTimeZoneFile(tz);
+
+	if (strstr(tz, "..") == nullptr)
+		if (auto table = loadTimeZoneFile(std::format("{}/{}", timeZoneDirectory(), tz)))
+			return table;
+
+	return TimeZoneTable::fromPosix(tz);
+}
+
+/*
+	The process local zone, loaded at the first use and replaced by reloadLocalTimeZone.
+	The replaced tables are kept: the LocalDay caches and the tm_zone returned to the callers point to them.
+*/
+std::mutex localTimeZoneMutex;
+std::vector<std::unique_ptr<TimeZoneTable>> localTimeZoneTables;
+std::atomic<const TimeZoneTable *> localTimeZone{nullptr};
+std::atomic<bool> localTimeZoneLoaded{false};
+
+void loadLocalTimeZone()
+{
+	std::unique_ptr<TimeZoneTable> table = loadLocalTimeZoneTable();
+	std::lock_guard<std::mutex> locker(localTimeZoneMutex);
+	localTimeZone.store(table.get(), std::memory_order_release);
+	if (table != nullptr)
+		localTimeZoneTables.push_back(std::move(table));
+	localTimeZoneLoaded.store(true, std::memory_order_release);
+}
+
+// nullptr: zona non supportata, resta localtime_r
+const TimeZoneTable *localTimeZoneTable()
+{
+	if (!localTimeZoneLoaded.load(std::memory_order_acquire)) [[unlikely]]
+	{
+		static std::once_flag loaded;
+		std::call_once(loaded, loadLocalTimeZone);
+	}
+	return localTimeZone.load(std::memory_order_acquire);
+}
+#endif
+
+// la zona locale del processo, nullptr: localtime_r/mktime (sempre su Windows)
+const TimeZoneTable *processTimeZoneTable()
+{
+#ifdef _WIN32
+	return nullptr;
+#else
+	return localTimeZoneTable();
+#endif
+}
+
+// incremented by reloadLocalTimeZone, it invalidates the local strings cached per thread
+std::atomic<uint32_t> localTimeZoneGeneration{0};
+
+/*
+	Per-thread cache of the UTC -> local decomposition keyed by UTC day: for a cached day
+	the conversion is a division and a remainder, no binary search and no civil calendar.
+	The day has one local time type or, for a DST transition day, two (before and after transition).
+	Direct mapped on the UTC day, its size is read from localDayCacheSize at every lookup.
+*/
+std::atomic<size_t> localDayCacheSize = 64;
+std::atomic<uint64_t> localDayCacheHits = 0;
+std::atomic<uint64_t> localDayCacheMisses = 0;
+
+struct LocalDay
+{
+	struct Civil
+	{
+		int32_t year;
+		uint8_t month;
+		uint8_t day;
+		uint8_t weekDay;
+		uint16_t yearDay; // 0 based as tm_yday
+	};
+
+	const TimeZoneTable *table = nullptr;
+	int64_t utcDay = std::numeric_limits<int64_t>::min();
+	// the first second with the after type (the end of the day if the type does not change)
+	int64_t transition;
+	const LocalTimeType *before;
+	const LocalTimeType *after;
+	// the local days utcDay - 1, utcDay, utcDay + 1 (an offset is less than a day)
+	Civil civil[3];
+};
+
+class LocalDayCache
+{
+  public:
+	~LocalDayCache() { flushCounters(); }
+
+	// nullptr if the day has more than one transition (or the cache is disabled)
+	const LocalDay *find(const TimeZoneTable &table, const int64_t utcDay)
+	{
+		const size_t size = localDayCacheSize.load(std::memory_order_relaxed);
+		if (size == 0)
+			return nullptr;
+		if (_days.size() != size)
+			_days.assign(size, LocalDay{});
+
+		LocalDay &localDay = _days[static_cast<uint64_t>(utcDay) % size];
+		if (localDay.utcDay == utcDay && localDay.table == &table)
+		{
+			count(_hits);
+			return &localDay;
+		}
+		count(_misses);
+		return fill(table, utcDay, &localDay) ? &localDay : nullptr;
+	}
+
+	// the counters not yet added to localDayCacheHits/localDayCacheMisses
+	uint64_t hits() const { return _hits; }
+	uint64_t misses() const { return _misses; }
+
+	void flushCounters()
+	{
+		localDayCacheHits.fetch_add(_hits, std::memory_order_relaxed);
+		localDayCacheMisses.fetch_add(_misses, std::memory_order_relaxed);
+		_hits = 0;
+		_misses = 0;
+	}
+
+  private:
+	// i contatori globali sono aggiornati ogni counterFlush eventi, non ad ogni conversione
+	static constexpr uint64_t counterFlush = 1024;
+
+	std::vector<LocalDay> _days;
+	uint64_t _hits = 0;
+	uint64_t _misses = 0;
+
+	void count(uint64_t &counter)
+	{
+		if (++counter == counterFlush)
+			flushCounters();
+	}
+
+	static bool fill(const TimeZoneTable &table, const int64_t utcDay, LocalDay *pLocalDay)
+	{
+		const int64_t dayStart = utcDay * 86400;
+		const int64_t dayEnd = dayStart + 86400;
+		int64_t from;
+		int64_t until;
+		const LocalTimeType &before = table.lookup(dayStart, &from, &until);
+		const LocalTimeType *after = &before;
+		if (until < dayEnd)
+		{
+			int64_t afterUntil;
+			after = &table.lookup(until, &from, &afterUntil);
+			if (afterUntil < dayEnd)
+				return false;
+		}
+		// civil copre solo offset minori di un giorno
+		if (std::abs(before.utcOffset) >= 86400 || std::abs(after->utcOffset) >= 86400)
+			return false;
+
+		pLocalDay->table = &table;
+		pLocalDay->utcDay = utcDay;
+		pLocalDay->transition = std::min(until, dayEnd);
+		pLocalDay->before = &before;
+		pLocalDay->after = after;
+		for (int index = 0; index < 3; index++)
+		{
+			const int64_t days = utcDay - 1 + index;
+			int64_t year;
+			int month;
+			int day;
+			Datetime::civilFromDays(days, &year, &month, &day);
+			pLocalDay->civil[index] = LocalDay::Civil{
+				static_cast<int32_t>(year), static_cast<uint8_t>(month), static_cast<uint8_t>(day), static_cast<uint8_t>(Datetime::weekDayFromDays(days)),
+				static_cast<uint16_t>(days - Datetime::daysFromCivil(year, 1, 1))
+			};
+		}
+		return true;
+	}
+};
+
+thread_local LocalDayCache localDayCache;
+
+void utcToLocalTm(const TimeZoneTable &table, const int64_t utcTime, tm *ptmLocalDateTime)
+{
+	const int64_t utcDay = floorDiv(utcTime, 86400);
+	if (const LocalDay *localDay = localDayCache.find(table, utcDay))
+	{
+		const LocalTimeType &type = utcTime < localDay->transition ? *localDay->before : *localDay->after;
+		const int64_t localSeconds = utcTime + type.utcOffset - (utcDay - 1) * 86400;
+		const LocalDay::Civil &civil = localDay->civil[localSeconds / 86400];
+		const int secondsOfDay = static_cast<int>(localSeconds % 86400);
+
+		ptmLocalDateTime->tm_sec = secondsOfDay % 60;
+		ptmLocalDateTime->tm_min = secondsOfDay / 60 % 60;
+		ptmLocalDateTime->tm_hour = secondsOfDay / 3600;
+		ptmLocalDateTime->tm_mday = civil.day;
+		ptmLocalDateTime->tm_mon = civil.month - 1;
+		ptmLocalDateTime->tm_year = civil.year - 1900;
+		ptmLocalDateTime->tm_wday = civil.weekDay;
+		ptmLocalDateTime->tm_yday = civil.yearDay;
+		ptmLocalDateTime->tm_isdst = type.isDst;
+#ifndef _WIN32
+		ptmLocalDateTime->tm_gmtoff = type.utcOffset;
+		ptmLocalDateTime->tm_zone = type.abbreviation.c_str();
+#endif
+		return;
+	}
+
+	const LocalTimeType &type = table.lookup(utcTime);
+	utcToTm(utcTime + type.utcOffset, ptmLocalDateTime);
+	ptmLocalDateTime->tm_isdst = type.isDst;
+#ifndef _WIN32
+	ptmLocalDateTime->tm_gmtoff = type.utcOffset;
+	ptmLocalDateTime->tm_zone = type.abbreviation.c_str();
+#endif
+}
+
+// local -> UTC, isDst (as tm_isdst) and dstPolicy choose for a skipped or repeated local time,
+// with DstPolicy::Reject the error is "skipped" or "repeated". table nullptr: mktime, the policy is not applied
+std::expected<int64_t, const char *>
+tryResolveLocalSeconds(const TimeZoneTable *table, const int64_t localSeconds, const int isDst, const Datetime::DstPolicy dstPolicy)
+{
+	if (table == nullptr)
+	{
+		tm tmLocalDateTime;
+		utcToTm(localSeconds, &tmLocalDateTime);
+		tmLocalDateTime.tm_isdst = isDst;
+		return mktime(&tmLocalDateTime);
+	}
+
+	// gli offset prima e dopo una eventuale transizione vicina
+	const LocalTimeType &before = table->lookup(localSeconds - 86400);
+	const LocalTimeType &after = table->lookup(localSeconds + 86400);
+	const int64_t beforeUtc = localSeconds - before.utcOffset;
+	const int64_t afterUtc = localSeconds - after.utcOffset;
+	const bool beforeValid = table->lookup(beforeUtc).utcOffset == before.utcOffset;
+	const bool afterValid = table->lookup(afterUtc).utcOffset == after.utcOffset;
+
+	if (beforeValid && afterValid && beforeUtc != afterUtc)
+	{
+		if (isDst >= 0 && before.isDst != after.isDst)
+			return after.isDst == (isDst > 0) ? afterUtc : beforeUtc;
+		if (dstPolicy == Datetime::DstPolicy::Reject)
+			return std::unexpected("repeated");
+		return dstPolicy == Datetime::DstPolicy::Later ? std::max(beforeUtc, afterUtc) : std::min(beforeUtc, afterUtc);
+	}
+	if (beforeValid)
+		return beforeUtc;
+	if (afterValid)
+		return afterUtc;
+
+	// ora saltata: beforeUtc è dopo la transizione (spostata in avanti), afterUtc prima (spostata indietro)
+	if (dstPolicy == Datetime::DstPolicy::Reject)
+		return std::unexpected("skipped");
+	return dstPolicy == Datetime::DstPolicy::Earlier ? afterUtc : beforeUtc;
+}
+
+// local -> UTC like mktime: fields normalized, tm_isdst chooses the offset of an ambiguous local time
+int64_t localTmToUtc(const TimeZoneTable &table, const tm &localTime)
+{
+	return *tryResolveLocalSeconds(&table, utcFromTm(localTime), localTime.tm_isdst, Datetime::DstPolicy::Compatible);
+}
+} // namespace
+
+void Datetime::setLocalDayCacheSize(const size_t days) { localDayCacheSize.store(days, std::memory_order_relaxed); }
+
+Datetime::LocalDayCacheStats Datetime::localDayCacheStats()
+{
+	return LocalDayCacheStats{
+		localDayCacheHits.load(std::memory_order_relaxed) + localDayCache.hits(),
+		localDayCacheMisses.load(std::memory_order_relaxed) + localDayCache.misses()
+	};
+}
+
+Datetime::Stats Datetime::stats()
+{
+	Stats stats{};
+	stats.localDayCache = localDayCacheStats();
+#ifdef DATETIME_STATS
+	static_assert(static_cast<int>(StatsFailure::Format) == static_cast<int>(ParseErrorKind::Format));
+
+	StatsRegistry &registry = statsRegistry();
+	StatsTotals totals;
+	{
+		std::lock_guard lock(registry.mutex);
+		totals = registry.retired;
+		for (const StatsShard *shard : registry.shards)
+			shard->addTo(totals);
+	}
+
+	stats.enabled = true;
+#ifdef DATETIME_X86_SIMD
+	// TSC calibrato sullo steady_clock dal primo uso (almeno 10 ms)
+	auto elapsed = std::chrono::steady_clock::now() - registry.startTime;
+	if (elapsed < std::chrono::milliseconds(10))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10) - elapsed);
+		elapsed = std::chrono::steady_clock::now() - registry.startTime;
+	}
+	const uint64_t ticks = statsTicks() - registry.startTicks;
+	stats.nanosecsPerTick = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / static_cast<double>(ticks);
+#else
+	stats.nanosecsPerTick = 1.0;
+#endif
+
+	for (size_t function = 0; function < statsFunctionsCount; function++)
+	{
+		const StatsCounters &counters = totals[function];
+		if (counters.calls == 0)
+			continue;
+
+		FunctionStats functionStats{};
+		functionStats.name = statsFunctionNames[function];
+		functionStats.calls = counters.calls;
+		functionStats.latencySamples = counters.samples;
+		for (size_t reason = 0; reason < statsFailureReasons; reason++)
+		{
+			functionStats.failuresByReason[reason] = counters.failures[reason];
+			functionStats.failures += counters.failures[reason];
+		}
+		functionStats.latencyHistogram = counters.latency;
+		functionStats.sampledNanosecs = static_cast<double>(counters.ticks) * stats.nanosecsPerTick;
+		stats.functions.push_back(functionStats);
+	}
+#endif
+
+	return stats;
+}
+
+void Datetime::setStatsSampling([[maybe_unused]] const uint32_t everyCalls)
+{
+#ifdef DATETIME_STATS
+	statsSampling.store(std::max<uint32_t>(everyCalls, 1), std::memory_order_relaxed);
+#endif
+}
+
+const char *Datetime::statsFailureName(const StatsFailure failure) noexcept
+{
+	switch (failure)
+	{
+	case StatsFailure::Length:
+	case StatsFailure::Digit:
+	case StatsFailure::Separator:
+	case StatsFailure::Range:
+	case StatsFailure::Format:
+		return parseErrorKindName(static_cast<ParseErrorKind>(failure));
+	case StatsFailure::Rejected:
+		return "rejected";
+	case StatsFailure::Exception:
+		return "exception";
+	}
+	return "unknown";
+}
+
+struct Datetime::TimeZone::Table
+{
+	std::string name;
+	std::unique_ptr<TimeZoneTable> table;
+};
+
+Datetime::TimeZone Datetime::TimeZone::locate(const std::string_view name)
+{
+	DATETIME_STATS_SCOPE(timeZoneLocate);
+	struct NameHash
+	{
+		using is_transparent = void;
+		size_t operator()(const std::string_view name) const { return std::hash<std::string_view>{}(name); }
+	};
+	// le zone non sono mai rimosse: gli handle e i tm_zone restano validi per tutto il processo
+	static std::shared_mutex mutex;
+	static std::unordered_map<std::string, std::unique_ptr<Table>, NameHash, std::equal_to<>> tables;
+
+	{
+		std::shared_lock lock(mutex);
+		if (const auto it = tables.find(name); it != tables.end())
+			return TimeZone(it->second.get());
+	}
+
+	if (name.empty() || name.front() == '/' || name.find("..") != std::string_view::npos)
+	{
+		const std::string errorMessage = std::format("Wrong time zone name, name: {}", name);
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
+
+	const std::string path = std::format("{}/{}", timeZoneDirectory(), name);
+	std::unique_ptr<TimeZoneTable> timeZoneTable = loadTimeZoneFile(path);
+	if (timeZoneTable == nullptr)
+	{
+		const std::string errorMessage = std::format("Time zone not found or not supported, name: {}, path: {}", name, path);
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
+
+	std::unique_lock lock(mutex);
+	auto [it, inserted] = tables.try_emplace(std::string(name));
+	if (inserted)
+		it->second = std::make_unique<Table>(Table{std::string(name), std::move(timeZoneTable)});
+
+	return TimeZone(it->second.get());
+}
+
+const std::string &Datetime::TimeZone::name() const { return _table->name; }
+
+int32_t Datetime::TimeZone::utcOffset(const time_t utcTime) const
+{
+	DATETIME_STATS_SCOPE(timeZoneUtcOffset);
+	return _table->table->lookup(utcTime).utcOffset;
+}
+
+tm Datetime::TimeZone::toLocal(const time_t utcTime) const
+{
+	DATETIME_STATS_SCOPE(timeZoneToLocal);
+	tm tmDateTime{};
+
+	utcToLocalTm(*_table->table, utcTime, &tmDateTime);
+	return tmDateTime;
+}
+
+time_t Datetime::TimeZone::toUtc(const tm &localTime) const
+{
+	DATETIME_STATS_SCOPE(timeZoneToUtc);
+	return static_cast<time_t>(localTmToUtc(*_table->table, localTime));
+}
+
+namespace
+{
+// localtime_r without the glibc tz lock when the local zone is supported by the in-process engine
+inline void utcToLocalTm(const time_t utcTime, tm *ptmLocalDateTime)
+{
+#ifdef _WIN32
+	localtime_s(ptmLocalDateTime, &utcTime);
+#else
+	if (const TimeZoneTable *table = localTimeZoneTable())
+		utcToLocalTm(*table, utcTime, ptmLocalDateTime);
+	else
+		localtime_r(&utcTime, ptmLocalDateTime);
+#endif
+}
+} // namespace
+
+namespace
+{
+// UTC offsets of a sequence of times: a table lookup only when a time leaves the offset interval of the previous one
+class OffsetCursor
+{
+  public:
+	// table nullptr: the process local zone through utcToLocalTm, a call per second
+	explicit OffsetCursor(const TimeZoneTable *table) : _table(table) {}
+
+	int32_t utcOffset(const int64_t utcTime)
+	{
+		if (utcTime < _from || utcTime >= _until)
+		{
+			if (_table != nullptr)
+				_offset = _table->lookup(utcTime, &_from, &_until).utcOffset;
+			else
+			{
+				tm tmLocalDateTime;
+				utcToLocalTm(static_cast<time_t>(utcTime), &tmLocalDateTime);
+				_offset = static_cast<int32_t>(utcFromTm(tmLocalDateTime) - utcTime);
+				_from = utcTime;
+				_until = utcTime + 1;
+			}
+		}
+		return _offset;
+	}
+
+  private:
+	const TimeZoneTable *_table;
+	int64_t _from = std::numeric_limits<int64_t>::max();
+	int64_t _until = std::numeric_limits<int64_t>::min();
+	int32_t _offset = 0;
+};
+
+/*
+	Current UTC offset of the process local zone and its interval [from, until) (until is the next transition):
+	while the time is in the interval a read is an atomic load. A new interval is a new object, the previous
+	ones are kept (a reader could still use them): two per year plus one per reloadLocalTimeZone.
+	A zone not supported by the table (and Windows) is not cached, localtime_r at every call.
+*/
+struct LocalOffset
+{
+	int64_t from;
+	int64_t until;
+	int32_t utcOffset;
+};
+
+std::atomic<const LocalOffset *> localOffset{nullptr};
+std::mutex localOffsetMutex;
+std::vector<std::unique_ptr<LocalOffset>> localOffsets;
+
+// seconds east of UTC at utcTime, current true publishes the interval of utcTime (the now of the callers)
+inline bool inLocalOffset(const LocalOffset *offset, const int64_t utcTime)
+{
+	return offset != nullptr && utcTime >= offset->from && utcTime < offset->until;
+}
+
+int32_t localUtcOffset(const int64_t utcTime, const bool current)
+{
+	if (const LocalOffset *offset = localOffset.load(std::memory_order_acquire); inLocalOffset(offset, utcTime)) [[likely]]
+		return offset->utcOffset;
+
+	const TimeZoneTable *table = processTimeZoneTable();
+	if (table == nullptr)
+	{
+		tm tmLocalDateTime;
+		utcToLocalTm(static_cast<time_t>(utcTime), &tmLocalDateTime);
+		return static_cast<int32_t>(utcFromTm(tmLocalDateTime) - utcTime);
+	}
+	if (!current)
+		return table->lookup(utcTime).utcOffset;
+
+	// la tabella è riletta sotto il lock: reloadLocalTimeZone azzera localOffset dopo averla sostituita
+	std::lock_guard<std::mutex> locker(localOffsetMutex);
+	if (const LocalOffset *offset = localOffset.load(std::memory_order_acquire); inLocalOffset(offset, utcTime))
+		return offset->utcOffset;
+	table = processTimeZoneTable();
+	if (table == nullptr)
+		return localUtcOffset(utcTime, false);
+	auto offset = std::make_unique<LocalOffset>();
+	offset->utcOffset = table->lookup(utcTime, &offset->from, &offset->until).utcOffset;
+	localOffset.store(offset.get(), std::memory_order_release);
+	localOffsets.push_back(std::move(offset));
+	return localOffsets.back()->utcOffset;
+}
+
+// UTC of the local start of a bucket, offset is the one of a time in the bucket
+int64_t bucketStartToUtc(OffsetCursor &cursor, const int64_t localStart, const int32_t offset)
+{
+	const int64_t candidate = localStart - offset;
+	const int32_t candidateOffset = cursor.utcOffset(candidate);
+	if (candidateOffset == offset)
+		return candidate;
+	const int64_t other = localStart - candidateOffset;
+	if (cursor.utcOffset(other) == candidateOffset)
+		return other;
+
+	// inizio del bucket saltato dall'inizio del DST: il bucket parte dalla transizione
+	int64_t before = std::min(candidate, other);
+	int64_t after = std::max(candidate, other);
+	const int32_t beforeOffset = cursor.utcOffset(before);
+	while (after - before > 1)
+	{
+		const int64_t middle = before + (after - before) / 2;
+		if (cursor.utcOffset(middle) == beforeOffset)
+			before = middle;
+		else
+			after = middle;
+	}
+	return after;
+}
+
+void localBuckets(
+	OffsetCursor &cursor, const std::span<const int64_t> utcInMillisecs, const Datetime::Bucket bucket, const std::span<int64_t> bucketStartsInMillisecs,
+	const std::span<uint8_t> isoWeeks, const std::span<uint16_t> daysOfYear, const std::span<uint8_t> weekDays
+)
+{
+	for (const size_t outputSize : {bucketStartsInMillisecs.size(), isoWeeks.size(), daysOfYear.size(), weekDays.size()})
+		if (outputSize != 0 && outputSize < utcInMillisecs.size())
+		{
+			const std::string errorMessage =
+				std::format("localBuckets, output too small, values: {}, output size: {}", utcInMillisecs.size(), outputSize);
+			DATETIME_STATS_EXCEPTION();
+			LOG_ERROR(errorMessage);
+			throw std::runtime_error(errorMessage);
+		}
+
+	constexpr int64_t noValue = std::numeric_limits<int64_t>::min();
+
+	// i campi del giorno locale e l'inizio del bucket sono ricalcolati solo quando cambiano
+	int64_t cachedDay = noValue;
+	int64_t dayBucketStart = 0;
+	uint8_t isoWeek = 0;
+	uint16_t dayOfYear = 0;
+	uint8_t weekDay = 0;
+	int64_t cachedLocalStart = noValue;
+	int32_t cachedOffset = 0;
+	int64_t cachedUtcStart = 0;
+	for (size_t index = 0; index < utcInMillisecs.size(); index++)
+	{
+		const int64_t utcTime = floorDiv(utcInMillisecs[index], 1000);
+		const int32_t offset = cursor.utcOffset(utcTime);
+		const int64_t localTime = utcTime + offset;
+		const int64_t localDay = floorDiv(localTime, 86400);
+		if (localDay != cachedDay)
+		{
+			int64_t year;
+			int month;
+			int day;
+			Datetime::civilFromDays(localDay, &year, &month, &day);
+			weekDay = static_cast<uint8_t>(Datetime::weekDayFromDays(localDay));
+			dayOfYear = static_cast<uint16_t>(localDay - Datetime::daysFromCivil(year, 1, 1) + 1);
+
+			// la settimana ISO è quella del suo giovedì
+			const int64_t monday = localDay - (weekDay + 6) % 7;
+			int64_t thursdayYear;
+			int thursdayMonth;
+			int thursdayDay;
+			Datetime::civilFromDays(monday + 3, &thursdayYear, &thursdayMonth, &thursdayDay);
+			isoWeek = static_cast<uint8_t>((monday + 3 - Datetime::daysFromCivil(thursdayYear, 1, 1)) / 7 + 1);
+
+			if (bucket == Datetime::Bucket::IsoWeek)
+				dayBucketStart = monday * 86400;
+			else if (bucket == Datetime::Bucket::Month)
+				dayBucketStart = Datetime::daysFromCivil(year, month, 1) * 86400;
+			else
+				dayBucketStart = localDay * 86400;
+			cachedDay = localDay;
+		}
+
+		if (!bucketStartsInMillisecs.empty())
+		{
+			int64_t localStart;
+			if (bucket == Datetime::Bucket::Minute)
+				localStart = localTime - (localTime - localDay * 86400) % 60;
+			else if (bucket == Datetime::Bucket::Hour)
+				localStart = localTime - (localTime - localDay * 86400) % 3600;
+			else
+				localStart = dayBucketStart;
+			if (localStart != cachedLocalStart || offset != cachedOffset)
+			{
+				cachedUtcStart = bucketStartToUtc(cursor, localStart, offset);
+				cachedLocalStart = localStart;
+				cachedOffset = offset;
+			}
+			bucketStartsInMillisecs[index] = cachedUtcStart * 1000;
+		}
+		if (!isoWeeks.empty())
+			isoWeeks[index] = isoWeek;
+		if (!daysOfYear.empty())
+			daysOfYear[index] = dayOfYear;
+		if (!weekDays.empty())
+			weekDays[index] = weekDay;
+	}
+}
+} // namespace
+
+void Datetime::localBuckets(
+	const std::span<const int64_t> utcInMillisecs, const Bucket bucket, const std::span<int64_t> bucketStartsInMillisecs,
+	const std::span<uint8_t> isoWeeks, const std::span<uint16_t> daysOfYear, const std::span<uint8_t> weekDays
+)
+{
+	DATETIME_STATS_SCOPE(localBuckets);
+	OffsetCursor cursor(processTimeZoneTable());
+	::localBuckets(cursor, utcInMillisecs, bucket, bucketStartsInMillisecs, isoWeeks, daysOfYear, weekDays);
+}
+
+void Datetime::localBuckets(
+	const std::span<const int64_t> utcInMillisecs, const TimeZone &timeZone, const Bucket bucket, const std::span<int64_t> bucketStartsInMillisecs,
+	const std::span<uint8_t> isoWeeks, const std::span<uint16_t> daysOfYear, const std::span<uint8_t> weekDays
+)
+{
+	DATETIME_STATS_SCOPE(localBucketsTimeZone);
+	OffsetCursor cursor(timeZone._table->table.get());
+	::localBuckets(cursor, utcInMillisecs, bucket, bucketStartsInMillisecs, isoWeeks, daysOfYear, weekDays);
+}
+
+// 2021-02-26 15:41:15
+std::string Datetime::timePointAsLocalString(std::chrono::system_clock::time_point t)
+{
+	DATETIME_STATS_SCOPE(timePointAsLocalString);
+	char buffer[64];
+	return {buffer, timePointAsLocalString(buffer, t)};
+}
+
+size_t Datetime::timePointAsLocalString(const std::span<char> output, std::chrono::system_clock::time_point t)
+{
+	DATETIME_STATS_SCOPE(timePointAsLocalStringBuffer);
+	time_t utcTime = std::chrono::system_clock::to_time_t(t);
+
+	thread_local SecondCache cache;
+	const uint32_t zoneGeneration = localTimeZoneGeneration.load(std::memory_order_relaxed);
+	if (cache.second != utcTime || cache.zoneGeneration != zoneGeneration)
+	{
+		tm tmDateTime;
+		utcToLocalTm(utcTime, &tmDateTime);
+
+		const int year = tmDateTime.tm_year + 1900;
+		if (year >= 0 && year <= 9999)
+			cache.length = writeIsoDateTime(
+							   cache.text, year, tmDateTime.tm_mon + 1, tmDateTime.tm_mday, ' ', tmDateTime.tm_hour, tmDateTime.tm_min,
+							   tmDateTime.tm_sec
+						   ) -
+						   cache.text;
+		else
+			cache.length = std::format_to_n(
+							   cache.text, sizeof(cache.text), "{:0>4}-{:0>2}-{:0>2} {:0>2}:{:0>2}:{:0>2}", year, tmDateTime.tm_mon + 1,
+							   tmDateTime.tm_mday, tmDateTime.tm_hour, tmDateTime.tm_min, tmDateTime.tm_sec
+			)
+							   .size;
+		cache.second = utcTime;
+		cache.zoneGeneration = zoneGeneration;
+	}
+
+	return copyToOutput(output, std::string_view(cache.text, cache.length));
+}
+
+std::string Datetime::timePointAsLocalString(std::chrono::system_clock::time_point t, const TimeZone &timeZone)
+{
+	DATETIME_STATS_SCOPE(timePointAsLocalStringTimeZone);
+	char buffer[64];
+	return {buffer, timePointAsLocalString(buffer, t, timeZone)};
+}
+
+size_t Datetime::timePointAsLocalString(const std::span<char> output, std::chrono::system_clock::time_point t, const TimeZone &timeZone)
+{
+	DATETIME_STATS_SCOPE(timePointAsLocalStringBufferTimeZone);
+	const tm tmDateTime = timeZone.toLocal(std::chrono::system_clock::to_time_t(t));
+
+	char text[64];
+	const int year = tmDateTime.tm_year + 1900;
+	size_t length;
+	if (year >= 0 && year <= 9999)
+		length =
+			writeIsoDateTime(text, year, tmDateTime.tm_mon + 1, tmDateTime.tm_mday, ' ', tmDateTime.tm_hour, tmDateTime.tm_min, tmDateTime.tm_sec) -
+			text;
+	else
+		length = std::format_to_n(
+					 text, sizeof(text), "{:0>4}-{:0>2}-{:0>2} {:0>2}:{:0>2}:{:0>2}", year, tmDateTime.tm_mon + 1, tmDateTime.tm_mday,
+					 tmDateTime.tm_hour, tmDateTime.tm_min, tmDateTime.tm_sec
+		)
+					 .size;
+
+	return copyToOutput(output, std::string_view(text, length));
+}
+
+// 2021-02-26T15:41:15Z
+std::string Datetime::timePointAsUtcString(std::chrono::system_clock::time_point t)
+{
+	DATETIME_STATS_SCOPE(timePointAsUtcString);
+	char buffer[64];
+	return {buffer, timePointAsUtcString(buffer, t)};
+}
+
+size_t Datetime::timePointAsUtcString(const std::span<char> output, std::chrono::system_clock::time_point t)
+{
+	DATETIME_STATS_SCOPE(timePointAsUtcStringBuffer);
+	time_t utcTime = std::chrono::system_clock::to_time_t(t);
+
+	thread_local SecondCache cache;
+	if (cache.second != utcTime)
+	{
+		int64_t days = utcTime / 86400;
+		int64_t secondsOfDay = utcTime % 86400;
+		if (secondsOfDay < 0)
+		{
+			days--;
+			secondsOfDay += 86400;
+		}
+		int64_t year;
+		int month;
+		int day;
+		civilFromDays(days, &year, &month, &day);
+
+		if (year >= 0 && year <= 9999)
+		{
+			char *end = writeIsoDateTime(cache.text, year, month, day, 'T', secondsOfDay / 3600, secondsOfDay / 60 % 60, secondsOfDay % 60);
+			*end++ = 'Z';
+			cache.length = end - cache.text;
+		}
+		else
+			cache.length = std::format_to_n(
+							   cache.text, sizeof(cache.text), "{:0>4}-{:0>2}-{:0>2}T{:0>2}:{:0>2}:{:0>2}Z", year, month, day, secondsOfDay / 3600,
+							   secondsOfDay / 60 % 60, secondsOfDay % 60
+			)
+							   .size;
+		cache.second = utcTime;
+	}
+
+	return copyToOutput(output, std::string_view(cache.text, cache.length));
+}
+
+std::string Datetime::localToUtcString(tm localTime)
+{
+	DATETIME_STATS_SCOPE(localToUtcString);
+	time_t utcTime = utcFromTm(localTime);
+
+	return utcToUtcString(utcTime);
+}
+
+
+// convert 2021-02-26T15:41:15.477+0100 (ISO8610) to utc
+uint64_t Datetime::iso8610ToUtc(const std::string& datetime, const bool millisecondsPrecision)
+{
+	DATETIME_STATS_SCOPE(iso8610ToUtc);
+	if (const auto utcTime = iso8610ToUtcInSecsOrMillisecs(datetime, millisecondsPrecision))
+		return *utcTime;
+
+	if (datetime.size() != 28)
+	{
+		const std::string errorMessage = std::format("Invalid datetime format, expected length is 28, but got {}: {}", datetime.length(), datetime);
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
+
+	int offsetSeconds;
+	{
+		const char sign = datetime[datetime.size() - 5];
+		std::string offsetStr = datetime.substr(datetime.size() - 4, 4);
+		const int offsetHours = std::stoi(offsetStr.substr(0, 2));
+		const int offsetMinutes = std::stoi(offsetStr.substr(2, 2));
+		offsetSeconds = offsetHours * 3600 + offsetMinutes * 60;
+		if (sign == '-')
+			offsetSeconds = -offsetSeconds;
+	}
+
+	time_t utcTime = parseStringToUtcInSecs(datetime, "%Y-%m-%dT%H:%M:%S");
+	utcTime -= offsetSeconds;
+
+	if (millisecondsPrecision)
+	{
+		const int milliSecs = std::stoi(datetime.substr(datetime.size() - 8, 3));
+		return utcTime * 1000 + milliSecs;
+	}
+	return utcTime;
+}
+
+void Datetime::nowUTCInMilliSecs(unsigned long long *pullNowUTCInSecs, unsigned long *pulAdditionalMilliSecs, long *plTimeZoneDifferenceInHours)
+{
+	DATETIME_STATS_SCOPE(nowUTCInMilliSecsSecsMillis);
+#ifdef _WIN32
+	SYSTEMTIME stSystemTime;
+#else
+	struct timeval tvTimeval;
+#endif
+
+#ifdef _WIN32
+	GetLocalTime(&stSystemTime);
+
+	(*pullNowUTCInSecs) = time(NULL);
+	(*pulAdditionalMilliSecs) = stSystemTime.wMilliseconds;
+
+	if (plTimeZoneDifferenceInHours != (long *)NULL)
+		Datetime::getTimeZoneInformation(plTimeZoneDifferenceInHours);
+#else
+	gettimeofday(&tvTimeval, NULL);
+
+	// l'offset in cache, non la struct timezone (obsoleta) di gettimeofday
+	if (plTimeZoneDifferenceInHours != (long *)NULL)
+		*plTimeZoneDifferenceInHours = localUtcOffset(tvTimeval.tv_sec, true) / 3600;
+
+	(*pullNowUTCInSecs) = tvTimeval.tv_sec;
+	(*pulAdditionalMilliSecs) = (tvTimeval.tv_usec / 1000);
+#endif
+}
+
+void Datetime::nowUTCInMilliSecs(unsigned long long *pullNowUTCInMilliSecs, long *plTimeZoneDifferenceInHours)
+{
+	DATETIME_STATS_SCOPE(nowUTCInMilliSecs);
+	unsigned long long ullNowUTCInSecs;
+	unsigned long ulAdditionalMilliSecs;
+
+	Datetime::nowUTCInMilliSecs(&ullNowUTCInSecs, &ulAdditionalMilliSecs, plTimeZoneDifferenceInHours);
+
+	(*pullNowUTCInMilliSecs) = ullNowUTCInSecs;
+	(*pullNowUTCInMilliSecs) *= 1000;
+	(*pullNowUTCInMilliSecs) += ulAdditionalMilliSecs;
+}
+
+void Datetime::nowLocalInMilliSecs(unsigned long long *pullNowLocalInMilliSecs)
+{
+	DATETIME_STATS_SCOPE(nowLocalInMilliSecs);
+	unsigned long long ullNowUTCInMilliSecs;
+
+	Datetime::nowUTCInMilliSecs(&ullNowUTCInMilliSecs, nullptr);
+
+	// offset in secondi: i fusi di mezz'ora (+05:30) non sono troncati
+	*pullNowLocalInMilliSecs = ullNowUTCInMilliSecs + static_cast<int64_t>(localUtcOffset(ullNowUTCInMilliSecs / 1000, true)) * 1000;
+}
+
+std::string Datetime::dateTimeFormat(const uint64_t milliSecondsSinceEpoch, const std::string& outputFormat, const std::string& outputPrecision)
+{
+	DATETIME_STATS_SCOPE(dateTimeFormatMs);
+	return dateTimeFormat(milliSecondsSinceEpoch, outputFormat, precisionFromString(outputPrecision));
+}
+
+std::string Datetime::dateTimeFormat(const std::chrono::system_clock::time_point& timePoint, const std::string& outputFormat,
+	const std::string& outputPrecision)
+{
+	DATETIME_STATS_SCOPE(dateTimeFormatTimePoint);
+	return dateTimeFormat(timePoint, outputFormat, precisionFromString(outputPrecision));
+}
+
+std::string Datetime::dateTimeFormat(const uint64_t milliSecondsSinceEpoch, const std::string_view outputFormat, const Precision outputPrecision)
+{
+	DATETIME_STATS_SCOPE(dateTimeFormatMsPrecision);
+	return formatter(outputFormat, outputPrecision).format(milliSecondsSinceEpoch);
+}
+
+std::string Datetime::dateTimeFormat(const std::chrono::system_clock::time_point& timePoint, const std::string_view outputFormat,
+	const Precision outputPrecision)
+{
+	DATETIME_STATS_SCOPE(dateTimeFormatTimePointPrecision);
+	return formatter(outputFormat, outputPrecision).format(timePoint);
+}
+
+size_t Datetime::dateTimeFormat(const std::span<char> output, const uint64_t milliSecondsSinceEpoch, const std::string_view outputFormat,
+	const std::string_view outputPrecision)
+{
+	DATETIME_STATS_SCOPE(dateTimeFormatBufferMs);
+	return dateTimeFormat(output, milliSecondsSinceEpoch, outputFormat, precisionFromString(outputPrecision));
+}
+
+size_t Datetime::dateTimeFormat(const std::span<char> output, const std::chrono::system_clock::time_point& timePoint,
+	const std::string_view outputFormat, const std::string_view outputPrecision)
+{
+	DATETIME_STATS_SCOPE(dateTimeFormatBufferTimePoint);
+	return dateTimeFormat(output, timePoint, outputFormat, precisionFromString(outputPrecision));
+}
+
+size_t Datetime::dateTimeFormat(const std::span<char> output, const uint64_t milliSecondsSinceEpoch, const std::string_view outputFormat,
+	const Precision outputPrecision)
+{
+	DATETIME_STATS_SCOPE(dateTimeFormatBufferMsPrecision);
+	return formatter(outputFormat, outputPrecision).format(output, milliSecondsSinceEpoch);
+}
+
+size_t Datetime::dateTimeFormat(const std::span<char> output, const std::chrono::system_clock::time_point& timePoint,
+	const std::string_view outputFormat, const Precision outputPrecision)
+{
+	DATETIME_STATS_SCOPE(dateTimeFormatBufferTimePointPrecision);
+	return formatter(outputFormat, outputPrecision).format(output, timePoint);
+}
+
+void Datetime::dateTimeFormatColumn(const std::span<const uint64_t> milliSecondsSinceEpoch, std::string &chars,
+	std::vector<int32_t> &offsets, const std::string_view outputFormat, const Precision outputPrecision)
+{
+	DATETIME_STATS_SCOPE(dateTimeFormatColumn);
+	formatter(outputFormat, outputPrecision).formatColumn(milliSecondsSinceEpoch, chars, offsets);
+}
+
+Datetime::Precision Datetime::precisionFromString(const std::string_view outputPrecision)
+{
+	DATETIME_STATS_SCOPE(precisionFromString);
+	if (outputPrecision == "seconds")
+		return Precision::Seconds;
+	if (outputPrecision == "millis" || outputPrecision == "milliseconds")
+		return Precision::Native;
+	if (outputPrecision == "micros" || outputPrecision == "microseconds")
+		return Precision::Micros;
+	if (outputPrecision == "nanos" || outputPrecision == "nanoseconds")
+		return Precision::Nanos;
+	if (outputPrecision == "minutes")
+		return Precision::Minutes;
+	if (outputPrecision == "hours")
+		return Precision::Hours;
+	if (outputPrecision == "days")
+		return Precision::Days;
+	DATETIME_STATS_FAILURE(Exception);
+	throw std::runtime_error(std::format("precision '{}' is not supported", outputPrecision));
+}
+
+const Datetime::Formatter &Datetime::formatter(const std::string_view outputFormat, const Precision outputPrecision)
+{
+	// pochi formati per thread: nessun lock, le chiavi sono confrontate solo con le entry del thread
+	struct CacheEntry
+	{
+		std::string outputFormat;
+		Precision outputPrecision;
+		Formatter formatter;
+	};
+	constexpr size_t cacheSize = 8;
+	thread_local std::vector<CacheEntry> cache;
+	thread_local size_t nextToReplace = 0;
+
+	if (cache.capacity() < cacheSize)
+		cache.reserve(cacheSize);
+
+	for (const CacheEntry &cacheEntry : cache)
+		if (cacheEntry.outputFormat == outputFormat && cacheEntry.outputPrecision == outputPrecision)
+			return cacheEntry.formatter;
+
+	Formatter newFormatter(outputFormat, outputPrecision);
+	if (cache.size() < cacheSize)
+	{
+		cache.push_back(CacheEntry{std::string(outputFormat), outputPrecision, std::move(newFormatter)});
+		return cache.back().formatter;
+	}
+
+	CacheEntry &cacheEntry = cache[nextToReplace];
+	nextToReplace = (nextToReplace + 1) % cacheSize;
+	cacheEntry = CacheEntry{std::string(outputFormat), outputPrecision, std::move(newFormatter)};
+	return cacheEntry.formatter;
+}
+
+Datetime::Formatter::Formatter(const std::string_view outputFormat, const std::string_view outputPrecision)
+	: Formatter(outputFormat, precisionFromString(outputPrecision))
+{
+}
+
+Datetime::Formatter::Formatter(const std::string_view outputFormat, const Precision outputPrecision)
+	: _precision(outputPrecision), _maxLength(0), _length(0), _planned(true)
+{
+	DATETIME_STATS_SCOPE(formatterConstructor);
+	constexpr int nativeFractionDigits = std::chrono::hh_mm_ss<std::chrono::system_clock::duration>::fractional_width;
+	static_assert(nativeFractionDigits == 0 || (nativeFractionDigits >= 3 && nativeFractionDigits <= 9));
+
+	switch (_precision)
+	{
+	case Precision::Millis:
+		_fractionDigits = 3;
+		break;
+	case Precision::Micros:
+		_fractionDigits = 6;
+		break;
+	case Precision::Nanos:
+		_fractionDigits = 9;
+		break;
+	case Precision::Native:
+		_fractionDigits = nativeFractionDigits;
+		break;
+	default:
+		_fractionDigits = 0;
+	}
+
+	// https://en.cppreference.com/w/cpp/chrono/system_clock/formatter.html
+	_vformatFormat = std::format("{{:{}}}", outputFormat);
+
+	const size_t secondsLength = 2 + (_fractionDigits > 0 ? 1 + _fractionDigits : 0);
+	for (size_t index = 0; index < outputFormat.size() && _planned; index++)
+	{
+		const char c = outputFormat[index];
+		if (c == '{' || c == '}')
+			_planned = false;
+		else if (c != '%')
+			addLiteral(std::string_view(&c, 1));
+		else if (++index == outputFormat.size())
+			_planned = false;
+		else
+		{
+			switch (outputFormat[index])
+			{
+			case 'Y':
+				addField(Field::Year, 4);
+				break;
+			case 'y':
+				addField(Field::YearOfCentury, 2);
+				break;
+			case 'm':
+				addField(Field::Month, 2);
+				break;
+			case 'd':
+				addField(Field::Day, 2);
+				break;
+			case 'j':
+				addField(Field::DayOfYear, 3);
+				break;
+			case 'H':
+				addField(Field::Hour, 2);
+				break;
+			case 'M':
+				addField(Field::Minute, 2);
+				break;
+			case 'S':
+				addField(Field::Second, secondsLength);
+				break;
+			case 'F':
+				addField(Field::Year, 4);
+				addLiteral("-");
+				addField(Field::Month, 2);
+				addLiteral("-");
+				addField(Field::Day, 2);
+				break;
+			case 'T':
+				addField(Field::Hour, 2);
+				addLiteral(":");
+				addField(Field::Minute, 2);
+				addLiteral(":");
+				addField(Field::Second, secondsLength);
+				break;
+			case 'R':
+				addField(Field::Hour, 2);
+				addLiteral(":");
+				addField(Field::Minute, 2);
+				break;
+			case 'Z':
+				addLiteral("UTC");
+				break;
+			case 'z':
+				addLiteral("+0000");
+				break;
+			case 'n':
+				addLiteral("\n");
+				break;
+			case 't':
+				addLiteral("\t");
+				break;
+			case '%':
+				addLiteral("%");
+				break;
+			default:
+				_planned = false;
+			}
+		}
+	}
+
+	if (!_planned)
+	{
+		_steps.clear();
+		_literals.clear();
+		_maxLength = 0;
+		_length = 0;
+	}
+}
+
+void Datetime::Formatter::addLiteral(const std::string_view literal)
+{
+	// literal consecutivi uniti in un solo step
+	if (!_steps.empty() && _steps.back().field == Field::Literal)
+		_steps.back().literalLength += literal.size();
+	else
+		_steps.push_back(Step{Field::Literal, static_cast<uint32_t>(_literals.size()), static_cast<uint32_t>(literal.size()),
+			static_cast<uint32_t>(_length)});
+	_literals += literal;
+	_maxLength += literal.size();
+	_length += literal.size();
+}
+
+void Datetime::Formatter::addField(const Field field, const size_t maxLength)
+{
+	_steps.push_back(Step{field, 0, 0, static_cast<uint32_t>(_length)});
+	_maxLength += maxLength;
+	_length += maxLength;
+}
+
+std::string Datetime::Formatter::format(const uint64_t milliSecondsSinceEpoch) const
+{
+	DATETIME_STATS_SCOPE(formatterFormatMs);
+	// Build time_point from milliseconds
+	const std::chrono::milliseconds milliSeconds{milliSecondsSinceEpoch};
+	return format(std::chrono::system_clock::time_point{milliSeconds});
+}
+
+std::string Datetime::Formatter::format(const std::chrono::system_clock::time_point &timePoint) const
+{
+	DATETIME_STATS_SCOPE(formatterFormatTimePoint);
+	if (_planned)
+	{
+		std::string output(_maxLength, '\0');
+		if (const size_t length = render(timePoint, output.data()); length > 0 || _maxLength == 0)
+		{
+			output.resize(length);
+			return output;
+		}
+	}
+
+	return vformat(timePoint);
+}
+
+size_t Datetime::Formatter::format(const std::span<char> output, const uint64_t milliSecondsSinceEpoch) const
+{
+	DATETIME_STATS_SCOPE(formatterFormatBufferMs);
+	const std::chrono::milliseconds milliSeconds{milliSecondsSinceEpoch};
+	return format(output, std::chrono::system_clock::time_point{milliSeconds});
+}
+
+size_t Datetime::Formatter::format(const std::span<char> output, const std::chrono::system_clock::time_point &timePoint) const
+{
+	DATETIME_STATS_SCOPE(formatterFormatBufferTimePoint);
+	constexpr size_t bufferLength = 256;
+
+	if (_planned && output.size() >= _maxLength)
+	{
+		if (const size_t length = render(timePoint, output.data()); length > 0 || _maxLength == 0)
+			return length;
+	}
+	else if (_planned && _maxLength <= bufferLength)
+	{
+		// output could be enough for the rendered chars even if it is less than _maxLength
+		char buffer[bufferLength];
+		if (const size_t length = render(timePoint, buffer); length > 0 || _maxLength == 0)
+			return copyToOutput(output, std::string_view(buffer, length));
+	}
+
+	return copyToOutput(output, vformat(timePoint));
+}
+
+void Datetime::Formatter::formatColumn(const std::span<const uint64_t> milliSecondsSinceEpoch, std::string &chars,
+	std::vector<int32_t> &offsets) const
+{
+	DATETIME_STATS_SCOPE(formatterFormatColumn);
+	constexpr int64_t noRow = std::numeric_limits<int64_t>::min();
+	constexpr size_t maxOffset = std::numeric_limits<int32_t>::max();
+
+	if (offsets.empty())
+		offsets.push_back(static_cast<int32_t>(chars.size()));
+	offsets.reserve(offsets.size() + milliSecondsSinceEpoch.size());
+
+	if (!_planned)
+	{
+		for (const uint64_t value : milliSecondsSinceEpoch)
+		{
+			chars += format(value);
+			if (chars.size() > maxOffset)
+			{
+				DATETIME_STATS_FAILURE(Exception);
+				throw std::runtime_error(std::format("column of {} chars does not fit the int32 offsets", chars.size()));
+			}
+			offsets.push_back(static_cast<int32_t>(chars.size()));
+		}
+		return;
+	}
+
+	// ogni riga è scritta copiando la precedente e aggiornando solo i campi cambiati
+	size_t rowStart = chars.size();
+	if (rowStart + milliSecondsSinceEpoch.size() * _length > maxOffset)
+	{
+		DATETIME_STATS_FAILURE(Exception);
+		throw std::runtime_error(std::format("column of {} chars does not fit the int32 offsets", rowStart + milliSecondsSinceEpoch.size() * _length));
+	}
+	chars.resize(rowStart + milliSecondsSinceEpoch.size() * _length);
+	// gli step dell'ora, i soli da aggiornare finché il giorno non cambia
+	std::vector<Step> timeSteps;
+	std::ranges::copy_if(_steps, std::back_inserter(timeSteps),
+		[](const Step &step) { return step.field == Field::Hour || step.field == Field::Minute || step.field == Field::Second; });
+	const char *previousRow = nullptr;
+	int64_t rowDays = noRow;
+	int64_t rowMinutes = noRow;
+	int64_t rowSeconds = noRow;
+	for (size_t valueIndex = 0; valueIndex < milliSecondsSinceEpoch.size(); valueIndex++)
+	{
+		const int64_t milliSecs = static_cast<int64_t>(milliSecondsSinceEpoch[valueIndex]);
+		int64_t days = milliSecs / 86400000;
+		int64_t milliSecsOfDay = milliSecs % 86400000;
+		if (milliSecsOfDay < 0)
+		{
+			days--;
+			milliSecsOfDay += 86400000;
+		}
+		int64_t secondsOfDay = milliSecsOfDay / 1000;
+		switch (_precision)
+		{
+		case Precision::Minutes:
+			secondsOfDay -= secondsOfDay % 60;
+			break;
+		case Precision::Hours:
+			secondsOfDay -= secondsOfDay % 3600;
+			break;
+		case Precision::Days:
+			secondsOfDay = 0;
+			break;
+		default:
+			break;
+		}
+
+		const bool dateChanged = days != rowDays;
+		int64_t year = 0;
+		int month = 0;
+		int day = 0;
+		if (dateChanged)
+			civilFromDays(days, &year, &month, &day);
+		if (dateChanged && (year < 0 || year > 9999))
+		{
+			// fuori dal piano: la riga ha un'altra lunghezza, le successive sono spostate
+			const std::string text = format(milliSecondsSinceEpoch[valueIndex]);
+			const size_t remaining = milliSecondsSinceEpoch.size() - valueIndex - 1;
+			if (rowStart + text.size() + remaining * _length > maxOffset)
+			{
+				DATETIME_STATS_FAILURE(Exception);
+				throw std::runtime_error(
+					std::format("column of {} chars does not fit the int32 offsets", rowStart + text.size() + remaining * _length)
+				);
+			}
+			chars.resize(rowStart);
+			chars += text;
+			chars.resize(chars.size() + remaining * _length);
+			rowStart += text.size();
+			offsets.push_back(static_cast<int32_t>(rowStart));
+			previousRow = nullptr;
+			rowDays = noRow;
+			continue;
+		}
+
+		char *row = chars.data() + rowStart;
+		if (previousRow != nullptr)
+			std::memcpy(row, previousRow, _length);
+		const bool minutesChanged = dateChanged || secondsOfDay / 60 != rowMinutes;
+		const bool secondsChanged = minutesChanged || secondsOfDay != rowSeconds;
+		for (const Step &step : dateChanged ? std::span<const Step>(_steps) : std::span<const Step>(timeSteps))
+		{
+			char *output = row + step.outputOffset;
+			switch (step.field)
+			{
+			case Field::Literal:
+				if (dateChanged)
+					std::copy_n(_literals.data() + step.literalOffset, step.literalLength, output);
+				break;
+			case Field::Year:
+				if (dateChanged)
+					writeFourDigits(output, static_cast<unsigned>(year));
+				break;
+			case Field::YearOfCentury:
+				if (dateChanged)
+					writeTwoDigits(output, static_cast<unsigned>(year % 100));
+				break;
+			case Field::Month:
+				if (dateChanged)
+					writeTwoDigits(output, month);
+				break;
+			case Field::Day:
+				if (dateChanged)
+					writeTwoDigits(output, day);
+				break;
+			case Field::DayOfYear:
+				if (dateChanged)
+					writeDigits(output, static_cast<unsigned>(days - daysFromCivil(year, 1, 1) + 1), 3);
+				break;
+			case Field::Hour:
+				if (minutesChanged)
+					writeTwoDigits(output, static_cast<unsigned>(secondsOfDay / 3600));
+				break;
+			case Field::Minute:
+				if (minutesChanged)
+					writeTwoDigits(output, static_cast<unsigned>(secondsOfDay / 60 % 60));
+				break;
+			case Field::Second:
+				if (secondsChanged)
+					writeTwoDigits(output, static_cast<unsigned>(secondsOfDay % 60));
+				// _fractionDigits è 0 o almeno 3, le cifre dopo i millisecondi sono sempre zero
+				if (_fractionDigits > 0)
+				{
+					if (dateChanged)
+					{
+						output[2] = '.';
+						std::fill_n(output + 6, _fractionDigits - 3, '0');
+					}
+					writeDigits(output + 3, static_cast<unsigned>(milliSecsOfDay % 1000), 3);
+				}
+				break;
+			}
+		}
+		previousRow = row;
+		rowDays = days;
+		rowMinutes = secondsOfDay / 60;
+		rowSeconds = secondsOfDay;
+		rowStart += _length;
+		offsets.push_back(static_cast<int32_t>(rowStart));
+	}
+}
+
+std::string Datetime::Formatter::vformat(const std::chrono::system_clock::time_point &timePoint) const
+{
+	switch (_precision)
+	{
+	case Precision::Native:
+		return std::vformat(_vformatFormat, std::make_format_args(timePoint));
+	case Precision::Nanos:
+	{
+		const auto _timePoint = floor<std::chrono::nanoseconds>(timePoint);
+		return std::vformat(_vformatFormat, std::make_format_args(_timePoint));
+	}
+	case Precision::Micros:
+	{
+		const auto _timePoint = floor<std::chrono::microseconds>(timePoint);
+		return std::vformat(_vformatFormat, std::make_format_args(_timePoint));
+	}
+	case Precision::Millis:
+	{
+		const auto _timePoint = floor<std::chrono::milliseconds>(timePoint);
+		return std::vformat(_vformatFormat, std::make_format_args(_timePoint));
+	}
+	case Precision::Seconds:
+	{
+		const auto _timePoint = floor<std::chrono::seconds>(timePoint);
+		return std::vformat(_vformatFormat, std::make_format_args(_timePoint));
+	}
+	case Precision::Minutes:
+	{
+		const auto _timePoint = floor<std::chrono::minutes>(timePoint);
+		return std::vformat(_vformatFormat, std::make_format_args(_timePoint));
+	}
+	case Precision::Hours:
+	{
+		const auto _timePoint = floor<std::chrono::hours>(timePoint);
+		return std::vformat(_vformatFormat, std::make_format_args(_timePoint));
+	}
+	default: // Precision::Days
+	{
+		const auto _timePoint = floor<std::chrono::days>(timePoint);
+		return std::vformat(_vformatFormat, std::make_format_args(_timePoint));
+	}
+	}
+}
+
+size_t Datetime::Formatter::render(const std::chrono::system_clock::time_point &timePoint, char *output) const
+{
+	constexpr uint32_t scale[] = {1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1};
+
+	const auto sinceEpoch = timePoint.time_since_epoch();
+	const auto days = floor<std::chrono::days>(sinceEpoch);
+	int64_t secondsOfDay = std::chrono::duration_cast<std::chrono::seconds>(sinceEpoch - days).count();
+	uint32_t subSeconds = 0;
+	switch (_precision)
+	{
+	case Precision::Millis:
+	case Precision::Micros:
+	case Precision::Nanos:
+	case Precision::Native:
+		subSeconds = static_cast<uint32_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(sinceEpoch - floor<std::chrono::seconds>(sinceEpoch)).count() /
+			scale[_fractionDigits]
+		);
+		break;
+	case Precision::Seconds:
+		break;
+	case Precision::Minutes:
+		secondsOfDay -= secondsOfDay % 60;
+		break;
+	case Precision::Hours:
+		secondsOfDay -= secondsOfDay % 3600;
+		break;
+	case Precision::Days:
+		secondsOfDay = 0;
+		break;
+	}
+
+	int64_t year;
+	int month;
+	int day;
+	civilFromDays(days.count(), &year, &month, &day);
+	if (year < 0 || year > 9999)
+		return 0;
+
+	char *current = output;
+	for (const Step &step : _steps)
+	{
+		switch (step.field)
+		{
+		case Field::Literal:
+			// quasi sempre un separatore di un solo carattere
+			if (step.literalLength == 1)
+				*current++ = _literals[step.literalOffset];
+			else
+				current = std::copy_n(_literals.data() + step.literalOffset, step.literalLength, current);
+			break;
+		case Field::Year:
+			current = writeFourDigits(current, static_cast<unsigned>(year));
+			break;
+		case Field::YearOfCentury:
+			current = writeTwoDigits(current, static_cast<unsigned>(year % 100));
+			break;
+		case Field::Month:
+			current = writeTwoDigits(current, month);
+			break;
+		case Field::Day:
+			current = writeTwoDigits(current, day);
+			break;
+		case Field::DayOfYear:
+			current = writeDigits(current, static_cast<unsigned>(days.count() - daysFromCivil(year, 1, 1) + 1), 3);
+			break;
+		case Field::Hour:
+			current = writeTwoDigits(current, static_cast<unsigned>(secondsOfDay / 3600));
+			break;
+		case Field::Minute:
+			current = writeTwoDigits(current, static_cast<unsigned>(secondsOfDay / 60 % 60));
+			break;
+		case Field::Second:
+			current = writeTwoDigits(current, static_cast<unsigned>(secondsOfDay % 60));
+			if (_fractionDigits > 0)
+			{
+				*current++ = '.';
+				current = writeDigits(current, subSeconds, _fractionDigits);
+			}
+			break;
+		}
+	}
+
+	return current - output;
+}
+
+std::string Datetime::dateTimeFormat(const tm &tm, const std::string& outputFormat)
+{
+	DATETIME_STATS_SCOPE(dateTimeFormatTm);
+	char buff[128];
+	return {buff, dateTimeFormat(buff, tm, outputFormat)};
+
+	// la libc dovrebbe implementare make_format_args(tm), quando sarà implementato il codice sopra
+	// sara sostituito da:
+	/*
+	// https://en.cppreference.com/w/cpp/chrono/system_clock/formatter.html
+	const string &_format = std::format("{{:{}}}", outputFormat);
+	return std::vformat(_format,make_format_args(tm));
+	*/
+}
+
+size_t Datetime::dateTimeFormat(const std::span<char> output, const tm &tm, const std::string_view outputFormat)
+{
+	DATETIME_STATS_SCOPE(dateTimeFormatBufferTm);
+	// strftime vuole il formato terminato da NUL
+	char format[128];
+	std::string longFormat;
+	const char *cFormat = format;
+	if (outputFormat.size() < sizeof format)
+	{
+		std::copy(outputFormat.begin(), outputFormat.end(), format);
+		format[outputFormat.size()] = '\0';
+	}
+	else
+	{
+		longFormat = outputFormat;
+		cFormat = longFormat.c_str();
+	}
+
+	char buff[128];
+	// https://en.cppreference.com/w/c/chrono/strftime.html
+	const size_t length = strftime(buff, sizeof buff, cFormat, &tm);
+	if (!length)
+	{
+		const std::string errorMessage = std::format("strftime failed, outputFormat: {}", outputFormat);
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
+
+	return copyToOutput(output, std::string_view(buff, length));
+}
+
+std::string Datetime::nowLocalTime(const std::string& outputFormat, const bool milliSeconds)
+{
+	DATETIME_STATS_SCOPE(nowLocalTime);
+	char buffer[160];
+	return {buffer, nowLocalTime(buffer, outputFormat, milliSeconds)};
+}
+
+size_t Datetime::nowLocalTime(const std::span<char> output, const std::string_view outputFormat, const bool milliSeconds)
+{
+	DATETIME_STATS_SCOPE(nowLocalTimeBuffer);
+	const auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+	const time_t utcTime = floor<std::chrono::seconds>(sinceEpoch).count();
+	const unsigned long ulMilliSecs = floor<std::chrono::milliseconds>(sinceEpoch).count() % 1000;
+
+	// stile nginx: nello stesso secondo localtime_r e strftime non vengono ripetuti, cambiano solo i millisecondi
+	thread_local SecondCache cache;
+	thread_local std::string cacheOutputFormat;
+	const uint32_t zoneGeneration = localTimeZoneGeneration.load(std::memory_order_relaxed);
+	if (cache.second != utcTime || cache.zoneGeneration != zoneGeneration || cacheOutputFormat != outputFormat)
+	{
+		const tm tmDateTime = utcSecondsToLocalTime(utcTime);
+		cache.length = dateTimeFormat(cache.text, tmDateTime, outputFormat);
+		cacheOutputFormat = outputFormat;
+		cache.second = utcTime;
+		cache.zoneGeneration = zoneGeneration;
+	}
+	size_t length = copyToOutput(output, std::string_view(cache.text, cache.length));
+
+	if (milliSeconds)
+	{
+		if (length + 3 > output.size())
+			throwOutputTooSmall(length + 3, output.size());
+		writeDigits(output.data() + length, ulMilliSecs, 3);
+		length += 3;
+	}
+
+	return length;
+}
+
+void Datetime::getTimeZoneInformation(long *plTimeZoneDifferenceInHours)
+{
+	DATETIME_STATS_SCOPE(getTimeZoneInformationPointer);
+	*plTimeZoneDifferenceInHours = localUtcOffset(time(nullptr), true) / 3600;
+}
+
+int32_t Datetime::utcOffsetInMinutes()
+{
+	DATETIME_STATS_SCOPE(utcOffsetInMinutes);
+	return localUtcOffset(time(nullptr), true) / 60;
+}
+
+void Datetime::reloadLocalTimeZone()
+{
+#ifdef _WIN32
+	_tzset();
+#else
+	// localtime_r (zone non supportate dalla tabella) non rilegge TZ e /etc/localtime senza tzset
+	tzset();
+	loadLocalTimeZone();
+#endif
+	{
+		std::lock_guard<std::mutex> locker(localOffsetMutex);
+		localOffset.store(nullptr, std::memory_order_release);
+	}
+	localTimeZoneGeneration.fetch_add(1, std::memory_order_relaxed);
+}
+
+namespace
+{
+#ifdef __linux__
+/*
+	inotify on /etc and on /etc/localtime: the link replaced (timedatectl writes a new link and renames it)
+	is an event of the directory, the file rewritten in place an event of the file (watched again after every change).
+	The thread waits on the inotify descriptor and on a pipe written by stop.
+*/
+class LocalTimeZoneWatch
+{
+  public:
+	~LocalTimeZoneWatch() { stop(); }
+
+	void start()
+	{
+		std::lock_guard<std::mutex> locker(_startStopMutex);
+		if (_watcher.joinable())
+			return;
+
+		_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (_inotify == -1 || pipe2(_stopPipe, O_CLOEXEC) == -1 ||
+			inotify_add_watch(_inotify, "/etc", IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE) == -1)
+		{
+			const std::string errorMessage = std::format(
+				"Local time zone watch failed"
+				", errno: {}",
+				errno
+			);
+			closeDescriptors();
+			LOG_ERROR(errorMessage);
+			throw std::runtime_error(errorMessage);
+		}
+		watchFile();
+		_watcher = std::thread([this]() { run(); });
+	}
+
+	void stop()
+	{
+		std::lock_guard<std::mutex> locker(_startStopMutex);
+		if (!_watcher.joinable())
+			return;
+
+		const char stopRequest = 0;
+		while (write(_stopPipe[1], &stopRequest, 1) == -1 && errno == EINTR)
+			;
+		_watcher.join();
+		closeDescriptors();
+	}
+
+	bool isRunning()
+	{
+		std::lock_guard<std::mutex> locker(_startStopMutex);
+		return _watcher.joinable();
+	}
+
+  private:
+	std::mutex _startStopMutex;
+	std::thread _watcher;
+	int _inotify = -1;
+	int _stopPipe[2] = {-1, -1};
+	int _fileWatch = -1;
+
+	void watchFile()
+	{
+		if (_fileWatch != -1)
+			inotify_rm_watch(_inotify, _fileWatch);
+		// -1 se /etc/localtime non c'è: basta il watch della directory
+		_fileWatch = inotify_add_watch(_inotify, "/etc/localtime", IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+	}
+
+	void run()
+	{
+		pollfd descriptors[2] = {{_inotify, POLLIN, 0}, {_stopPipe[0], POLLIN, 0}};
+		alignas(inotify_event) char events[4096];
+		while (true)
+		{
+			if (poll(descriptors, 2, -1) == -1)
+			{
+				if (errno == EINTR)
+					continue;
+				LOG_ERROR(std::format("Local time zone watch poll failed, errno: {}", errno));
+				return;
+			}
+			if (descriptors[1].revents != 0)
+				return;
+
+			bool changed = false;
+			ssize_t length;
+			while ((length = read(_inotify, events, sizeof(events))) > 0)
+				for (const char *event = events; event < events + length;)
+				{
+					const inotify_event *inotifyEvent = reinterpret_cast<const inotify_event *>(event);
+					if (inotifyEvent->wd == _fileWatch || (inotifyEvent->len > 0 && strcmp(inotifyEvent->name, "localtime") == 0))
+						changed = true;
+					event += sizeof(inotify_event) + inotifyEvent->len;
+				}
+			if (changed)
+			{
+				watchFile();
+				Datetime::reloadLocalTimeZone();
+			}
+		}
+	}
+
+	void closeDescriptors()
+	{
+		for (int *descriptor : {&_inotify, &_stopPipe[0], &_stopPipe[1]})
+			if (*descriptor != -1)
+			{
+				close(*descriptor);
+				*descriptor = -1;
+			}
+		_fileWatch = -1;
+	}
+};
+
+LocalTimeZoneWatch localTimeZoneWatch;
+#endif
+} // namespace
+
+void Datetime::startLocalTimeZoneWatch()
+{
+#ifdef __linux__
+	localTimeZoneWatch.start();
+#else
+	const std::string errorMessage = "Local time zone watch is supported only on Linux (inotify)";
+	LOG_ERROR(errorMessage);
+	throw std::runtime_error(errorMessage);
+#endif
+}
+
+void Datetime::stopLocalTimeZoneWatch()
+{
+#ifdef __linux__
+	localTimeZoneWatch.stop();
+#endif
+}
+
+bool Datetime::isLocalTimeZoneWatchRunning()
+{
+#ifdef __linux__
+	return localTimeZoneWatch.isRunning();
+#else
+	return false;
+#endif
+}
+
+long Datetime::getTimeZoneInformation()
+{
+	DATETIME_STATS_SCOPE(getTimeZoneInformation);
+	long lTimeZoneDifferenceInHours;
+
+	getTimeZoneInformation(&lTimeZoneDifferenceInHours);
+
+	return lTimeZoneDifferenceInHours;
+}
+
+void Datetime::get_tm_LocalTime(tm *ptmDateTime, unsigned long *pulMilliSecs)
+{
+	DATETIME_STATS_SCOPE(getTmLocalTime);
+#ifdef _WIN32
+	time_t tTime;
+	SYSTEMTIME stSystemTime;
+
+	tTime = time(NULL);
+
+	Datetime::convertFromUTCToLocal(tTime, ptmDateTime);
+
+	GetLocalTime(&stSystemTime);
+
+	*pulMilliSecs = stSystemTime.wMilliseconds;
+#else
+	timeval tvTimeval{};
+
+	if (gettimeofday(&tvTimeval, NULL) == -1)
+	{
+		const std::string errorMessage = std::format("gettimeofday failed");
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
+
+	convertFromUTCToLocal(tvTimeval.tv_sec, ptmDateTime);
+
+	*pulMilliSecs = tvTimeval.tv_usec / 1000;
+#endif
+}
+
+void Datetime::convertFromLocalToUTC(tm *ptmDateTime, time_t *ptUTCTime)
+{
+	DATETIME_STATS_SCOPE(convertFromLocalToUTCTimeT);
+	*ptUTCTime = localToUTC(ptmDateTime);
+}
+
+time_t Datetime::localToUTC(tm *ptmDateTime)
+{
+	DATETIME_STATS_SCOPE(localToUTC);
+	return mktime(ptmDateTime);
+}
+
+void Datetime::convertFromLocalToUTC(tm *ptmLocalDateTime, tm *ptmUTCDateTime)
+{
+	DATETIME_STATS_SCOPE(convertFromLocalToUTCTm);
+	time_t tUTCTime;
+
+	convertFromLocalToUTC(ptmLocalDateTime, &tUTCTime);
+
+	convertFromUTCInSecondsToBreakDownUTC(tUTCTime, ptmUTCDateTime);
+}
+
+void Datetime::convertFromUTCInSecondsToBreakDownUTC(time_t tUTCTime, tm *ptmUTCDateTime)
+{
+	DATETIME_STATS_SCOPE(convertFromUTCInSecondsToBreakDownUTC);
+	utcToTm(tUTCTime, ptmUTCDateTime);
+}
+
+void Datetime::convertFromLocalDateTimeToLocalInSecs(
+	unsigned long ulYear, unsigned long ulMon, unsigned long ulDay, unsigned long ulHour, unsigned long ulMin, unsigned long ulSec,
+	long lDaylightSavingTime, unsigned long long *pullLocalInSecs
+)
+{
+	DATETIME_STATS_SCOPE(convertFromLocalDateTimeToLocalInSecs);
+	time_t tUTCTime;
+	tm tmDateTime;
+
+	tmDateTime.tm_year = ulYear - 1900;
+	tmDateTime.tm_mon = ulMon - 1;
+	tmDateTime.tm_mday = ulDay;
+	tmDateTime.tm_hour = ulHour;
+	tmDateTime.tm_min = ulMin;
+	tmDateTime.tm_sec = ulSec;
+
+	//	Negative value if status of daylight saving time is unknown.
+	// (does it mean it attempt to determine whether Daylight Saving Time is in effect
+	//	for the specified time?)
+	tmDateTime.tm_isdst = lDaylightSavingTime;
+
+	// Simulate as the date is a local date
+	Datetime::convertFromLocalToUTC(&tmDateTime, &tUTCTime);
+
+	// l'offset dell'istante convertito (non quello di adesso), in secondi
+	*pullLocalInSecs = ((unsigned long long)tUTCTime) + ((unsigned long long)localUtcOffset(tUTCTime, false));
+}
+
+tm Datetime::utcSecondsToLocalTime(time_t utcTime)
+{
+	DATETIME_STATS_SCOPE(utcSecondsToLocalTime);
+	tm tmDateTime{};
+
+	utcToLocalTm(utcTime, &tmDateTime);
+	return tmDateTime;
+}
+
+void Datetime::convertFromUTCToLocal(time_t tUTCTime, tm *ptmLocalDateTime)
+{
+	DATETIME_STATS_SCOPE(convertFromUTCToLocal);
+	utcToLocalTm(tUTCTime, ptmLocalDateTime);
+}
+
+tm Datetime::utcSecondsToLocalTime(time_t utcTime, const TimeZone &timeZone)
+{
+	DATETIME_STATS_SCOPE(utcSecondsToLocalTimeTimeZone);
+	return timeZone.toLocal(utcTime);
+}
+
+void Datetime::convertFromUTCToLocal(time_t tUTCTime, const TimeZone &timeZone, tm *ptmLocalDateTime)
+{
+	DATETIME_STATS_SCOPE(convertFromUTCToLocalTimeZone);
+	*ptmLocalDateTime = timeZone.toLocal(tUTCTime);
+}
+
+time_t Datetime::localToUTC(const tm &localTime, const TimeZone &timeZone)
+{
+	DATETIME_STATS_SCOPE(localToUTCTimeZone);
+	return timeZone.toUtc(localTime);
+}
+
+namespace
+{
+// seconds since epoch of the wall clock, the fields are normalized as timegm does
+int64_t localSecondsOf(int64_t year, int64_t month, const int64_t day, const int64_t hour, const int64_t minute, const int64_t second)
+{
+	const int64_t years = floorDiv(month - 1, 12);
+	year += years;
+	month -= years * 12;
+	return (Datetime::daysFromCivil(year, static_cast<int>(month), 1) + day - 1) * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+[[noreturn]] void throwDstPolicyReject(const int64_t localSeconds, const char *what)
+{
+	tm tmLocalDateTime;
+	utcToTm(localSeconds, &tmLocalDateTime);
+	const std::string errorMessage = std::format(
+		"Local time {} by the DST (DstPolicy::Reject), local time: {:0>4}-{:0>2}-{:0>2} {:0>2}:{:0>2}:{:0>2}", what,
+		tmLocalDateTime.tm_year + 1900, tmLocalDateTime.tm_mon + 1, tmLocalDateTime.tm_mday, tmLocalDateTime.tm_hour, tmLocalDateTime.tm_min,
+		tmLocalDateTime.tm_sec
+	);
+	DATETIME_STATS_EXCEPTION();
+	LOG_ERROR(errorMessage);
+	throw std::runtime_error(errorMessage);
+}
+
+int64_t resolveLocalSeconds(const TimeZoneTable *table, const int64_t localSeconds, const int isDst, const Datetime::DstPolicy dstPolicy)
+{
+	const auto utcTime = tryResolveLocalSeconds(table, localSeconds, isDst, dstPolicy);
+	if (!utcTime)
+		throwDstPolicyReject(localSeconds, utcTime.error());
+	return *utcTime;
+}
+
+Datetime::CivilDateTime utcToCivil(const TimeZoneTable *table, const int64_t utcTime)
+{
+	int64_t localSeconds;
+	bool isDst;
+	if (table != nullptr)
+	{
+		const LocalTimeType &type = table->lookup(utcTime);
+		localSeconds = utcTime + type.utcOffset;
+		isDst = type.isDst;
+	}
+	else
+	{
+		tm tmLocalDateTime;
+		utcToLocalTm(static_cast<time_t>(utcTime), &tmLocalDateTime);
+		localSeconds = utcFromTm(tmLocalDateTime);
+		isDst = tmLocalDateTime.tm_isdst > 0;
+	}
+
+	const int64_t days = floorDiv(localSeconds, 86400);
+	const int64_t secondsOfDay = localSeconds - days * 86400;
+	int64_t year;
+	int month;
+	int day;
+	Datetime::civilFromDays(days, &year, &month, &day);
+	return Datetime::CivilDateTime{
+		static_cast<int32_t>(year),
+		static_cast<uint8_t>(month),
+		static_cast<uint8_t>(day),
+		static_cast<uint8_t>(secondsOfDay / 3600),
+		static_cast<uint8_t>(secondsOfDay / 60 % 60),
+		static_cast<uint8_t>(secondsOfDay % 60),
+		static_cast<int8_t>(isDst)
+	};
+}
+
+void checkCivil(const Datetime::CivilDateTime &dateTime)
+{
+	if (dateTime.month < 1 || dateTime.month > 12 || dateTime.day < 1 || dateTime.day > Datetime::getLastDayOfMonth(dateTime.year, dateTime.month) ||
+		dateTime.hour > 23 || dateTime.minute > 59 || dateTime.second > 59)
+	{
+		const std::string errorMessage = std::format(
+			"Wrong input, year: {}, month: {}, day: {}, hour: {}, minute: {}, second: {}", dateTime.year, dateTime.month, dateTime.day,
+			dateTime.hour, dateTime.minute, dateTime.second
+		);
+		DATETIME_STATS_EXCEPTION();
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
+}
+
+Datetime::CivilDateTime addSeconds(const TimeZoneTable *table, const Datetime::CivilDateTime &dateTime, const int64_t seconds)
+{
+	checkCivil(dateTime);
+	const int64_t localSeconds = localSecondsOf(dateTime.year, dateTime.month, dateTime.day, dateTime.hour, dateTime.minute, dateTime.second);
+	return utcToCivil(table, resolveLocalSeconds(table, localSeconds, dateTime.isDst, Datetime::DstPolicy::Compatible) + seconds);
+}
+
+Datetime::CivilDateTime addDays(
+	const TimeZoneTable *table, const Datetime::CivilDateTime &dateTime, const int64_t days, const Datetime::DstPolicy dstPolicy
+)
+{
+	checkCivil(dateTime);
+	const int64_t localSeconds =
+		localSecondsOf(dateTime.year, dateTime.month, dateTime.day + days, dateTime.hour, dateTime.minute, dateTime.second);
+	return utcToCivil(table, resolveLocalSeconds(table, localSeconds, -1, dstPolicy));
+}
+
+Datetime::CivilDateTime addMonths(
+	const TimeZoneTable *table, const Datetime::CivilDateTime &dateTime, const int64_t months, const Datetime::DstPolicy dstPolicy
+)
+{
+	checkCivil(dateTime);
+	const int64_t totalMonths = dateTime.year * int64_t(12) + dateTime.month - 1 + months;
+	const int64_t year = floorDiv(totalMonths, 12);
+	const int month = static_cast<int>(totalMonths - year * 12 + 1);
+	const int day = std::min<int>(dateTime.day, Datetime::getLastDayOfMonth(year, month));
+	const int64_t localSeconds = localSecondsOf(year, month, day, dateTime.hour, dateTime.minute, dateTime.second);
+	return utcToCivil(table, resolveLocalSeconds(table, localSeconds, -1, dstPolicy));
+}
+} // namespace
+
+void Datetime::addSeconds(
+	unsigned long ulSrcYear, unsigned long ulSrcMonth, unsigned long ulSrcDay, unsigned long ulSrcHour, unsigned long ulSrcMinutes,
+	unsigned long ulSrcSeconds, long lSrcDaylightSavingTime, long long llSecondsToAdd, unsigned long *pulDestYear, unsigned long *pulDestMonth,
+	unsigned long *pulDestDay, unsigned long *pulDestHour, unsigned long *pulDestMinutes, unsigned long *pulDestSeconds,
+	bool *pbDestDaylightSavingTime
+)
+{
+	DATETIME_STATS_SCOPE(addSeconds);
+	if (llSecondsToAdd == 0)
+	{
+		*pulDestYear = ulSrcYear;
+		*pulDestMonth = ulSrcMonth;
+		*pulDestDay = ulSrcDay;
+		*pulDestHour = ulSrcHour;
+		*pulDestMinutes = ulSrcMinutes;
+		*pulDestSeconds = ulSrcSeconds;
+		*pbDestDaylightSavingTime = lSrcDaylightSavingTime;
+
+		return;
+	}
+
+	// i campi fuori range sono normalizzati come faceva mktime
+	const TimeZoneTable *table = processTimeZoneTable();
+	const int64_t localSeconds = localSecondsOf(ulSrcYear, ulSrcMonth, ulSrcDay, ulSrcHour, ulSrcMinutes, ulSrcSeconds);
+	const CivilDateTime dateTime =
+		utcToCivil(table, resolveLocalSeconds(table, localSeconds, static_cast<int>(lSrcDaylightSavingTime), DstPolicy::Compatible) + llSecondsToAdd);
+
+	*pulDestYear = dateTime.year;
+	*pulDestMonth = dateTime.month;
+	*pulDestDay = dateTime.day;
+	*pulDestHour = dateTime.hour;
+	*pulDestMinutes = dateTime.minute;
+	*pulDestSeconds = dateTime.second;
+	*pbDestDaylightSavingTime = dateTime.isDst == 1;
+}
+
+Datetime::CivilDateTime Datetime::addSeconds(const CivilDateTime &dateTime, const int64_t seconds)
+{
+	DATETIME_STATS_SCOPE(addSecondsCivil);
+	return ::addSeconds(processTimeZoneTable(), dateTime, seconds);
+}
+
+Datetime::CivilDateTime Datetime::addSeconds(const CivilDateTime &dateTime, const int64_t seconds, const TimeZone &timeZone)
+{
+	DATETIME_STATS_SCOPE(addSecondsCivilTimeZone);
+	return ::addSeconds(timeZone._table->table.get(), dateTime, seconds);
+}
+
+Datetime::CivilDateTime Datetime::addDays(const CivilDateTime &dateTime, const int64_t days, const DstPolicy dstPolicy)
+{
+	DATETIME_STATS_SCOPE(addDays);
+	return ::addDays(processTimeZoneTable(), dateTime, days, dstPolicy);
+}
+
+Datetime::CivilDateTime Datetime::addDays(const CivilDateTime &dateTime, const int64_t days, const TimeZone &timeZone, const DstPolicy dstPolicy)
+{
+	DATETIME_STATS_SCOPE(addDaysTimeZone);
+	return ::addDays(timeZone._table->table.get(), dateTime, days, dstPolicy);
+}
+
+Datetime::CivilDateTime Datetime::addMonths(const CivilDateTime &dateTime, const int64_t months, const DstPolicy dstPolicy)
+{
+	DATETIME_STATS_SCOPE(addMonths);
+	return ::addMonths(processTimeZoneTable(), dateTime, months, dstPolicy);
+}
+
+Datetime::CivilDateTime Datetime::addMonths(
+	const CivilDateTime &dateTime, const int64_t months, const TimeZone &timeZone, const DstPolicy dstPolicy
+)
+{
+	DATETIME_STATS_SCOPE(addMonthsTimeZone);
+	return ::addMonths(timeZone._table->table.get(), dateTime, months, dstPolicy);
+}
+
+namespace
+{
+// l'intervallo UTC [from, until) dell'ultimo offset usato: lontano un giorno dai suoi estremi
+// un'ora locale ha un solo UTC, quello di resolveLocalSeconds
+struct RecurrenceOffsetCache
+{
+	const TimeZoneTable *table = nullptr;
+	int64_t from = 0;
+	int64_t until = 0;
+	int32_t utcOffset = 0;
+};
+
+std::optional<int64_t>
+occurrenceToUtc(RecurrenceOffsetCache *cache, const TimeZoneTable *table, const int64_t localSeconds, const Datetime::DstPolicy dstPolicy)
+{
+	if (table != nullptr && cache->table == table && localSeconds - 86400 >= cache->from && localSeconds + 86400 < cache->until)
+		return localSeconds - cache->utcOffset;
+
+	const auto utcTime = tryResolveLocalSeconds(table, localSeconds, -1, dstPolicy);
+	if (table != nullptr)
+	{
+		cache->table = table;
+		cache->utcOffset = table->lookup(localSeconds, &cache->from, &cache->until).utcOffset;
+	}
+	if (!utcTime)
+		return std::nullopt;
+	return *utcTime;
+}
+
+void checkRecurrenceRule(const Datetime::Recurrence::Rule &rule)
+{
+	using Frequency = Datetime::Recurrence::Frequency;
+	if (rule.hour > 23 || rule.minute > 59 || rule.frequency > Frequency::Monthly || (rule.frequency == Frequency::Weekly && (rule.weekDays & 0x7F) == 0) ||
+		(rule.frequency == Frequency::Monthly && rule.monthDays == 0))
+	{
+		const std::string errorMessage = std::format(
+			"Wrong recurrence rule"
+			", frequency: {}"
+			", hour: {}"
+			", minute: {}"
+			", weekDays: {:#x}"
+			", monthDays: {:#x}",
+			static_cast<int>(rule.frequency), rule.hour, rule.minute, rule.weekDays, rule.monthDays
+		);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
+}
+
+void nextOccurrences(
+	const Datetime::Recurrence::Rule &rule, const TimeZoneTable *table, RecurrenceOffsetCache *cache, const int64_t afterUtcInMilliSecs,
+	const std::span<int64_t> occurrences
+)
+{
+	using Frequency = Datetime::Recurrence::Frequency;
+	const int64_t afterUtc = floorDiv(afterUtcInMilliSecs, 1000);
+	int64_t afterLocal;
+	if (table != nullptr)
+		afterLocal = afterUtc + table->lookup(afterUtc).utcOffset;
+	else
+	{
+		tm tmLocalDateTime;
+		utcToLocalTm(static_cast<time_t>(afterUtc), &tmLocalDateTime);
+		afterLocal = utcFromTm(tmLocalDateTime);
+	}
+	// dal giorno locale prima: la DST può spostare l'occorrenza di un giorno oltre afterUtc
+	int64_t days = floorDiv(afterLocal, 86400) - 1;
+	const int64_t secondsOfDay = rule.hour * 3600 + rule.minute * 60;
+
+	size_t count = 0;
+	const auto add = [&](const int64_t day)
+	{
+		const std::optional<int64_t> utcTime = occurrenceToUtc(cache, table, day * 86400 + secondsOfDay, rule.dstPolicy);
+		if (utcTime.has_value() && *utcTime * 1000 > afterUtcInMilliSecs)
+			occurrences[count++] = *utcTime * 1000;
+	};
+
+	switch (rule.frequency)
+	{
+	case Frequency::Daily:
+		for (; count < occurrences.size(); days++)
+			add(days);
+		break;
+	case Frequency::Weekly:
+		for (; count < occurrences.size(); days++)
+			if ((rule.weekDays >> Datetime::weekDayFromDays(days)) & 1)
+				add(days);
+		break;
+	case Frequency::Monthly:
+	{
+		int64_t year;
+		int month;
+		int firstDay;
+		Datetime::civilFromDays(days, &year, &month, &firstDay);
+		while (count < occurrences.size())
+		{
+			// i giorni del mese nella regola (bit 1-lastDay), l'ultimo anche per il bit 0
+			const int lastDay = Datetime::getLastDayOfMonth(year, month);
+			uint64_t monthDays = rule.monthDays & ((uint64_t(2) << lastDay) - 2);
+			if (rule.monthDays & 1)
+				monthDays |= uint64_t(1) << lastDay;
+			monthDays &= ~((uint64_t(1) << firstDay) - 1);
+			const int64_t monthStart = Datetime::daysFromCivil(year, month, 1);
+			for (; monthDays != 0 && count < occurrences.size(); monthDays &= monthDays - 1)
+				add(monthStart + std::countr_zero(monthDays) - 1);
+
+			firstDay = 1;
+			if (++month > 12)
+			{
+				month = 1;
+				year++;
+			}
+		}
+		break;
+	}
+	}
+}
+} // namespace
+
+Datetime::Recurrence::Recurrence(const Rule &rule) : _rule(rule), _timeZone(nullptr) { checkRecurrenceRule(rule); }
+
+Datetime::Recurrence::Recurrence(const Rule &rule, const TimeZone &timeZone) : _rule(rule), _timeZone(timeZone._table) { checkRecurrenceRule(rule); }
+
+int64_t Datetime::Recurrence::next(const int64_t afterUtcInMilliSecs) const
+{
+	DATETIME_STATS_SCOPE(recurrenceNext);
+	RecurrenceOffsetCache cache;
+	int64_t occurrence;
+	nextOccurrences(
+		_rule, _timeZone == nullptr ? processTimeZoneTable() : _timeZone->table.get(), &cache, afterUtcInMilliSecs, std::span(&occurrence, 1)
+	);
+	return occurrence;
+}
+
+void Datetime::Recurrence::next(const int64_t afterUtcInMilliSecs, const std::span<int64_t> occurrences) const
+{
+	DATETIME_STATS_SCOPE(recurrenceNextSpan);
+	RecurrenceOffsetCache cache;
+	nextOccurrences(_rule, _timeZone == nullptr ? processTimeZoneTable() : _timeZone->table.get(), &cache, afterUtcInMilliSecs, occurrences);
+}
+
+void Datetime::Recurrence::next(
+	const std::span<const Recurrence> recurrences, const int64_t afterUtcInMilliSecs, const size_t count, const std::span<int64_t> occurrences
+)
+{
+	DATETIME_STATS_SCOPE(recurrenceNextBatch);
+	if (count != 0 && occurrences.size() / count < recurrences.size())
+	{
+		const std::string errorMessage = std::format(
+			"Output span too small"
+			", recurrences: {}"
+			", count: {}"
+			", occurrences size: {}",
+			recurrences.size(), count, occurrences.size()
+		);
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
+
+	// la cache resta valida tra le regole della stessa zona
+	const TimeZoneTable *processTable = processTimeZoneTable();
+	RecurrenceOffsetCache cache;
+	for (size_t index = 0; index < recurrences.size(); index++)
+	{
+		const Recurrence &recurrence = recurrences[index];
+		nextOccurrences(
+			recurrence._rule, recurrence._timeZone == nullptr ? processTable : recurrence._timeZone->table.get(), &cache, afterUtcInMilliSecs,
+			occurrences.subspan(index * count, count)
+		);
+	}
+}
+
+void Datetime::isLeapYear(unsigned long ulYear, bool *pbIsLeapYear)
+{
+	DATETIME_STATS_SCOPE(isLeapYear);
+	*pbIsLeapYear = isLeapYear(static_cast<int64_t>(ulYear));
+}
+
+void Datetime::getLastDayOfMonth(unsigned long ulYear, unsigned long ulMonth, unsigned long *pulLastDayOfMonth)
+{
+	DATETIME_STATS_SCOPE(getLastDayOfMonth);
+	if (ulMonth <= 0 || ulMonth > 12)
+	{
+		const std::string errorMessage = std::format(
+			"Wrong input"
+			", ulMonth: {}",
+			ulMonth
+		);
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
+
+	*pulLastDayOfMonth = getLastDayOfMonth(static_cast<int64_t>(ulYear), static_cast<int>(ulMonth));
+}
+
+/* sostituita da parseUtcStringToTimeT
+// 2021-02-26T15:41:15Z
+time_t Datetime::sDateSecondsToUtc(string sDate)
+{
+
+	unsigned long ulUTCYear;
+	unsigned long ulUTCMonth;
+	unsigned long ulUTCDay;
+	unsigned long ulUTCHour;
+	unsigned long ulUTCMinutes;
+	unsigned long ulUTCSeconds;
+	tm tmDate;
+	int sscanfReturn;
+
+#ifdef _WIN32
+	if ((sscanfReturn =
+			 sscanf_s(sDate.c_str(), "%4lu-%2lu-%2luT%2lu:%2lu:%2luZ", &ulUTCYear, &ulUTCMonth, &ulUTCDay, &ulUTCHour, &ulUTCMinutes, &ulUTCSeconds)
+		) != 6)
+#else
+	if ((sscanfReturn =
+			 sscanf(sDate.c_str(), "%4lu-%2lu-%2luT%2lu:%2lu:%2luZ", &ulUTCYear, &ulUTCMonth, &ulUTCDay, &ulUTCHour, &ulUTCMinutes, &ulUTCSeconds)) !=
+		6)
+#endif
+	{
+		string errorMessage = std::format(
+			"Field has a wrong format (sscanf failed)"
+			", sDate: {}"
+			", sscanfReturn: {}",
+			sDate, sscanfReturn
+		);
+		// LOG_ERROR(errorMessage);
+
+		throw runtime_error(errorMessage);
+	}
+
+	time_t utcTime;
+
+	time(&utcTime);
+#ifdef _WIN32
+	gmtime_s(&tmDate, &utcTime);
+#else
+	gmtime_r(&utcTime, &tmDate);
+#endif
+
+	tmDate.tm_year = ulUTCYear - 1900;
+	tmDate.tm_mon = ulUTCMonth - 1;
+	tmDate.tm_mday = ulUTCDay;
+	tmDate.tm_hour = ulUTCHour;
+	tmDate.tm_min = ulUTCMinutes;
+	tmDate.tm_sec = ulUTCSeconds;
+
+#ifdef _WIN32
+	utcTime = _mkgmtime(&tmDate);
+#else
+	utcTime = timegm(&tmDate);
+#endif
+
+	return utcTime;
+}
+*/
+
+// 2021-02-26T15:41:15Z
+bool Datetime::parseIsoUtcInSecs(const std::string_view datetime, time_t *pUtcInSecs) noexcept
+{
+	DATETIME_STATS_SCOPE(parseIsoUtcInSecs);
+	int64_t utcInSecs;
+	if (datetime.size() != isoSecondsLength + 1 || datetime[isoSecondsLength] != 'Z' || !parseIsoSeconds(datetime.data(), &utcInSecs))
+	{
+		DATETIME_STATS_FAILURE(Rejected);
+		return false;
+	}
+
+	*pUtcInSecs = static_cast<time_t>(utcInSecs);
+	return true;
+}
+
+// 2021-02-26T15:41:15.765Z
+bool Datetime::parseIsoUtcInMillisecs(const std::string_view datetime, int64_t *pUtcInMillisecs) noexcept
+{
+	DATETIME_STATS_SCOPE(parseIsoUtcInMillisecs);
+	int64_t utcInSecs;
+	if (datetime.size() != isoSecondsLength + 5 || datetime[isoSecondsLength] != '.' || datetime[isoSecondsLength + 4] != 'Z' ||
+		!parseIsoSeconds(datetime.data(), &utcInSecs))
+	{
+		DATETIME_STATS_FAILURE(Rejected);
+		return false;
+	}
+
+	const int hundreds = static_cast<unsigned char>(datetime[isoSecondsLength + 1]) - '0';
+	const int tensAndUnits = twoDigits(datetime.data() + isoSecondsLength + 2);
+	if (hundreds < 0 || hundreds > 9 || tensAndUnits < 0)
+	{
+		DATETIME_STATS_FAILURE(Rejected);
+		return false;
+	}
+
+	*pUtcInMillisecs = utcInSecs * 1000 + hundreds * 100 + tensAndUnits;
+	return true;
+}
+
+void Datetime::setParseErrorCallback(const ParseErrorCallback callback) noexcept { parseErrorCallback.store(callback, std::memory_order_relaxed); }
+
+const char *Datetime::parseErrorKindName(const ParseErrorKind kind) noexcept
+{
+	switch (kind)
+	{
+	case ParseErrorKind::Length:
+		return "wrong length";
+	case ParseErrorKind::Digit:
+		return "digit expected";
+	case ParseErrorKind::Separator:
+		return "separator expected";
+	case ParseErrorKind::Range:
+		return "field out of range";
+	case ParseErrorKind::Format:
+		return "format not matched";
+	}
+	return "unknown";
+}
+
+std::expected<int64_t, Datetime::ParseError> Datetime::tryParseStringToUtcInSecs(const std::string_view datetime, const std::string_view inputFormat) noexcept
+{
+	DATETIME_STATS_SCOPE(tryParseStringToUtcInSecs);
+	if (inputFormat == "%Y-%m-%dT%H:%M:%SZ" || inputFormat == "%Y-%m-%dT%H:%M:%S")
+	{
+		// come get_time, senza la Z i caratteri dopo i secondi sono ignorati
+		const std::string_view layout = inputFormat.back() == 'Z' ? isoSecondsUtcLayout : isoSecondsLayout;
+		std::expected<int64_t, ParseError> result;
+		if (datetime.size() < layout.size() || (layout == isoSecondsUtcLayout && datetime.size() != layout.size()))
+			result = parseError(ParseErrorKind::Length, std::min(datetime.size(), layout.size()));
+		else
+			result = isoLayoutToUtcInSecs(datetime, layout);
+		return DATETIME_STATS_RESULT(reportParseError("tryParseStringToUtcInSecs", datetime, result));
+	}
+
+	// get_time can throw (bad_alloc) or leave the stream in an unexpected state: it never escapes
+	try
+	{
+		tm tm = {};
+		std::istringstream ss{std::string(datetime)};
+		ss >> std::get_time(&tm, std::string(inputFormat).c_str());
+		if (ss.fail())
+		{
+			ss.clear();
+			const auto position = ss.tellg();
+			return DATETIME_STATS_RESULT(reportParseError(
+				"tryParseStringToUtcInSecs", datetime, parseError(ParseErrorKind::Format, position < 0 ? 0 : static_cast<size_t>(position))
+			));
+		}
+		return utcFromTm(tm);
+	}
+	catch (...)
+	{
+		return DATETIME_STATS_RESULT(reportParseError("tryParseStringToUtcInSecs", datetime, parseError(ParseErrorKind::Format, 0)));
+	}
 }
 
-void Datetime::addSeconds(
-	unsigned long ulSrcYear, unsigned long ulSrcMonth, unsigned long ulSrcDay, unsigned long ulSrcHour, unsigned long ulSrcMinutes,
-	unsigned long ulSrcSeconds, long lSrcDaylightSavingTime, long long llSecondsToAdd, unsigned long *pulDestYear, unsigned long *pulDestMonth,
-	unsigned long *pulDestDay, unsigned long *pulDestHour, unsigned long *pulDestMinutes, unsigned long *pulDestSeconds,
-	bool *pbDestDaylightSavingTime
+std::expected<int64_t, Datetime::ParseError> Datetime::trySDateMilliSecondsToUtc(const std::string_view sDate) noexcept
+{
+	DATETIME_STATS_SCOPE(trySDateMilliSecondsToUtc);
+	return DATETIME_STATS_RESULT(reportParseError("trySDateMilliSecondsToUtc", sDate, isoMillisecsToUtc(sDate)));
+}
+
+std::expected<int64_t, Datetime::ParseError> Datetime::tryIso8610ToUtc(const std::string_view datetime, const bool millisecondsPrecision) noexcept
+{
+	DATETIME_STATS_SCOPE(tryIso8610ToUtc);
+	return DATETIME_STATS_RESULT(reportParseError("tryIso8610ToUtc", datetime, iso8610ToUtcInSecsOrMillisecs(datetime, millisecondsPrecision)));
+}
+
+std::expected<int64_t, Datetime::ParseError> Datetime::parseIso8601ToUtcInNanosecs(const std::string_view datetime) noexcept
+{
+	DATETIME_STATS_SCOPE(parseIso8601ToUtcInNanosecs);
+	return DATETIME_STATS_RESULT(reportParseError("parseIso8601ToUtcInNanosecs", datetime, iso8601ToUtc(datetime, Precision::Nanos)));
+}
+
+std::expected<int64_t, Datetime::ParseError> Datetime::parseIso8601ToUtc(const std::string_view datetime, const Precision precision) noexcept
+{
+	DATETIME_STATS_SCOPE(parseIso8601ToUtc);
+	return DATETIME_STATS_RESULT(reportParseError("parseIso8601ToUtc", datetime, iso8601ToUtc(datetime, precision)));
+}
+
+std::expected<int64_t, Datetime::ParseError> Datetime::tryGetLastDayOfMonth(const int64_t year, const int64_t month) noexcept
+{
+	DATETIME_STATS_SCOPE(tryGetLastDayOfMonth);
+	if (month < 1 || month > 12)
+		return DATETIME_STATS_RESULT(reportParseError("tryGetLastDayOfMonth", {}, parseError(ParseErrorKind::Range, 0)));
+	return getLastDayOfMonth(year, static_cast<int>(month));
+}
+
+namespace
+{
+constexpr uint64_t nanosecsPerSecond = 1000000000;
+constexpr uint64_t maxDurationNanosecs = std::numeric_limits<int64_t>::max();
+// 10^(9 - digits), scala una frazione di digits cifre in nanosecondi
+constexpr std::array<uint64_t, 10> fractionScale = {1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1};
+
+// legge le cifre da position (al massimo 19, stanno in un uint64_t), ritorna quante sono
+inline size_t readDurationNumber(const std::string_view duration, const size_t position, uint64_t *pValue)
+{
+	uint64_t value = 0;
+	size_t index = position;
+	while (index < duration.size() && index - position < 19)
+	{
+		const unsigned digit = static_cast<unsigned char>(duration[index]) - '0';
+		if (digit > 9)
+			break;
+		value = value * 10 + digit;
+		index++;
+	}
+	*pValue = value;
+	return index - position;
+}
+
+// *pTotal += value * unit, false se supera int64_t
+inline bool addDurationUnits(uint64_t *pTotal, const uint64_t value, const uint64_t unit)
+{
+	if (value > maxDurationNanosecs / unit)
+		return false;
+	const uint64_t nanosecs = value * unit;
+	if (nanosecs > maxDurationNanosecs - *pTotal)
+		return false;
+	*pTotal += nanosecs;
+	return true;
+}
+
+// (.|,) e 1-9 cifre da position, in nanosecondi; position avanza oltre la frazione
+std::expected<uint64_t, Datetime::ParseError> readDurationFraction(const std::string_view duration, size_t *pPosition)
+{
+	using Kind = Datetime::ParseErrorKind;
+	size_t position = *pPosition + 1;
+	uint64_t fraction;
+	const size_t digits = readDurationNumber(duration, position, &fraction);
+	if (digits == 0)
+		return parseError(position < duration.size() ? Kind::Digit : Kind::Length, position);
+	if (digits > 9)
+		return parseError(Kind::Length, position + 9);
+	*pPosition = position + digits;
+	return fraction * fractionScale[digits];
+}
+
+// H...:MM[:SS[(.|,)fraction]]
+std::expected<uint64_t, Datetime::ParseError> clockDurationToNanosecs(const std::string_view duration, size_t position)
+{
+	using Kind = Datetime::ParseErrorKind;
+	uint64_t hours;
+	const size_t hoursDigits = readDurationNumber(duration, position, &hours);
+	if (hoursDigits == 0)
+		return parseError(position < duration.size() ? Kind::Digit : Kind::Length, position);
+	uint64_t total = 0;
+	if (!addDurationUnits(&total, hours, 3600 * nanosecsPerSecond))
+		return parseError(Kind::Range, position);
+	position += hoursDigits;
+
+	// :MM e :SS, due cifre 00-59
+	for (const uint64_t unit : {60 * nanosecsPerSecond, nanosecsPerSecond})
+	{
+		if (position == duration.size() && unit == nanosecsPerSecond)
+			return total;
+		if (position == duration.size())
+			return parseError(Kind::Length, position);
+		if (duration[position] != ':')
+			return parseError(Kind::Separator, position);
+		position++;
+		if (duration.size() - position < 2)
+			return parseError(Kind::Length, duration.size());
+		const int value = twoDigits(duration.data() + position);
+		if (value < 0)
+			return parseError(Kind::Digit, position);
+		if (value > 59)
+			return parseError(Kind::Range, position);
+		if (!addDurationUnits(&total, static_cast<uint64_t>(value), unit))
+			return parseError(Kind::Range, position);
+		position += 2;
+	}
+
+	if (position == duration.size())
+		return total;
+	if (duration[position] != '.' && duration[position] != ',')
+		return parseError(Kind::Separator, position);
+	const size_t fractionPosition = position;
+	const auto fraction = readDurationFraction(duration, &position);
+	if (!fraction)
+		return std::unexpected(fraction.error());
+	if (!addDurationUnits(&total, *fraction, 1))
+		return parseError(Kind::Range, fractionPosition);
+	if (position != duration.size())
+		return parseError(Kind::Length, position);
+	return total;
+}
+
+// [nW|nD][T[nH][nM][n[(.|,)fraction]S]], position e' dopo la P
+std::expected<uint64_t, Datetime::ParseError> isoDurationToNanosecs(const std::string_view duration, size_t position)
+{
+	using Kind = Datetime::ParseErrorKind;
+	uint64_t total = 0;
+	bool dateComponent = false;
+	if (position < duration.size() && duration[position] != 'T')
+	{
+		uint64_t value;
+		const size_t digits = readDurationNumber(duration, position, &value);
+		if (digits == 0)
+			return parseError(Kind::Digit, position);
+		const size_t valuePosition = position;
+		position += digits;
+		if (position == duration.size())
+			return parseError(Kind::Length, position);
+		uint64_t unit;
+		if (duration[position] == 'W')
+			unit = 7 * 86400 * nanosecsPerSecond;
+		else if (duration[position] == 'D')
+			unit = 86400 * nanosecsPerSecond;
+		else
+			return parseError(Kind::Separator, position);
+		if (!addDurationUnits(&total, value, unit))
+			return parseError(Kind::Range, valuePosition);
+		position++;
+		dateComponent = true;
+	}
+	if (position == duration.size())
+	{
+		if (!dateComponent)
+			return parseError(Kind::Length, position);
+		return total;
+	}
+	if (duration[position] != 'T')
+		return parseError(Kind::Separator, position);
+	position++;
+
+	// H, M e S in quest'ordine, almeno uno
+	int lastDesignator = 0;
+	while (position < duration.size())
+	{
+		const size_t valuePosition = position;
+		uint64_t value;
+		const size_t digits = readDurationNumber(duration, position, &value);
+		if (digits == 0)
+			return parseError(Kind::Digit, position);
+		position += digits;
+		uint64_t fraction = 0;
+		bool hasFraction = false;
+		if (position < duration.size() && (duration[position] == '.' || duration[position] == ','))
+		{
+			const auto readFraction = readDurationFraction(duration, &position);
+			if (!readFraction)
+				return std::unexpected(readFraction.error());
+			fraction = *readFraction;
+			hasFraction = true;
+		}
+		if (position == duration.size())
+			return parseError(Kind::Length, position);
+
+		int designator;
+		uint64_t unit;
+		switch (duration[position])
+		{
+		case 'H':
+			designator = 1;
+			unit = 3600 * nanosecsPerSecond;
+			break;
+		case 'M':
+			designator = 2;
+			unit = 60 * nanosecsPerSecond;
+			break;
+		case 'S':
+			designator = 3;
+			unit = nanosecsPerSecond;
+			break;
+		default:
+			return parseError(Kind::Separator, position);
+		}
+		if (designator <= lastDesignator || (hasFraction && designator != 3))
+			return parseError(Kind::Separator, position);
+		if (!addDurationUnits(&total, value, unit) || !addDurationUnits(&total, fraction, 1))
+			return parseError(Kind::Range, valuePosition);
+		lastDesignator = designator;
+		position++;
+	}
+	if (lastDesignator == 0)
+		return parseError(Kind::Length, position);
+	return total;
+}
+
+std::expected<int64_t, Datetime::ParseError> durationToNanosecs(const std::string_view duration)
+{
+	const bool negative = !duration.empty() && duration[0] == '-';
+	const size_t position = negative ? 1 : 0;
+	if (position == duration.size())
+		return parseError(Datetime::ParseErrorKind::Length, position);
+
+	const auto magnitude =
+		duration[position] == 'P' ? isoDurationToNanosecs(duration, position + 1) : clockDurationToNanosecs(duration, position);
+	if (!magnitude)
+		return std::unexpected(magnitude.error());
+	const int64_t nanosecs = static_cast<int64_t>(*magnitude);
+	return negative ? -nanosecs : nanosecs;
+}
+
+inline char *writeDurationNumber(char *output, const uint64_t value)
+{
+	if (value < 100)
+		return writeTwoDigits(output, static_cast<unsigned>(value));
+	return std::to_chars(output, output + 20, value).ptr;
+}
+
+// al massimo 28 chars: -PT2562047H47M16.854775807S
+size_t writeDuration(char *output, const int64_t nanosecs, const Datetime::DurationFormat format, const Datetime::Precision precision)
+{
+	using Precision = Datetime::Precision;
+	int fractionDigits = 0;
+	uint64_t unit = 1;
+	switch (precision)
+	{
+	case Precision::Days:
+		unit = 86400 * nanosecsPerSecond;
+		break;
+	case Precision::Hours:
+		unit = 3600 * nanosecsPerSecond;
+		break;
+	case Precision::Minutes:
+		unit = 60 * nanosecsPerSecond;
+		break;
+	case Precision::Seconds:
+		unit = nanosecsPerSecond;
+		break;
+	case Precision::Millis:
+		fractionDigits = 3;
+		break;
+	case Precision::Micros:
+		fractionDigits = 6;
+		break;
+	case Precision::Nanos:
+		fractionDigits = 9;
+		break;
+	case Precision::Native:
+		fractionDigits = std::chrono::hh_mm_ss<std::chrono::system_clock::duration>::fractional_width;
+		break;
+	}
+	if (fractionDigits > 0)
+		unit = fractionScale[fractionDigits];
+
+	// il modulo troncato alla precisione, -0 non esiste
+	uint64_t magnitude = nanosecs < 0 ? 0 - static_cast<uint64_t>(nanosecs) : static_cast<uint64_t>(nanosecs);
+	magnitude -= magnitude % unit;
+	const uint64_t seconds = magnitude / nanosecsPerSecond;
+	const uint64_t hours = seconds / 3600;
+	const unsigned minutes = static_cast<unsigned>(seconds / 60 % 60);
+	const unsigned secondsOfMinute = static_cast<unsigned>(seconds % 60);
+	const unsigned fraction = static_cast<unsigned>(magnitude % nanosecsPerSecond / unit);
+
+	char *current = output;
+	if (nanosecs < 0 && magnitude != 0)
+		*current++ = '-';
+	if (format == Datetime::DurationFormat::Clock)
+	{
+		current = writeDurationNumber(current, hours);
+		*current++ = ':';
+		current = writeTwoDigits(current, minutes);
+		if (precision >= Precision::Seconds)
+		{
+			*current++ = ':';
+			current = writeTwoDigits(current, secondsOfMinute);
+		}
+		if (fractionDigits > 0)
+		{
+			*current++ = '.';
+			current = writeDigits(current, fraction, fractionDigits);
+		}
+		return current - output;
+	}
+
+	*current++ = 'P';
+	*current++ = 'T';
+	if (hours != 0)
+	{
+		current = std::to_chars(current, current + 20, hours).ptr;
+		*current++ = 'H';
+	}
+	if (minutes != 0)
+	{
+		current = std::to_chars(current, current + 20, minutes).ptr;
+		*current++ = 'M';
+	}
+	if (secondsOfMinute != 0 || fraction != 0 || magnitude == 0)
+	{
+		current = std::to_chars(current, current + 20, secondsOfMinute).ptr;
+		if (fraction != 0)
+		{
+			*current++ = '.';
+			char *fractionEnd = writeDigits(current, fraction, fractionDigits);
+			while (fractionEnd[-1] == '0')
+				fractionEnd--;
+			current = fractionEnd;
+		}
+		*current++ = 'S';
+	}
+	return current - output;
+}
+} // namespace
+
+std::expected<std::chrono::nanoseconds, Datetime::ParseError> Datetime::parseDuration(const std::string_view duration) noexcept
+{
+	DATETIME_STATS_SCOPE(parseDuration);
+	const auto nanosecs = DATETIME_STATS_RESULT(reportParseError("parseDuration", duration, durationToNanosecs(duration)));
+	if (!nanosecs)
+		return std::unexpected(nanosecs.error());
+	return std::chrono::nanoseconds(*nanosecs);
+}
+
+size_t Datetime::formatDuration(
+	const std::span<char> output, const std::chrono::nanoseconds duration, const DurationFormat format, const Precision precision
 )
 {
-	// initialize the tm struct (the tm_wday field too)
-	time_t tUtcTime;
-	tm tmDateTime;
+	DATETIME_STATS_SCOPE(formatDurationBuffer);
+	char text[64];
+	const size_t length = writeDuration(text, duration.count(), format, precision);
+	return copyToOutput(output, std::string_view(text, length));
+}
 
-	if (llSecondsToAdd == 0)
+std::string Datetime::formatDuration(const std::chrono::nanoseconds duration, const DurationFormat format, const Precision precision)
+{
+	DATETIME_STATS_SCOPE(formatDuration);
+	char text[64];
+	return std::string(text, writeDuration(text, duration.count(), format, precision));
+}
+
+size_t Datetime::parseDurationColumn(
+	const std::string_view chars, const std::span<const int32_t> offsets, const std::span<std::chrono::nanoseconds> durations,
+	const std::span<uint8_t> valid
+)
+{
+	DATETIME_STATS_SCOPE(parseDurationColumn);
+	const size_t rows = offsets.empty() ? 0 : offsets.size() - 1;
+	if (durations.size() < rows || valid.size() < rows)
 	{
-		*pulDestYear = ulSrcYear;
-		*pulDestMonth = ulSrcMonth;
-		*pulDestDay = ulSrcDay;
-		*pulDestHour = ulSrcHour;
-		*pulDestMinutes = ulSrcMinutes;
-		*pulDestSeconds = ulSrcSeconds;
-		*pbDestDaylightSavingTime = lSrcDaylightSavingTime;
+		const std::string errorMessage = std::format(
+			"Output spans too small"
+			", rows: {}"
+			", durations size: {}"
+			", valid size: {}",
+			rows, durations.size(), valid.size()
+		);
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
 
-		return;
+	size_t validRows = 0;
+	for (size_t row = 0; row < rows; row++)
+	{
+		const int32_t start = offsets[row];
+		const int32_t end = offsets[row + 1];
+		if (start < 0 || end < start || static_cast<size_t>(end) > chars.size())
+		{
+			const std::string errorMessage = std::format(
+				"Wrong offsets"
+				", row: {}"
+				", start: {}"
+				", end: {}"
+				", chars size: {}",
+				row, start, end, chars.size()
+			);
+			DATETIME_STATS_FAILURE(Exception);
+			LOG_ERROR(errorMessage);
+			throw std::runtime_error(errorMessage);
+		}
+		// le righe malformate non passano dal callback degli errori, valid basta
+		const auto nanosecs = durationToNanosecs(chars.substr(start, end - start));
+		durations[row] = std::chrono::nanoseconds(nanosecs.value_or(0));
+		valid[row] = nanosecs.has_value();
+		validRows += nanosecs.has_value();
+	}
+	return validRows;
+}
+
+void Datetime::formatDurationColumn(
+	const std::span<const std::chrono::nanoseconds> durations, std::string &chars, std::vector<int32_t> &offsets, const DurationFormat format,
+	const Precision precision
+)
+{
+	DATETIME_STATS_SCOPE(formatDurationColumn);
+	constexpr size_t maxOffset = std::numeric_limits<int32_t>::max();
+
+	if (offsets.empty())
+		offsets.push_back(static_cast<int32_t>(chars.size()));
+	offsets.reserve(offsets.size() + durations.size());
+	for (const std::chrono::nanoseconds duration : durations)
+	{
+		char text[64];
+		chars.append(text, writeDuration(text, duration.count(), format, precision));
+		if (chars.size() > maxOffset)
+		{
+			DATETIME_STATS_FAILURE(Exception);
+			throw std::runtime_error(std::format("column of {} chars does not fit the int32 offsets", chars.size()));
+		}
+		offsets.push_back(static_cast<int32_t>(chars.size()));
+	}
+}
+
+namespace
+{
+// 2021-02-26T15:41:15.765Z / 2021-02-26T15:41:15.477+0100
+constexpr size_t isoMillisecsUtcLength = 24;
+constexpr size_t isoMillisecsOffsetLength = 28;
+
+// ms, offset and epoch from the already validated fields of a row
+inline int64_t isoMillisecsRowToUtc(
+	int year, int month, int day, int hour, int minute, int second, int milliSeconds, char sign, int offsetHours, int offsetMinutes
+)
+{
+	int64_t utcInSecs = Datetime::daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+	const int offsetSeconds = offsetHours * 3600 + offsetMinutes * 60;
+	if (sign == '+')
+		utcInSecs -= offsetSeconds;
+	else if (sign == '-')
+		utcInSecs += offsetSeconds;
+	return utcInSecs * 1000 + milliSeconds;
+}
+
+bool parseIsoMillisecsRow(const char *row, const size_t fieldWidth, int64_t *pUtcInMillisecs)
+{
+	int64_t utcInSecs;
+	if (row[isoSecondsLength] != '.' || !parseIsoSeconds(row, &utcInSecs))
+		return false;
+
+	const int hundreds = static_cast<unsigned char>(row[20]) - '0';
+	const int tensAndUnits = twoDigits(row + 21);
+	if (hundreds < 0 || hundreds > 9 || tensAndUnits < 0)
+		return false;
+
+	int offsetSeconds = 0;
+	if (fieldWidth == isoMillisecsUtcLength)
+	{
+		if (row[23] != 'Z')
+			return false;
+	}
+	else
+	{
+		const int offsetHours = twoDigits(row + 24);
+		const int offsetMinutes = twoDigits(row + 26);
+		if ((row[23] != '+' && row[23] != '-') || offsetHours < 0 || offsetHours > 23 || offsetMinutes < 0 || offsetMinutes > 59)
+			return false;
+		offsetSeconds = offsetHours * 3600 + offsetMinutes * 60;
+		if (row[23] == '-')
+			offsetSeconds = -offsetSeconds;
+	}
+
+	*pUtcInMillisecs = (utcInSecs - offsetSeconds) * 1000 + hundreds * 100 + tensAndUnits;
+	return true;
+}
+
+using BatchKernelFunction = size_t (*)(
+	const char *fields, size_t rows, size_t fieldWidth, size_t fieldStride, int64_t *utcInMillisecs, uint8_t *valid
+);
+
+size_t parseBatchScalar(
+	const char *fields, const size_t rows, const size_t fieldWidth, const size_t fieldStride, int64_t *utcInMillisecs, uint8_t *valid
+)
+{
+	size_t validRows = 0;
+	for (size_t rowIndex = 0; rowIndex < rows; rowIndex++)
+	{
+		int64_t utcInMillisec = 0;
+		const bool rowValid = parseIsoMillisecsRow(fields + rowIndex * fieldStride, fieldWidth, &utcInMillisec);
+		utcInMillisecs[rowIndex] = rowValid ? utcInMillisec : 0;
+		valid[rowIndex] = rowValid;
+		validRows += rowValid;
+	}
+	return validRows;
+}
+
+#ifdef DATETIME_X86_SIMD
+/*
+	Every row is read with two 16 bytes loads: lo = row[0, 16) and hi = row[fieldWidth - 16, fieldWidth)
+	so that no byte outside the row is touched. The digits are validated against a template,
+	gathered in pairs by pshufb and converted by pmaddubsw (d0 * 10 + d1), then the ranges are
+	checked on the 16 bits lanes:
+		lo lanes: year / 100, year % 100, month, day, hour, minute
+		hi lanes: second, ms / 100, ms % 100[, offset hours, offset minutes]
+*/
+struct BatchLayout
+{
+	// Digits: 1 digit, 0 separator, 2 any byte
+	alignas(16) int8_t loSeparators[16];
+	alignas(16) int8_t loDigits[16];
+	alignas(16) int8_t loShuffle[16];
+	alignas(16) int16_t loMin[8];
+	alignas(16) int16_t loMax[8];
+	alignas(16) int8_t hiSeparators[16];
+	alignas(16) int8_t hiDigits[16];
+	alignas(16) int8_t hiShuffle[16];
+	alignas(16) int16_t hiMax[8];
+	int hiSignIndex; // -1: 'Z' layout
+};
+
+constexpr int8_t Z = -128; // pshufb: azzera il byte
+
+// YYYY-MM-DDTHH:MM
+#define DATETIME_BATCH_LO                                                                                                                            \
+	{0, 0, 0, 0, '-', 0, 0, '-', 0, 0, 'T', 0, 0, ':', 0, 0}, {1, 1, 1, 1, 0, 1, 1, 0, 1, 1, 0, 1, 1, 0, 1, 1},                                  \
+		{0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, Z, Z, Z, Z}, {0, 0, 1, 1, 0, 0, 0, 0}, {99, 99, 12, 31, 23, 59, 0, 0}
+
+// hi = DDTHH:MM:SS.mmmZ
+constexpr BatchLayout utcBatchLayout = {
+	DATETIME_BATCH_LO,
+	{0, 0, 'T', 0, 0, ':', 0, 0, ':', 0, 0, '.', 0, 0, 0, 'Z'},
+	{1, 1, 0, 1, 1, 0, 1, 1, 0, 1, 1, 0, 1, 1, 1, 0},
+	{9, 10, Z, 12, 13, 14, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z},
+	{60, 9, 99, 0, 0, 0, 0, 0},
+	-1
+};
+
+// hi = HH:MM:SS.mmm+hhmm (the sign, 2 in hiDigits, is checked apart)
+constexpr BatchLayout offsetBatchLayout = {
+	DATETIME_BATCH_LO,
+	{0, ':', 0, 0, ':', 0, 0, '.', 0, 0, 0, 0, 0, 0, 0, 0},
+	{1, 0, 1, 1, 0, 1, 1, 0, 1, 1, 1, 2, 1, 1, 1, 1},
+	{5, 6, Z, 8, 9, 10, 12, 13, 14, 15, Z, Z, Z, Z, Z, Z},
+	{60, 9, 99, 23, 59, 0, 0, 0},
+	11
+};
+
+#undef DATETIME_BATCH_LO
+
+inline const BatchLayout &batchLayout(const size_t fieldWidth)
+{
+	return fieldWidth == isoMillisecsUtcLength ? utcBatchLayout : offsetBatchLayout;
+}
+
+// lanes already range checked by the kernels
+inline int64_t batchLanesToUtc(const uint16_t *lo, const uint16_t *hi, const char sign)
+{
+	return isoMillisecsRowToUtc(lo[0] * 100 + lo[1], lo[2], lo[3], lo[4], lo[5], hi[0], hi[1] * 100 + hi[2], sign, hi[3], hi[4]);
+}
+
+// 0xFFFF se tutti i byte della riga rispettano il template (cifre e separatori)
+__attribute__((target("sse4.1"))) inline int sse4TemplateMask(__m128i bytes, __m128i digits, const int8_t *separators, const int8_t *digitMask)
+{
+	const __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+	const __m128i isSeparator = _mm_cmpeq_epi8(bytes, _mm_load_si128(reinterpret_cast<const __m128i *>(separators)));
+	const __m128i kind = _mm_load_si128(reinterpret_cast<const __m128i *>(digitMask));
+	const __m128i digitPositions = _mm_cmpeq_epi8(kind, _mm_set1_epi8(1));
+	const __m128i anyPositions = _mm_cmpeq_epi8(kind, _mm_set1_epi8(2));
+	return _mm_movemask_epi8(_mm_or_si128(_mm_blendv_epi8(isSeparator, isDigit, digitPositions), anyPositions));
+}
+
+__attribute__((target("sse4.1"))) size_t parseBatchSse4(
+	const char *fields, const size_t rows, const size_t fieldWidth, const size_t fieldStride, int64_t *utcInMillisecs, uint8_t *valid
+)
+{
+	const BatchLayout &layout = batchLayout(fieldWidth);
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i weights = _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1);
+	const __m128i loShuffle = _mm_load_si128(reinterpret_cast<const __m128i *>(layout.loShuffle));
+	const __m128i hiShuffle = _mm_load_si128(reinterpret_cast<const __m128i *>(layout.hiShuffle));
+	const __m128i loMin = _mm_load_si128(reinterpret_cast<const __m128i *>(layout.loMin));
+	const __m128i loMax = _mm_load_si128(reinterpret_cast<const __m128i *>(layout.loMax));
+	const __m128i hiMax = _mm_load_si128(reinterpret_cast<const __m128i *>(layout.hiMax));
+
+	size_t validRows = 0;
+	for (size_t rowIndex = 0; rowIndex < rows; rowIndex++)
+	{
+		const char *row = fields + rowIndex * fieldStride;
+		const __m128i loBytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row));
+		const __m128i hiBytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + fieldWidth - 16));
+		const __m128i loDigits = _mm_sub_epi8(loBytes, zero);
+		const __m128i hiDigits = _mm_sub_epi8(hiBytes, zero);
+
+		const __m128i lo = _mm_maddubs_epi16(_mm_shuffle_epi8(loDigits, loShuffle), weights);
+		const __m128i hi = _mm_maddubs_epi16(_mm_shuffle_epi8(hiDigits, hiShuffle), weights);
+		const __m128i outOfRange = _mm_or_si128(
+			_mm_or_si128(_mm_cmplt_epi16(lo, loMin), _mm_cmpgt_epi16(lo, loMax)), _mm_cmpgt_epi16(hi, hiMax)
+		);
+
+		const char sign = layout.hiSignIndex < 0 ? 'Z' : row[fieldWidth - 16 + layout.hiSignIndex];
+		const bool rowValid = (sse4TemplateMask(loBytes, loDigits, layout.loSeparators, layout.loDigits) &
+							   sse4TemplateMask(hiBytes, hiDigits, layout.hiSeparators, layout.hiDigits)) == 0xFFFF &&
+							  _mm_testz_si128(outOfRange, outOfRange) && (layout.hiSignIndex < 0 || sign == '+' || sign == '-');
+
+		alignas(16) uint16_t loLanes[8];
+		alignas(16) uint16_t hiLanes[8];
+		_mm_store_si128(reinterpret_cast<__m128i *>(loLanes), lo);
+		_mm_store_si128(reinterpret_cast<__m128i *>(hiLanes), hi);
+
+		utcInMillisecs[rowIndex] = rowValid ? batchLanesToUtc(loLanes, hiLanes, sign) : 0;
+		valid[rowIndex] = rowValid;
+		validRows += rowValid;
+	}
+	return validRows;
+}
+
+// 0xFFFFFFFF se tutti i byte delle due righe rispettano il template
+__attribute__((target("avx2"))) inline uint32_t avx2TemplateMask(__m256i bytes, __m256i digits, const int8_t *separators, const int8_t *digitMask)
+{
+	const __m256i isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digits, _mm256_set1_epi8(9)), digits);
+	const __m256i isSeparator =
+		_mm256_cmpeq_epi8(bytes, _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(separators))));
+	const __m256i kind = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(digitMask)));
+	const __m256i digitPositions = _mm256_cmpeq_epi8(kind, _mm256_set1_epi8(1));
+	const __m256i anyPositions = _mm256_cmpeq_epi8(kind, _mm256_set1_epi8(2));
+	return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_blendv_epi8(isSeparator, isDigit, digitPositions), anyPositions)));
+}
+
+// two rows for iteration, one for each 128 bits lane
+__attribute__((target("avx2"))) size_t parseBatchAvx2(
+	const char *fields, const size_t rows, const size_t fieldWidth, const size_t fieldStride, int64_t *utcInMillisecs, uint8_t *valid
+)
+{
+	const BatchLayout &layout = batchLayout(fieldWidth);
+	const __m256i zero = _mm256_set1_epi8('0');
+	const __m256i weights = _mm256_set1_epi16(0x010A); // bytes 10, 1
+	const __m256i loShuffle = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(layout.loShuffle)));
+	const __m256i hiShuffle = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(layout.hiShuffle)));
+	const __m256i loMin = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(layout.loMin)));
+	const __m256i loMax = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(layout.loMax)));
+	const __m256i hiMax = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(layout.hiMax)));
+
+	size_t validRows = 0;
+	size_t rowIndex = 0;
+	for (; rowIndex + 2 <= rows; rowIndex += 2)
+	{
+		const char *rows2[2] = {fields + rowIndex * fieldStride, fields + (rowIndex + 1) * fieldStride};
+		const __m256i loBytes = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rows2[0]))),
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(rows2[1])), 1
+		);
+		const __m256i hiBytes = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rows2[0] + fieldWidth - 16))),
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(rows2[1] + fieldWidth - 16)), 1
+		);
+		const __m256i loDigits = _mm256_sub_epi8(loBytes, zero);
+		const __m256i hiDigits = _mm256_sub_epi8(hiBytes, zero);
+
+		const __m256i lo = _mm256_maddubs_epi16(_mm256_shuffle_epi8(loDigits, loShuffle), weights);
+		const __m256i hi = _mm256_maddubs_epi16(_mm256_shuffle_epi8(hiDigits, hiShuffle), weights);
+		const __m256i outOfRange = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpgt_epi16(loMin, lo), _mm256_cmpgt_epi16(lo, loMax)), _mm256_cmpgt_epi16(hi, hiMax)
+		);
+
+		const uint32_t templateMask = avx2TemplateMask(loBytes, loDigits, layout.loSeparators, layout.loDigits) &
+									  avx2TemplateMask(hiBytes, hiDigits, layout.hiSeparators, layout.hiDigits);
+		const uint32_t rangeMask = ~static_cast<uint32_t>(_mm256_movemask_epi8(outOfRange));
+
+		alignas(32) uint16_t loLanes[16];
+		alignas(32) uint16_t hiLanes[16];
+		_mm256_store_si256(reinterpret_cast<__m256i *>(loLanes), lo);
+		_mm256_store_si256(reinterpret_cast<__m256i *>(hiLanes), hi);
+
+		for (size_t lane = 0; lane < 2; lane++)
+		{
+			const char sign = layout.hiSignIndex < 0 ? 'Z' : rows2[lane][fieldWidth - 16 + layout.hiSignIndex];
+			const uint32_t laneMask = 0xFFFFu << (lane * 16);
+			const bool rowValid = (templateMask & laneMask) == laneMask && (rangeMask & laneMask) == laneMask &&
+								  (layout.hiSignIndex < 0 || sign == '+' || sign == '-');
+
+			utcInMillisecs[rowIndex + lane] = rowValid ? batchLanesToUtc(loLanes + lane * 8, hiLanes + lane * 8, sign) : 0;
+			valid[rowIndex + lane] = rowValid;
+			validRows += rowValid;
+		}
 	}
 
-	tmDateTime.tm_year = ulSrcYear;
-	tmDateTime.tm_mon = ulSrcMonth;
-	tmDateTime.tm_mday = ulSrcDay;
-	tmDateTime.tm_hour = ulSrcHour;
-	tmDateTime.tm_min = ulSrcMinutes;
-	tmDateTime.tm_sec = ulSrcSeconds;
+	if (rowIndex < rows)
+		validRows += parseBatchSse4(fields + rowIndex * fieldStride, rows - rowIndex, fieldWidth, fieldStride, utcInMillisecs + rowIndex, valid + rowIndex);
 
-	tmDateTime.tm_year -= 1900;
-	tmDateTime.tm_mon -= 1;
+	return validRows;
+}
+#endif
+
+BatchKernelFunction selectBatchKernel()
+{
+#ifdef DATETIME_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return parseBatchAvx2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return parseBatchSse4;
+#endif
+	return parseBatchScalar;
+}
+
+// nullptr: kernel non supportato dalla CPU
+BatchKernelFunction batchKernelOf(const Datetime::BatchKernel kernel)
+{
+	switch (kernel)
+	{
+	case Datetime::BatchKernel::Auto:
+	{
+		static const BatchKernelFunction batchKernel = selectBatchKernel();
+		return batchKernel;
+	}
+	case Datetime::BatchKernel::Scalar:
+		return parseBatchScalar;
+#ifdef DATETIME_X86_SIMD
+	case Datetime::BatchKernel::Sse41:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse4.1") ? parseBatchSse4 : nullptr;
+	case Datetime::BatchKernel::Avx2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? parseBatchAvx2 : nullptr;
+#endif
+	default:
+		return nullptr;
+	}
+}
+} // namespace
+
+size_t Datetime::parseUtcInMillisecsBatch(
+	const std::span<const char> fields, const size_t fieldWidth, const std::span<int64_t> utcInMillisecs, const std::span<uint8_t> valid,
+	size_t fieldStride, const BatchKernel kernel
+)
+{
+	DATETIME_STATS_SCOPE(parseUtcInMillisecsBatch);
+	if (fieldStride == 0)
+		fieldStride = fieldWidth;
+
+	if ((fieldWidth != isoMillisecsUtcLength && fieldWidth != isoMillisecsOffsetLength) || fieldStride < fieldWidth)
+	{
+		const std::string errorMessage = std::format(
+			"Wrong input"
+			", fieldWidth: {}"
+			", fieldStride: {}",
+			fieldWidth, fieldStride
+		);
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
+
+	const size_t rows = fields.size() < fieldWidth ? 0 : (fields.size() - fieldWidth) / fieldStride + 1;
+	if (utcInMillisecs.size() < rows || valid.size() < rows)
+	{
+		const std::string errorMessage = std::format(
+			"Output spans are too small"
+			", rows: {}"
+			", utcInMillisecs.size: {}"
+			", valid.size: {}",
+			rows, utcInMillisecs.size(), valid.size()
+		);
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
 
-	//	A negative value for tm_isdst causes mktime() to attempt
-	//	to determine whether Daylight Saving Time is in effect
-	//	for the specified time.
-	tmDateTime.tm_isdst = lSrcDaylightSavingTime;
+	const BatchKernelFunction batchKernel = batchKernelOf(kernel);
+	if (batchKernel == nullptr)
+	{
+		const std::string errorMessage = std::format("Batch kernel not supported by the CPU, kernel: {}", static_cast<int>(kernel));
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
+
+	return batchKernel(fields.data(), rows, fieldWidth, fieldStride, utcInMillisecs.data(), valid.data());
+}
+
+namespace
+{
+// zigzag: i piccoli valori negativi diventano piccoli positivi (un byte di varint)
+inline uint64_t zigzagEncode(const uint64_t value) { return (value << 1) ^ (0 - (value >> 63)); }
+
+inline uint64_t zigzagDecode(const uint64_t value) { return (value >> 1) ^ (0 - (value & 1)); }
+
+inline void appendVarint(std::vector<uint8_t> &data, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		data.push_back(static_cast<uint8_t>(value) | 0x80);
+		value >>= 7;
+	}
+	data.push_back(static_cast<uint8_t>(value));
+}
+
+// ritorna nullptr se il varint e' troncato o piu' lungo di 10 byte
+inline const uint8_t *readVarint(const uint8_t *current, const uint8_t *end, uint64_t *pValue)
+{
+	uint64_t value = 0;
+	for (int shift = 0; shift < 70 && current < end; shift += 7)
+	{
+		const uint8_t byte = *current++;
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if (byte < 0x80)
+		{
+			*pValue = value;
+			return current;
+		}
+	}
+	return nullptr;
+}
+
+[[noreturn]] void throwMalformedTimestampColumn(const std::string_view reason)
+{
+	const std::string errorMessage = std::format("Malformed TimestampColumn, {}", reason);
+	DATETIME_STATS_EXCEPTION();
+	LOG_ERROR(errorMessage);
+	throw std::runtime_error(errorMessage);
+}
 
-	tUtcTime = mktime(&tmDateTime);
+void writeLittleEndian(uint8_t *output, const uint64_t value)
+{
+	for (int byte = 0; byte < 8; byte++)
+		output[byte] = static_cast<uint8_t>(value >> (byte * 8));
+}
+
+uint64_t readLittleEndian(const uint8_t *input)
+{
+	uint64_t value = 0;
+	for (int byte = 0; byte < 8; byte++)
+		value |= static_cast<uint64_t>(input[byte]) << (byte * 8);
+	return value;
+}
 
-	tUtcTime = tUtcTime + llSecondsToAdd;
+// decodifica i primi count valori di un blocco, le differenze sono modulo 2^64
+void decodeTimestampBlock(const int64_t first, const uint8_t *current, const uint8_t *end, const size_t count, int64_t *output)
+{
+	uint64_t value = static_cast<uint64_t>(first);
+	uint64_t delta = 0;
+	output[0] = first;
+	size_t index = 1;
+	while (index < count)
+	{
+		// serie regolare: 8 varint di un byte, nessun branch per valore
+		if (count - index >= 8 && end - current >= 8)
+		{
+			uint64_t word;
+			std::memcpy(&word, current, sizeof(word));
+			if ((word & 0x8080808080808080ull) == 0)
+			{
+				for (int byte = 0; byte < 8; byte++)
+				{
+					delta += zigzagDecode(current[byte]);
+					value += delta;
+					output[index++] = static_cast<int64_t>(value);
+				}
+				current += 8;
+				continue;
+			}
+		}
 
-	Datetime::convertFromUTCToLocal(tUtcTime, &tmDateTime);
+		uint64_t deltaOfDelta;
+		current = readVarint(current, end, &deltaOfDelta);
+		if (current == nullptr)
+			throwMalformedTimestampColumn("truncated varint");
+		delta += zigzagDecode(deltaOfDelta);
+		value += delta;
+		output[index++] = static_cast<int64_t>(value);
+	}
+}
+} // namespace
 
-	*pulDestYear = tmDateTime.tm_year + 1900;
-	*pulDestMonth = tmDateTime.tm_mon + 1;
-	*pulDestDay = tmDateTime.tm_mday;
-	*pulDestHour = tmDateTime.tm_hour;
-	*pulDestMinutes = tmDateTime.tm_min;
-	*pulDestSeconds = tmDateTime.tm_sec;
+Datetime::TimestampColumn::TimestampColumn(const std::span<const int64_t> utcInMillisecs) { append(utcInMillisecs); }
 
-	if (tmDateTime.tm_isdst == 1)
-		*pbDestDaylightSavingTime = true;
+void Datetime::TimestampColumn::append(const int64_t utcInMillisecs)
+{
+	DATETIME_STATS_SCOPE(timestampColumnAppend);
+	if (_size % blockSize == 0)
+	{
+		_blocks.push_back(Block{utcInMillisecs, _data.size()});
+		_lastDelta = 0;
+	}
 	else
-		*pbDestDaylightSavingTime = false;
+	{
+		const uint64_t delta = static_cast<uint64_t>(utcInMillisecs) - static_cast<uint64_t>(_last);
+		appendVarint(_data, zigzagEncode(delta - static_cast<uint64_t>(_lastDelta)));
+		_lastDelta = static_cast<int64_t>(delta);
+	}
+	_last = utcInMillisecs;
+	_size++;
 }
 
-void Datetime::isLeapYear(unsigned long ulYear, bool *pbIsLeapYear)
+void Datetime::TimestampColumn::append(const std::span<const int64_t> utcInMillisecs)
 {
-	if (ulYear % 4 != 0)
-		*pbIsLeapYear = false;
-
-	if (ulYear % 400 == 0)
-		*pbIsLeapYear = true;
+	DATETIME_STATS_SCOPE(timestampColumnAppendSpan);
+	_data.reserve(_data.size() + utcInMillisecs.size());
+	for (const int64_t value : utcInMillisecs)
+		append(value);
+}
 
-	if (ulYear % 100 == 0)
-		*pbIsLeapYear = false;
+int64_t Datetime::TimestampColumn::operator[](const size_t index) const
+{
+	DATETIME_STATS_SCOPE(timestampColumnAt);
+	if (index >= _size)
+	{
+		const std::string errorMessage = std::format(
+			"Wrong index"
+			", index: {}"
+			", size: {}",
+			index, _size
+		);
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
 
-	*pbIsLeapYear = true;
+	const size_t block = index / blockSize;
+	const uint8_t *end = _data.data() + (block + 1 < _blocks.size() ? _blocks[block + 1].offset : _data.size());
+	int64_t values[blockSize];
+	decodeTimestampBlock(_blocks[block].first, _data.data() + _blocks[block].offset, end, index % blockSize + 1, values);
+	return values[index % blockSize];
 }
 
-void Datetime::getLastDayOfMonth(unsigned long ulYear, unsigned long ulMonth, unsigned long *pulLastDayOfMonth)
+size_t Datetime::TimestampColumn::decodeBlock(const size_t block, const std::span<int64_t> utcInMillisecs) const
 {
-	bool bIsLeapYear;
-	int piDaysInMonths[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-
-	if (ulMonth <= 0 || ulMonth > 12)
+	DATETIME_STATS_SCOPE(timestampColumnDecodeBlock);
+	const size_t count = block < _blocks.size() ? std::min(blockSize, _size - block * blockSize) : 0;
+	if (count == 0 || utcInMillisecs.size() < count)
 	{
 		const std::string errorMessage = std::format(
 			"Wrong input"
-			", ulMonth: {}",
-			ulMonth
+			", block: {}"
+			", blocks: {}"
+			", utcInMillisecs.size: {}",
+			block, _blocks.size(), utcInMillisecs.size()
 		);
+		DATETIME_STATS_FAILURE(Exception);
 		LOG_ERROR(errorMessage);
 		throw std::runtime_error(errorMessage);
 	}
 
-	isLeapYear(ulYear, &bIsLeapYear);
-
-	*pulLastDayOfMonth = piDaysInMonths[ulMonth - 1];
-
-	if (ulMonth == 2 && bIsLeapYear) // february of a leap year
-		(*pulLastDayOfMonth) += 1;
+	const uint8_t *end = _data.data() + (block + 1 < _blocks.size() ? _blocks[block + 1].offset : _data.size());
+	decodeTimestampBlock(_blocks[block].first, _data.data() + _blocks[block].offset, end, count, utcInMillisecs.data());
+	return count;
 }
 
-/* sostituita da parseUtcStringToTimeT
-// 2021-02-26T15:41:15Z
-time_t Datetime::sDateSecondsToUtc(string sDate)
+void Datetime::TimestampColumn::decode(const std::span<int64_t> utcInMillisecs) const
 {
-
-	unsigned long ulUTCYear;
-	unsigned long ulUTCMonth;
-	unsigned long ulUTCDay;
-	unsigned long ulUTCHour;
-	unsigned long ulUTCMinutes;
-	unsigned long ulUTCSeconds;
-	tm tmDate;
-	int sscanfReturn;
-
-#ifdef _WIN32
-	if ((sscanfReturn =
-			 sscanf_s(sDate.c_str(), "%4lu-%2lu-%2luT%2lu:%2lu:%2luZ", &ulUTCYear, &ulUTCMonth, &ulUTCDay, &ulUTCHour, &ulUTCMinutes, &ulUTCSeconds)
-		) != 6)
-#else
-	if ((sscanfReturn =
-			 sscanf(sDate.c_str(), "%4lu-%2lu-%2luT%2lu:%2lu:%2luZ", &ulUTCYear, &ulUTCMonth, &ulUTCDay, &ulUTCHour, &ulUTCMinutes, &ulUTCSeconds)) !=
-		6)
-#endif
+	DATETIME_STATS_SCOPE(timestampColumnDecode);
+	if (utcInMillisecs.size() < _size)
 	{
-		string errorMessage = std::format(
-			"Field has a wrong format (sscanf failed)"
-			", sDate: {}"
-			", sscanfReturn: {}",
-			sDate, sscanfReturn
+		const std::string errorMessage = std::format(
+			"Output span is too small"
+			", size: {}"
+			", utcInMillisecs.size: {}",
+			_size, utcInMillisecs.size()
 		);
-		// LOG_ERROR(errorMessage);
-
-		throw runtime_error(errorMessage);
+		DATETIME_STATS_FAILURE(Exception);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
 	}
 
-	time_t utcTime;
+	for (size_t block = 0; block < _blocks.size(); block++)
+		decodeBlock(block, utcInMillisecs.subspan(block * blockSize));
+}
 
-	time(&utcTime);
-#ifdef _WIN32
-	gmtime_s(&tmDate, &utcTime);
-#else
-	gmtime_r(&utcTime, &tmDate);
-#endif
+void Datetime::TimestampColumn::formatBlock(
+	const size_t block, const Formatter &formatter, std::string &chars, std::vector<int32_t> &offsets
+) const
+{
+	DATETIME_STATS_SCOPE(timestampColumnFormatBlock);
+	int64_t values[blockSize];
+	const size_t count = decodeBlock(block, values);
+	// stessi bit di dateTimeFormat(uint64_t milliSecondsSinceEpoch)
+	formatter.formatColumn(std::span<const uint64_t>(reinterpret_cast<const uint64_t *>(values), count), chars, offsets);
+}
 
-	tmDate.tm_year = ulUTCYear - 1900;
-	tmDate.tm_mon = ulUTCMonth - 1;
-	tmDate.tm_mday = ulUTCDay;
-	tmDate.tm_hour = ulUTCHour;
-	tmDate.tm_min = ulUTCMinutes;
-	tmDate.tm_sec = ulUTCSeconds;
+// size, (first, offset) per blocco, dimensione dei varint, varint: tutto little endian
+std::vector<uint8_t> Datetime::TimestampColumn::serialize() const
+{
+	DATETIME_STATS_SCOPE(timestampColumnSerialize);
+	std::vector<uint8_t> image(8 + _blocks.size() * 16 + 8 + _data.size());
+	uint8_t *current = image.data();
+	writeLittleEndian(current, _size);
+	current += 8;
+	for (const Block &block : _blocks)
+	{
+		writeLittleEndian(current, static_cast<uint64_t>(block.first));
+		writeLittleEndian(current + 8, block.offset);
+		current += 16;
+	}
+	writeLittleEndian(current, _data.size());
+	current += 8;
+	std::copy(_data.begin(), _data.end(), current);
 
-#ifdef _WIN32
-	utcTime = _mkgmtime(&tmDate);
-#else
-	utcTime = timegm(&tmDate);
-#endif
+	return image;
+}
 
-	return utcTime;
+Datetime::TimestampColumn Datetime::TimestampColumn::deserialize(const std::span<const uint8_t> image)
+{
+	DATETIME_STATS_SCOPE(timestampColumnDeserialize);
+	if (image.size() < 16)
+		throwMalformedTimestampColumn(std::format("image too short, size: {}", image.size()));
+
+	TimestampColumn column;
+	column._size = readLittleEndian(image.data());
+	const uint64_t blocks = column._size / blockSize + (column._size % blockSize != 0);
+	if (blocks > (image.size() - 16) / 16)
+		throwMalformedTimestampColumn(std::format("image too short, size: {}, values: {}", image.size(), column._size));
+
+	const uint8_t *current = image.data() + 8;
+	column._blocks.resize(blocks);
+	for (Block &block : column._blocks)
+	{
+		block.first = static_cast<int64_t>(readLittleEndian(current));
+		block.offset = readLittleEndian(current + 8);
+		current += 16;
+	}
+	const uint64_t dataSize = readLittleEndian(current);
+	current += 8;
+	if (dataSize != static_cast<uint64_t>(image.data() + image.size() - current))
+		throwMalformedTimestampColumn(std::format("wrong data size, dataSize: {}, image.size: {}", dataSize, image.size()));
+	for (size_t block = 0; block < column._blocks.size(); block++)
+		if ((block == 0 && column._blocks[block].offset != 0) || (block > 0 && column._blocks[block].offset < column._blocks[block - 1].offset) ||
+			column._blocks[block].offset > dataSize)
+			throwMalformedTimestampColumn(std::format("wrong block offset, block: {}", block));
+	column._data.assign(current, current + dataSize);
+
+	// stato dell'encoder per gli append successivi (valida anche l'ultimo blocco)
+	if (!column._blocks.empty())
+	{
+		int64_t values[blockSize];
+		const size_t count = column.decodeBlock(column._blocks.size() - 1, values);
+		column._last = values[count - 1];
+		column._lastDelta = count > 1 ? static_cast<int64_t>(static_cast<uint64_t>(values[count - 1]) - static_cast<uint64_t>(values[count - 2])) : 0;
+	}
+
+	return column;
 }
-*/
 
 // ex: 2021-02-26T15:41:15Z
 time_t Datetime::parseStringToUtcInSecs(const std::string &datetime, const std::string& inputFormat)
 {
+	DATETIME_STATS_SCOPE(parseStringToUtcInSecs);
+	// fast path per i layout ISO fissi, get_time resta per gli altri formati e per gli input non canonici
+	if (inputFormat == "%Y-%m-%dT%H:%M:%SZ")
+	{
+		time_t utcInSecs;
+		if (parseIsoUtcInSecs(datetime, &utcInSecs))
+			return utcInSecs;
+	}
+	else if (inputFormat == "%Y-%m-%dT%H:%M:%S" && datetime.size() >= isoSecondsLength)
+	{
+		// get_time ignora i caratteri dopo i secondi (i.e.: .477+0100)
+		int64_t utcInSecs;
+		if (parseIsoSeconds(datetime.data(), &utcInSecs))
+			return static_cast<time_t>(utcInSecs);
+	}
+
 	// E' importante che la stringa abbia sempre la Z finale (Z = Zulu = UTC)
 	tm tm = {};
 	std::istringstream ss(datetime);
@@ -543,22 +4808,26 @@ time_t Datetime::parseStringToUtcInSecs(const std::string &datetime, const std::
 	if (ss.fail())
 	{
 		const std::string errorMessage = std::format("Parsing datetime failed. datetime: {}", datetime);
+		DATETIME_STATS_FAILURE(Exception);
 		LOG_ERROR(errorMessage);
 		throw std::runtime_error(errorMessage);
 	}
 
-	// timegm interpreta la tm come UTC
-#ifdef _WIN32
-	return _mkgmtime(&tm);
-#else
-	return timegm(&tm);
-#endif
+	// la tm e' UTC
+	return utcFromTm(tm);
 }
 
 // 2021-02-26T15:41:15.765Z
 int64_t Datetime::parseUtcStringToUtcInMillisecs(const std::string &datetime)
 {
+	DATETIME_STATS_SCOPE(parseUtcStringToUtcInMillisecs);
 	// return Datetime::parseStringToUtcInSecs(datetime) * 1000;
+	{
+		int64_t utcInMillisecs;
+		if (parseIsoUtcInMillisecs(datetime, &utcInMillisecs))
+			return utcInMillisecs;
+	}
+
 	std::tm tm = {};
 	int millis = 0;
 
@@ -567,26 +4836,40 @@ int64_t Datetime::parseUtcStringToUtcInMillisecs(const std::string &datetime)
 	char discard;
 	ss >> std::get_time(&tm, "%Y-%m-%dT%H:%M:%S");
 	if (ss.fail())
+	{
+		DATETIME_STATS_FAILURE(Exception);
 		throw std::runtime_error(std::format("Parsing datetime failed. datetime: {}", datetime));
+	}
 	ss >> discard; // '.' prima dei millisecondi
 	if (ss.fail())
+	{
+		DATETIME_STATS_FAILURE(Exception);
 		throw std::runtime_error(std::format("Parsing datetime failed. datetime: {}", datetime));
+	}
 	ss >> millis;
 	if (ss.fail())
+	{
+		DATETIME_STATS_FAILURE(Exception);
 		throw std::runtime_error(std::format("Parsing datetime failed. datetime: {}", datetime));
+	}
 
-	// timegm interpreta la tm come UTC
-#ifdef _WIN32
-	time_t seconds = _mkgmtime(&tm);
-#else
-	time_t seconds = timegm(&tm);
-#endif
-	return static_cast<int64_t>(seconds) * 1000 + millis;
+	// la tm e' UTC
+	return utcFromTm(tm) * 1000 + millis;
 }
 
 // HH:MM
 long Datetime::sTimeToMilliSecs(std::string sTime)
 {
+	DATETIME_STATS_SCOPE(sTimeToMilliSecs);
+	// il caso HH:MM senza sscanf; gli altri input restano a sscanf, che ne definisce il risultato
+	if (sTime.size() == 5 && sTime[2] == ':')
+	{
+		const int hours = twoDigits(sTime.data());
+		const int minutes = twoDigits(sTime.data() + 3);
+		if (hours >= 0 && minutes >= 0)
+			return (hours * 3600 + minutes * 60) * 1000;
+	}
+
 	int hours;
 	int minutes;
 	int sscanfReturn;
@@ -604,6 +4887,7 @@ long Datetime::sTimeToMilliSecs(std::string sTime)
 			sTime, sscanfReturn
 		);
 
+		DATETIME_STATS_FAILURE(Rejected);
 		return -1;
 	}
 
@@ -612,9 +4896,28 @@ long Datetime::sTimeToMilliSecs(std::string sTime)
 
 std::string Datetime::utcToUtcString(const time_t utc, const std::string& outputFormat, const std::string& outputPrecision)
 {
+	DATETIME_STATS_SCOPE(utcToUtcString);
+	return dateTimeFormat(utc * 1000, outputFormat, outputPrecision);
+}
+
+size_t Datetime::utcToUtcString(const std::span<char> output, const time_t utc, const std::string_view outputFormat, const std::string_view outputPrecision)
+{
+	DATETIME_STATS_SCOPE(utcToUtcStringBuffer);
+	return dateTimeFormat(output, utc * 1000, outputFormat, outputPrecision);
+}
+
+std::string Datetime::utcToUtcString(const time_t utc, const std::string_view outputFormat, const Precision outputPrecision)
+{
+	DATETIME_STATS_SCOPE(utcToUtcStringPrecision);
 	return dateTimeFormat(utc * 1000, outputFormat, outputPrecision);
 }
 
+size_t Datetime::utcToUtcString(const std::span<char> output, const time_t utc, const std::string_view outputFormat, const Precision outputPrecision)
+{
+	DATETIME_STATS_SCOPE(utcToUtcStringBufferPrecision);
+	return dateTimeFormat(output, utc * 1000, outputFormat, outputPrecision);
+}
+
 /*
 string Datetime::utcToUtcString(time_t utc, Format format)
 {
@@ -641,10 +4944,30 @@ string Datetime::utcToUtcString(time_t utc, Format format)
 
 std::string Datetime::utcToLocalString(const time_t utc, const std::string& outputFormat)
 {
+	DATETIME_STATS_SCOPE(utcToLocalString);
 	tm tmDateTime = utcSecondsToLocalTime(utc);
 	return dateTimeFormat(tmDateTime, outputFormat);
 }
 
+size_t Datetime::utcToLocalString(const std::span<char> output, const time_t utc, const std::string_view outputFormat)
+{
+	DATETIME_STATS_SCOPE(utcToLocalStringBuffer);
+	tm tmDateTime = utcSecondsToLocalTime(utc);
+	return dateTimeFormat(output, tmDateTime, outputFormat);
+}
+
+std::string Datetime::utcToLocalString(const time_t utc, const TimeZone &timeZone, const std::string &outputFormat)
+{
+	DATETIME_STATS_SCOPE(utcToLocalStringTimeZone);
+	return dateTimeFormat(timeZone.toLocal(utc), outputFormat);
+}
+
+size_t Datetime::utcToLocalString(const std::span<char> output, const time_t utc, const TimeZone &timeZone, const std::string_view outputFormat)
+{
+	DATETIME_STATS_SCOPE(utcToLocalStringBufferTimeZone);
+	return dateTimeFormat(output, timeZone.toLocal(utc), outputFormat);
+}
+
 /*
 string Datetime::utcToLocalString(time_t utc, Format format)
 {
@@ -667,6 +4990,10 @@ string Datetime::utcToLocalString(time_t utc, Format format)
 // 2021-02-26T15:41:15.477Z
 int64_t Datetime::sDateMilliSecondsToUtc(std::string sDate)
 {
+	DATETIME_STATS_SCOPE(sDateMilliSecondsToUtc);
+	// fast path per i layout canonici, sscanf resta per gli altri input (i.e. spazi)
+	if (const auto utcInMillisecs = isoMillisecsToUtc(sDate))
+		return *utcInMillisecs;
 
 	unsigned long ulUTCYear;
 	unsigned long ulUTCMonth;
@@ -677,7 +5004,6 @@ int64_t Datetime::sDateMilliSecondsToUtc(std::string sDate)
 	unsigned long ulUTCMilliSeconds;
 	unsigned long ulHourTimeZone;
 	unsigned long ulMinuteTimeZone;
-	tm tmDate;
 	int sscanfReturn;
 
 	char signTimeZone = '+';
@@ -705,6 +5031,7 @@ int64_t Datetime::sDateMilliSecondsToUtc(std::string sDate)
 			", sDate: {}",
 			sDate
 		);
+		DATETIME_STATS_FAILURE(Exception);
 		LOG_ERROR(errorMessage);
 		throw std::runtime_error(errorMessage);
 	}
@@ -729,6 +5056,7 @@ int64_t Datetime::sDateMilliSecondsToUtc(std::string sDate)
 				", sscanfReturn: {}",
 				sDate, sscanfReturn
 			);
+			DATETIME_STATS_FAILURE(Exception);
 			LOG_ERROR(errorMessage);
 			throw std::runtime_error(errorMessage);
 		}
@@ -751,40 +5079,413 @@ int64_t Datetime::sDateMilliSecondsToUtc(std::string sDate)
 				", sscanfReturn: {}",
 				sDate, sscanfReturn
 			);
+			DATETIME_STATS_FAILURE(Exception);
 			LOG_ERROR(errorMessage);
 			throw std::runtime_error(errorMessage);
 		}
 	}
 
+	int64_t utcTime = civilToUtcInSecs(ulUTCYear, ulUTCMonth, ulUTCDay, ulUTCHour, ulUTCMinutes, ulUTCSeconds) * 1000;
+	utcTime += ulUTCMilliSeconds;
+
+	if (signTimeZone == '+')
+		utcTime -= (((ulHourTimeZone * 3600) + (ulMinuteTimeZone * 60)) * 1000);
+	else // if (signTimeZone == '-')
+		utcTime += (((ulHourTimeZone * 3600) + (ulMinuteTimeZone * 60)) * 1000);
+
+	return utcTime;
+}
+
+namespace
+{
+void fillCachedClockSnapshot(Datetime::CachedClock::Snapshot *pSnapshot)
+{
+	const auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+	const int64_t utcInMilliSecs = floor<std::chrono::milliseconds>(sinceEpoch).count();
+	const time_t utcTime = floor<std::chrono::seconds>(sinceEpoch).count();
+	const unsigned milliSecs = utcInMilliSecs - static_cast<int64_t>(utcTime) * 1000;
+
+	pSnapshot->utcInMilliSecs = utcInMilliSecs;
+	pSnapshot->milliSecs = milliSecs;
+	pSnapshot->localTime = Datetime::utcSecondsToLocalTime(utcTime);
+
+	int64_t year;
+	int month;
+	int day;
+	Datetime::civilFromDays(utcTime / 86400, &year, &month, &day);
+	const unsigned secondsOfDay = utcTime % 86400;
+	char *end = writeIsoDateTime(pSnapshot->utcString, year, month, day, 'T', secondsOfDay / 3600, secondsOfDay / 60 % 60, secondsOfDay % 60);
+	*end++ = '.';
+	end = writeDigits(end, milliSecs, 3);
+	*end++ = 'Z';
+	*end = '\0';
+
+	const tm &localTime = pSnapshot->localTime;
+	end = writeIsoDateTime(
+		pSnapshot->localString, localTime.tm_year + 1900, localTime.tm_mon + 1, localTime.tm_mday, ' ', localTime.tm_hour, localTime.tm_min,
+		localTime.tm_sec
+	);
+	*end++ = '.';
+	end = writeDigits(end, milliSecs, 3);
+	*end = '\0';
+}
+
+/*
+	Seqlock: the writer (only the ticker thread) makes sequence odd, updates the words and makes it even again,
+	a reader retries if sequence was odd or changed while it was copying the words.
+	The words are atomics (relaxed) so that the concurrent copy is not a data race.
+*/
+class CachedClockTicker
+{
+  public:
+	~CachedClockTicker() { stop(); }
+
+	void start(const std::chrono::milliseconds tickInterval)
+	{
+		std::lock_guard<std::mutex> locker(_startStopMutex);
+
+		stopTicker();
+
+		publish();
+		_stopRequested.store(false, std::memory_order_relaxed);
+		_ticker = std::thread(
+			[this, tickInterval]()
+			{
+				while (!_stopRequested.load(std::memory_order_relaxed))
+				{
+					std::this_thread::sleep_for(tickInterval);
+					publish();
+				}
+			}
+		);
+		_running.store(true, std::memory_order_release);
+	}
+
+	void stop()
 	{
-		time_t utcTime;
+		std::lock_guard<std::mutex> locker(_startStopMutex);
 
-		time(&utcTime);
-#ifdef _WIN32
-		gmtime_s(&tmDate, &utcTime);
+		stopTicker();
+	}
+
+	bool isRunning() const { return _running.load(std::memory_order_acquire); }
+
+	// false if the clock is not running
+	bool read(Datetime::CachedClock::Snapshot *pSnapshot) const
+	{
+		uint64_t words[snapshotWords];
+		uint64_t sequence;
+		do
+		{
+			sequence = _sequence.load(std::memory_order_acquire);
+			if (sequence == 0)
+				return false;
+			if (sequence & 1)
+				continue;
+			for (size_t index = 0; index < snapshotWords; index++)
+				words[index] = _words[index].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+		} while ((sequence & 1) || _sequence.load(std::memory_order_relaxed) != sequence);
+
+		std::memcpy(pSnapshot, words, sizeof(*pSnapshot));
+		return true;
+	}
+
+	// false if the clock is not running
+	bool readUTCInMilliSecs(int64_t *pUtcInMilliSecs) const
+	{
+		if (!isRunning())
+			return false;
+		*pUtcInMilliSecs = _utcInMilliSecs.load(std::memory_order_relaxed);
+		return true;
+	}
+
+  private:
+	static constexpr size_t snapshotWords = (sizeof(Datetime::CachedClock::Snapshot) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	alignas(64) std::atomic<uint64_t> _sequence{0};
+	std::atomic<uint64_t> _words[snapshotWords]{};
+	alignas(64) std::atomic<int64_t> _utcInMilliSecs{0};
+
+	std::atomic<bool> _running{false};
+	std::atomic<bool> _stopRequested{false};
+	std::mutex _startStopMutex;
+	std::thread _ticker;
+
+	void publish()
+	{
+		uint64_t words[snapshotWords]{};
+		Datetime::CachedClock::Snapshot snapshot;
+		fillCachedClockSnapshot(&snapshot);
+		std::memcpy(words, &snapshot, sizeof(snapshot));
+
+		// sequence 0 means "never published"
+		const uint64_t sequence = _sequence.load(std::memory_order_relaxed);
+		const uint64_t nextSequence = sequence == 0 ? 2 : sequence + 2;
+		_sequence.store(nextSequence - 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t index = 0; index < snapshotWords; index++)
+			_words[index].store(words[index], std::memory_order_relaxed);
+		_sequence.store(nextSequence, std::memory_order_release);
+
+		_utcInMilliSecs.store(snapshot.utcInMilliSecs, std::memory_order_relaxed);
+	}
+
+	void stopTicker()
+	{
+		if (!_ticker.joinable())
+			return;
+
+		_running.store(false, std::memory_order_release);
+		_stopRequested.store(true, std::memory_order_relaxed);
+		_ticker.join();
+		_sequence.store(0, std::memory_order_release);
+	}
+};
+
+CachedClockTicker cachedClockTicker;
+} // namespace
+
+void Datetime::CachedClock::start(const std::chrono::milliseconds tickInterval)
+{
+	if (tickInterval <= std::chrono::milliseconds::zero())
+	{
+		const std::string errorMessage = std::format(
+			"Wrong input"
+			", tickInterval: {}",
+			tickInterval.count()
+		);
+		LOG_ERROR(errorMessage);
+		throw std::runtime_error(errorMessage);
+	}
+
+	cachedClockTicker.start(tickInterval);
+}
+
+void Datetime::CachedClock::stop() { cachedClockTicker.stop(); }
+
+bool Datetime::CachedClock::isRunning() { return cachedClockTicker.isRunning(); }
+
+void Datetime::CachedClock::now(Snapshot *pSnapshot)
+{
+	DATETIME_STATS_SCOPE(cachedClockNow);
+	if (!cachedClockTicker.read(pSnapshot))
+		fillCachedClockSnapshot(pSnapshot);
+}
+
+int64_t Datetime::CachedClock::nowUTCInMilliSecs()
+{
+	DATETIME_STATS_SCOPE(cachedClockNowUTCInMilliSecs);
+	int64_t utcInMilliSecs;
+	if (cachedClockTicker.readUTCInMilliSecs(&utcInMilliSecs))
+		return utcInMilliSecs;
+
+#if defined(CLOCK_REALTIME_COARSE)
+	timespec now{};
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+	return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
 #else
-		gmtime_r(&utcTime, &tmDate);
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 #endif
+}
 
-		tmDate.tm_year = ulUTCYear - 1900;
-		tmDate.tm_mon = ulUTCMonth - 1;
-		tmDate.tm_mday = ulUTCDay;
-		tmDate.tm_hour = ulUTCHour;
-		tmDate.tm_min = ulUTCMinutes;
-		tmDate.tm_sec = ulUTCSeconds;
-	}
+void Datetime::CachedClock::get_tm_LocalTime(tm *ptmDateTime, unsigned long *pulMilliSecs)
+{
+	DATETIME_STATS_SCOPE(cachedClockGetTmLocalTime);
+	Snapshot snapshot;
+	now(&snapshot);
 
+	*ptmDateTime = snapshot.localTime;
+	*pulMilliSecs = snapshot.milliSecs;
+}
+
+namespace
+{
+#if defined(DATETIME_X86_SIMD) && defined(__x86_64__)
+#define DATETIME_FAST_CLOCK_TSC
+#endif
+
+int64_t realtimeNanosecs()
+{
 #ifdef _WIN32
-	int64_t utcTime = _mkgmtime(&tmDate) * 1000;
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 #else
-	int64_t utcTime = timegm(&tmDate) * 1000;
+	timespec now{};
+	clock_gettime(CLOCK_REALTIME, &now);
+	return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
 #endif
-	utcTime += ulUTCMilliSeconds;
+}
 
-	if (signTimeZone == '+')
-		utcTime -= (((ulHourTimeZone * 3600) + (ulMinuteTimeZone * 60)) * 1000);
-	else // if (signTimeZone == '-')
-		utcTime += (((ulHourTimeZone * 3600) + (ulMinuteTimeZone * 60)) * 1000);
+#ifdef DATETIME_FAST_CLOCK_TSC
+/*
+	nanosecs = baseNanosecs + (tsc - baseTsc) * multiplier / 2^32, base is the last (tsc, CLOCK_REALTIME) sample.
+	Seqlock as CachedClockTicker: the thread of the re-sync (the only writer, it holds _resyncMutex)
+	makes sequence odd, updates the words and makes it even again.
+*/
+class FastClockTsc
+{
+  public:
+	FastClockTsc()
+	{
+		unsigned int eax;
+		unsigned int ebx;
+		unsigned int ecx;
+		unsigned int edx;
+		// CPUID.80000007H:EDX[8], invariant TSC: frequenza costante in tutti gli stati e sincronizzato tra i core
+		if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || (edx & (1u << 8)) == 0)
+			return;
+
+		sample(&_syncTsc, &_syncNanosecs);
+		uint64_t tsc;
+		int64_t nanosecs;
+		do
+			sample(&tsc, &nanosecs);
+		while (nanosecs - _syncNanosecs < calibrationNanosecs && nanosecs >= _syncNanosecs);
+		// CLOCK_REALTIME spostato indietro durante la calibrazione: resta clock_gettime
+		if (nanosecs < _syncNanosecs || tsc <= _syncTsc)
+			return;
+
+		const uint64_t multiplier = (static_cast<unsigned __int128>(nanosecs - _syncNanosecs) << 32) / (tsc - _syncTsc);
+		_resyncTicks = static_cast<int64_t>((static_cast<unsigned __int128>(resyncNanosecs) << 32) / multiplier);
+		_syncTsc = tsc;
+		_syncNanosecs = nanosecs;
+		publish(tsc, nanosecs, multiplier);
+		_invariant = true;
+	}
 
-	return utcTime;
+	bool invariant() const { return _invariant; }
+
+	int64_t now()
+	{
+		const uint64_t tsc = __rdtsc();
+		uint64_t baseTsc;
+		int64_t baseNanosecs;
+		uint64_t multiplier;
+		read(&baseTsc, &baseNanosecs, &multiplier);
+
+		// un core può leggere un tsc di poco precedente alla base appena pubblicata: delta negativo
+		const int64_t ticks = static_cast<int64_t>(tsc - baseTsc);
+		if (ticks > _resyncTicks) [[unlikely]]
+		{
+			int64_t nanosecs;
+			if (resync(&nanosecs))
+				return nanosecs;
+		}
+		return baseNanosecs + static_cast<int64_t>((static_cast<__int128>(ticks) * multiplier) >> 32);
+	}
+
+  private:
+	static constexpr int64_t calibrationNanosecs = 2000000;
+	static constexpr int64_t resyncNanosecs = 1000000000;
+
+	alignas(64) std::atomic<uint64_t> _sequence{0};
+	std::atomic<uint64_t> _baseTsc{0};
+	std::atomic<int64_t> _baseNanosecs{0};
+	std::atomic<uint64_t> _multiplier{0};
+
+	bool _invariant = false;
+	int64_t _resyncTicks = std::numeric_limits<int64_t>::max();
+	std::mutex _resyncMutex;
+	// the last sample, written only by the thread of the re-sync
+	uint64_t _syncTsc = 0;
+	int64_t _syncNanosecs = 0;
+
+	// coppia (tsc, CLOCK_REALTIME): il tsc a metà del clock_gettime più breve di alcuni tentativi
+	static void sample(uint64_t *pTsc, int64_t *pNanosecs)
+	{
+		uint64_t bestWidth = std::numeric_limits<uint64_t>::max();
+		for (int attempt = 0; attempt < 5; attempt++)
+		{
+			const uint64_t before = __rdtsc();
+			const int64_t nanosecs = realtimeNanosecs();
+			const uint64_t after = __rdtsc();
+			if (attempt == 0 || after - before < bestWidth)
+			{
+				bestWidth = after - before;
+				*pTsc = before + (after - before) / 2;
+				*pNanosecs = nanosecs;
+			}
+		}
+	}
+
+	bool resync(int64_t *pNanosecs)
+	{
+		std::unique_lock<std::mutex> locker(_resyncMutex, std::try_to_lock);
+		if (!locker.owns_lock())
+			return false;
+
+		uint64_t tsc;
+		int64_t nanosecs;
+		sample(&tsc, &nanosecs);
+		// un altro thread ha già risincronizzato
+		if (static_cast<int64_t>(tsc - _syncTsc) <= _resyncTicks)
+			return false;
+
+		// la frequenza dell'ultimo intervallo, salvo un salto di CLOCK_REALTIME (più dell'1% dalla precedente)
+		uint64_t multiplier = _multiplier.load(std::memory_order_relaxed);
+		if (nanosecs > _syncNanosecs)
+		{
+			const uint64_t measured = (static_cast<unsigned __int128>(nanosecs - _syncNanosecs) << 32) / (tsc - _syncTsc);
+			if (measured > multiplier - multiplier / 100 && measured < multiplier + multiplier / 100)
+				multiplier = measured;
+		}
+		_syncTsc = tsc;
+		_syncNanosecs = nanosecs;
+		publish(tsc, nanosecs, multiplier);
+
+		*pNanosecs = nanosecs;
+		return true;
+	}
+
+	void publish(const uint64_t tsc, const int64_t nanosecs, const uint64_t multiplier)
+	{
+		const uint64_t sequence = _sequence.load(std::memory_order_relaxed);
+		_sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		_baseTsc.store(tsc, std::memory_order_relaxed);
+		_baseNanosecs.store(nanosecs, std::memory_order_relaxed);
+		_multiplier.store(multiplier, std::memory_order_relaxed);
+		_sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	void read(uint64_t *pTsc, int64_t *pNanosecs, uint64_t *pMultiplier) const
+	{
+		uint64_t sequence;
+		do
+		{
+			sequence = _sequence.load(std::memory_order_acquire);
+			*pTsc = _baseTsc.load(std::memory_order_relaxed);
+			*pNanosecs = _baseNanosecs.load(std::memory_order_relaxed);
+			*pMultiplier = _multiplier.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+		} while ((sequence & 1) || _sequence.load(std::memory_order_relaxed) != sequence);
+	}
+};
+
+// calibrato alla prima chiamata
+FastClockTsc &fastClockTsc()
+{
+	static FastClockTsc tsc;
+	return tsc;
+}
+#endif
+} // namespace
+
+Datetime::FastClock::time_point Datetime::FastClock::now() noexcept
+{
+	DATETIME_STATS_SCOPE(fastClockNow);
+#ifdef DATETIME_FAST_CLOCK_TSC
+	if (FastClockTsc &tsc = fastClockTsc(); tsc.invariant())
+		return time_point(duration(tsc.now()));
+#endif
+	return time_point(duration(realtimeNanosecs()));
+}
+
+bool Datetime::FastClock::usesTsc() noexcept
+{
+#ifdef DATETIME_FAST_CLOCK_TSC
+	return fastClockTsc().invariant();
+#else
+	return false;
+#endif
 }
@@ -21,8 +21,15 @@
 
 #pragma once
 
+#include <array>
 #include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <expected>
+#include <span>
 #include <string>
+#include <string_view>
+#include <vector>
 
 class Datetime
 {
@@ -35,6 +42,196 @@ public:
 	};
 	*/
   public:
+	/**
+		Precision of the formatted and parsed times: the time is truncated to it,
+		Millis, Micros and Nanos render the seconds with 3, 6 and 9 fraction digits,
+		Native with the digits of the system_clock precision.
+	*/
+	enum class Precision : uint8_t
+	{
+		Days,
+		Hours,
+		Minutes,
+		Seconds,
+		Millis,
+		Micros,
+		Nanos,
+		Native
+	};
+
+	/**
+		The string precisions of the older overloads: days, hours, minutes, seconds, millis (milliseconds),
+		micros (microseconds), nanos (nanoseconds). "millis" is Native, as it has always been
+		(std::format of the system_clock time_point). Throws if the string is not one of them.
+	*/
+	static Precision precisionFromString(std::string_view outputPrecision);
+
+	/**
+		outputFormat and outputPrecision of dateTimeFormat compiled once in a plan:
+		format does not parse the format string nor compare the precision at every call.
+		Specifiers: %Y %y %m %d %j %H %M %S %F %T %R %Z %z %n %t %% are rendered by the plan,
+		the other ones (i.e. %a, %b, %E..., %O...) by std::vformat (parsed at every call).
+	*/
+	class Formatter
+	{
+	  public:
+		explicit Formatter(std::string_view outputFormat = "%Y-%m-%dT%H:%M:%SZ", Precision outputPrecision = Precision::Seconds);
+		Formatter(std::string_view outputFormat, std::string_view outputPrecision);
+
+		std::string format(const std::chrono::system_clock::time_point &timePoint) const;
+		std::string format(uint64_t milliSecondsSinceEpoch) const;
+
+		/**
+			Write into output, no allocation for the specifiers rendered by the plan.
+			Returns the number of chars written (no terminating NUL),
+			throws if output is too small.
+		*/
+		size_t format(std::span<char> output, const std::chrono::system_clock::time_point &timePoint) const;
+		size_t format(std::span<char> output, uint64_t milliSecondsSinceEpoch) const;
+
+		/**
+			Appends the milliSecondsSinceEpoch to an Arrow string column (utf8 layout):
+			the rendered values are concatenated in chars and offsets gets the end of each one
+			(if offsets is empty, the start of the first one is added before).
+			The values are expected sorted (not required): like an odometer, only the fields
+			changed since the previous value are computed and rendered again (the date only
+			when the day changes, hours and minutes when the minute changes), the others are
+			kept from the previous row. No allocation per value beyond the growth of chars and offsets.
+			Throws if chars goes over the int32 offsets.
+		*/
+		void formatColumn(std::span<const uint64_t> milliSecondsSinceEpoch, std::string &chars, std::vector<int32_t> &offsets) const;
+
+	  private:
+		enum class Field : uint8_t
+		{
+			Literal,
+			Year,
+			YearOfCentury,
+			Month,
+			Day,
+			DayOfYear,
+			Hour,
+			Minute,
+			Second
+		};
+
+		struct Step
+		{
+			Field field;
+			uint32_t literalOffset;
+			uint32_t literalLength;
+			// position of the step in the rendered string (every field has a fixed width)
+			uint32_t outputOffset;
+		};
+
+		Precision _precision;
+		// digits after the seconds, 0 if the precision is Seconds or coarser
+		uint8_t _fractionDigits;
+		std::vector<Step> _steps;
+		std::string _literals;
+		size_t _maxLength;
+		// length of the strings rendered by the plan
+		size_t _length;
+		// "{:<outputFormat>}", used by std::vformat when the plan cannot render the format or the time point
+		std::string _vformatFormat;
+		bool _planned;
+
+		void addLiteral(std::string_view literal);
+		void addField(Field field, size_t maxLength);
+		std::string vformat(const std::chrono::system_clock::time_point &timePoint) const;
+		// returns 0 if the plan cannot render the time point (year out of 0-9999)
+		size_t render(const std::chrono::system_clock::time_point &timePoint, char *output) const;
+	};
+
+	/**
+		Opt-in coarse clock for threads stamping many events.
+		Once started, a background thread refreshes every tickInterval the UTC milliseconds,
+		the broken-down local time and the UTC/local strings. The readers get them
+		through a seqlock: no syscall and no lock, the accuracy is tickInterval.
+		If the clock is not running, the readers compute the values by themselves
+		(nowUTCInMilliSecs uses CLOCK_REALTIME_COARSE on Linux).
+	*/
+	class CachedClock
+	{
+	  public:
+		struct Snapshot
+		{
+			int64_t utcInMilliSecs;
+			tm localTime;
+			unsigned long milliSecs;
+			// 2021-02-26T15:41:15.765Z
+			char utcString[25];
+			// 2021-02-26 15:41:15.765
+			char localString[24];
+		};
+
+		// start (or restart with a new tickInterval) the background thread
+		static void start(std::chrono::milliseconds tickInterval = std::chrono::milliseconds(1));
+		static void stop();
+		static bool isRunning();
+
+		static void now(Snapshot *pSnapshot);
+		static int64_t nowUTCInMilliSecs();
+		static void get_tm_LocalTime(tm *ptmDateTime, unsigned long *pulMilliSecs);
+	};
+
+	/**
+		Wall clock (the epoch and the time of system_clock) in nanoseconds read from the invariant TSC,
+		a std::chrono Clock: FastClock::now() is an rdtsc plus a multiplication, no syscall/vDSO.
+		The TSC is calibrated against CLOCK_REALTIME at the first call (about 2 ms) and re-synchronized
+		once a second by the first now() after it (the drift is bounded by the error of a second):
+		a re-sync can move the clock by that error, also backward, so it is not steady.
+		Without an invariant TSC (cpuid) or out of x86-64 now() is clock_gettime(CLOCK_REALTIME).
+		time_point is a system_clock time_point in nanoseconds, the system_clock::time_point itself
+		with libstdc++: it goes to dateTimeFormat(time_point, ...) and timePointAsUtcString as it is.
+	*/
+	class FastClock
+	{
+	  public:
+		using duration = std::chrono::nanoseconds;
+		using rep = duration::rep;
+		using period = duration::period;
+		using time_point = std::chrono::time_point<std::chrono::system_clock, duration>;
+		static constexpr bool is_steady = false;
+
+		static time_point now() noexcept;
+		// false: the fallback on clock_gettime
+		static bool usesTsc() noexcept;
+	};
+
+	/**
+		IANA time zone (i.e. Europe/Rome) read from the local tzdata files (TZDIR or /usr/share/zoneinfo),
+		independent from TZ and from the process local zone, no tzset is needed.
+		locate memory-maps and parses the TZif file once and interns the zone for the whole process:
+		the next lookups of the same name are a hash hit. The handle is cheap to copy.
+		locate throws if the zone does not exist or its file is not supported.
+	*/
+	class TimeZone
+	{
+	  public:
+		static TimeZone locate(std::string_view name);
+
+		const std::string &name() const;
+		// seconds east of UTC at utcTime
+		int32_t utcOffset(time_t utcTime) const;
+		tm toLocal(time_t utcTime) const;
+		/**
+			Local date time to UTC, the fields are normalized as mktime does.
+			For an ambiguous local time (end of the DST) tm_isdst 0/1 chooses the offset,
+			-1 the first one. A local time skipped by the start of the DST is shifted forward.
+		*/
+		time_t toUtc(const tm &localTime) const;
+
+	  private:
+		// the bulk functions use the table directly
+		friend class Datetime;
+
+		struct Table;
+		const Table *_table;
+
+		explicit TimeZone(const Table *table) : _table(table) {}
+	};
+
 	static std::string dateTimeFormat(uint64_t milliSecondsSinceEpoch,
 		const std::string& outputFormat = "%Y-%m-%dT%H:%M:%SZ",
 		const std::string& outputPrecision = "seconds");
@@ -42,12 +239,154 @@ public:
 		const std::string& outputFormat = "%Y-%m-%dT%H:%M:%SZ",
 		const std::string& outputPrecision = "seconds");
 	static std::string dateTimeFormat(const tm &tm, const std::string& outputFormat = "%Y-%m-%dT%H:%M:%S");
+	// the string precision overloads above are shims of these ones
+	static std::string dateTimeFormat(uint64_t milliSecondsSinceEpoch, std::string_view outputFormat, Precision outputPrecision);
+	static std::string dateTimeFormat(const std::chrono::system_clock::time_point& timePoint, std::string_view outputFormat,
+		Precision outputPrecision);
+
+	/**
+		The following overloads write into the caller buffer (output) instead of returning a std::string.
+		They return the number of chars written (no terminating NUL), do not allocate
+		and throw if output is too small.
+	*/
+	static size_t dateTimeFormat(std::span<char> output, uint64_t milliSecondsSinceEpoch,
+		std::string_view outputFormat = "%Y-%m-%dT%H:%M:%SZ", std::string_view outputPrecision = "seconds");
+	static size_t dateTimeFormat(std::span<char> output, const std::chrono::system_clock::time_point& timePoint,
+		std::string_view outputFormat = "%Y-%m-%dT%H:%M:%SZ", std::string_view outputPrecision = "seconds");
+	static size_t dateTimeFormat(std::span<char> output, const tm &tm, std::string_view outputFormat = "%Y-%m-%dT%H:%M:%S");
+	static size_t dateTimeFormat(std::span<char> output, uint64_t milliSecondsSinceEpoch, std::string_view outputFormat,
+		Precision outputPrecision);
+	static size_t dateTimeFormat(std::span<char> output, const std::chrono::system_clock::time_point& timePoint,
+		std::string_view outputFormat, Precision outputPrecision);
+	static size_t timePointAsLocalString(std::span<char> output, std::chrono::system_clock::time_point t);
+	static size_t timePointAsUtcString(std::span<char> output, std::chrono::system_clock::time_point t);
+	static size_t nowLocalTime(std::span<char> output, std::string_view outputFormat = "%Y-%m-%dT%H:%M:%S", bool milliSeconds = false);
+	static size_t utcToUtcString(std::span<char> output, time_t utc, std::string_view outputFormat = "%Y-%m-%dT%H:%M:%SZ",
+		std::string_view outputPrecision = "seconds");
+	static size_t utcToUtcString(std::span<char> output, time_t utc, std::string_view outputFormat, Precision outputPrecision);
+	static size_t utcToLocalString(std::span<char> output, time_t utc, std::string_view outputFormat = "%Y-%m-%dT%H:%M:%S");
+
+	/**
+		Batch version of dateTimeFormat for the exporters: the sorted milliSecondsSinceEpoch
+		are appended to the Arrow string column chars/offsets (see Formatter::formatColumn).
+	*/
+	static void dateTimeFormatColumn(std::span<const uint64_t> milliSecondsSinceEpoch, std::string &chars, std::vector<int32_t> &offsets,
+		std::string_view outputFormat = "%Y-%m-%dT%H:%M:%SZ", Precision outputPrecision = Precision::Seconds);
 
 	static std::string timePointAsLocalString(std::chrono::system_clock::time_point t);
 	static std::string timePointAsUtcString(std::chrono::system_clock::time_point t);
 	static std::string localToUtcString(tm localTime);
 	static tm utcSecondsToLocalTime(time_t utcTime);
 
+	/**
+		The same conversions in timeZone instead of the process local zone
+	*/
+	static tm utcSecondsToLocalTime(time_t utcTime, const TimeZone &timeZone);
+	static void convertFromUTCToLocal(time_t tUTCTime, const TimeZone &timeZone, tm *ptmLocalDateTime);
+	static time_t localToUTC(const tm &localTime, const TimeZone &timeZone);
+	static std::string timePointAsLocalString(std::chrono::system_clock::time_point t, const TimeZone &timeZone);
+	static size_t timePointAsLocalString(std::span<char> output, std::chrono::system_clock::time_point t, const TimeZone &timeZone);
+	static std::string utcToLocalString(time_t utc, const TimeZone &timeZone, const std::string& outputFormat = "%Y-%m-%dT%H:%M:%S");
+	static size_t utcToLocalString(std::span<char> output, time_t utc, const TimeZone &timeZone,
+		std::string_view outputFormat = "%Y-%m-%dT%H:%M:%S");
+
+	/**
+		The UTC -> local conversions (convertFromUTCToLocal, utcSecondsToLocalTime, utcToLocalString,
+		timePointAsLocalString, TimeZone::toLocal, ...) cache per thread, for the last UTC days,
+		the local dates and the offsets of the day (two for a DST transition day):
+		a time in a cached day is converted by a division and a remainder.
+		The cache is direct mapped on the UTC day, days is its size per thread (default 64, 0 disables it).
+		The hits/misses are the sum of all the threads, updated every 1024 lookups of a thread
+		(exact for the calling thread).
+	*/
+	struct LocalDayCacheStats
+	{
+		uint64_t hits;
+		uint64_t misses;
+	};
+	static void setLocalDayCacheSize(size_t days);
+	static LocalDayCacheStats localDayCacheStats();
+
+	/**
+		Counters of the public functions (conversions, parsers, formatters, clocks; not the configuration ones),
+		compiled only if the library is built with DATETIME_STATS (CMake option of the same name):
+		without it the functions have no instrumentation at all and stats() returns enabled false and no function.
+		Every thread updates its own shard (no lock, no read-modify-write), stats() merges the shards
+		of the running threads with the counters of the terminated ones.
+		The calls and the failures are all counted, the latency is measured one call every everyCalls
+		of setStatsSampling (default 16, 1 measures all of them): reading the clock costs more than the counters.
+		A function calling another public one is counted by both (i.e. getTimeZoneInformation()).
+	*/
+	enum class StatsFailure : uint8_t
+	{
+		// ParseErrorKind of the try* parsers
+		Length,
+		Digit,
+		Separator,
+		Range,
+		Format,
+		Rejected, // parseIsoUtcInSecs/parseIsoUtcInMillisecs returned false or sTimeToMilliSecs -1
+		Exception // the function threw
+	};
+	static constexpr size_t statsFailureReasons = 7;
+	static constexpr size_t statsLatencyBuckets = 32;
+
+	struct FunctionStats
+	{
+		// i.e. "dateTimeFormat (buffer ms)"
+		const char *name;
+		uint64_t calls;
+		uint64_t failures;
+		// indexed by StatsFailure
+		std::array<uint64_t, statsFailureReasons> failuresByReason;
+		// calls whose latency was measured
+		uint64_t latencySamples;
+		// latencyHistogram[0]: samples shorter than 1 tick, [i]: samples lasting [2^(i-1), 2^i) ticks, the last one collects the longer ones
+		std::array<uint64_t, statsLatencyBuckets> latencyHistogram;
+		// sum of the samples, sampledNanosecs / latencySamples is the average latency
+		double sampledNanosecs;
+	};
+
+	struct Stats
+	{
+		bool enabled;
+		// ticks of latencyHistogram to nanoseconds (TSC on x86, steady_clock nanoseconds elsewhere)
+		double nanosecsPerTick;
+		// only the functions called at least once
+		std::vector<FunctionStats> functions;
+		LocalDayCacheStats localDayCache;
+	};
+	static Stats stats();
+	static void setStatsSampling(uint32_t everyCalls);
+	static const char *statsFailureName(StatsFailure failure) noexcept;
+
+	enum class Bucket : uint8_t
+	{
+		Minute,
+		Hour,
+		Day,
+		IsoWeek, // starts on Monday
+		Month
+	};
+
+	/**
+		Bulk local time bucketing for the aggregations, in the process local zone or in timeZone.
+		For every utcInMillisecs[i] (epoch milliseconds, sorted or not: the sorted ones are faster):
+			- bucketStartsInMillisecs[i]: UTC epoch milliseconds of the local start of its bucket
+				(for a bucket starting in a skipped local time, the end of the gap)
+			- isoWeeks[i]: ISO 8601 week number (1-53) of its local date
+			- daysOfYear[i]: day of the year (1-366) of its local date
+			- weekDays[i]: day of the week of its local date, 0 Sunday, as tm_wday
+		The empty outputs are skipped, the others have to be as big as utcInMillisecs (otherwise it throws).
+		The offsets come from the time zone table: there is a lookup only when a value leaves
+		the offset interval of the previous one, and no localtime_r/mktime per value.
+	*/
+	static void localBuckets(std::span<const int64_t> utcInMillisecs, Bucket bucket, std::span<int64_t> bucketStartsInMillisecs,
+		std::span<uint8_t> isoWeeks = {}, std::span<uint16_t> daysOfYear = {}, std::span<uint8_t> weekDays = {});
+	static void localBuckets(std::span<const int64_t> utcInMillisecs, const TimeZone &timeZone, Bucket bucket,
+		std::span<int64_t> bucketStartsInMillisecs, std::span<uint8_t> isoWeeks = {}, std::span<uint16_t> daysOfYear = {},
+		std::span<uint8_t> weekDays = {});
+
 	/**
 		The plTimeZoneDifferenceInHours parameter could be also NULL,
 		in that case the variable is not initialized.
@@ -70,10 +409,35 @@ public:
 	static string nowLocalTime(unsigned long ulTextFormat);
 	*/
 
+	/**
+		Current UTC offset (DST included) of the process local zone in hours, truncated toward zero:
+		utcOffsetInMinutes for the zones that are not whole hours (+05:30, +05:45).
+	*/
 	static void getTimeZoneInformation(long *plTimeZoneDifferenceInHours);
 
 	static long getTimeZoneInformation(void);
 
+	/**
+		Current UTC offset of the process local zone in minutes east of UTC (330 for Asia/Kolkata).
+		The offset is cached with its validity, up to the next transition of the zone: while it is valid
+		a read is an atomic load (plus time()), no gettimeofday/localtime_r.
+		getTimeZoneInformation, nowUTCInMilliSecs(..., plTimeZoneDifferenceInHours), nowLocalInMilliSecs
+		and convertFromLocalDateTimeToLocalInSecs read the same cache.
+	*/
+	static int32_t utcOffsetInMinutes();
+
+	/**
+		The process local zone (TZ or /etc/localtime) is read once: reloadLocalTimeZone reads it again
+		(and calls tzset), invalidating the cached offset, the local day cache and the cached local strings.
+		startLocalTimeZoneWatch starts a thread that reloads it when /etc/localtime changes
+		(inotify, Linux only: it throws on the other platforms), stopLocalTimeZoneWatch stops it.
+		The tables of the previous zones are kept, the tm_zone already returned stay valid.
+	*/
+	static void reloadLocalTimeZone();
+	static void startLocalTimeZoneWatch();
+	static void stopLocalTimeZoneWatch();
+	static bool isLocalTimeZoneWatchRunning();
+
 	static void get_tm_LocalTime(tm *ptmDateTime, unsigned long *pulMilliSecs);
 
 	/**
@@ -132,6 +496,8 @@ public:
 			- 0: DaylightSavingTime NO present for the input time (ulSrcYear, ...)
 			- 1: DaylightSavingTime present for the input time (ulSrcYear, ...)
 			- -1: information about DaylightSavingTime not available
+		It only chooses the offset of an ambiguous time (end of the DST),
+		the conversions do not use mktime/localtime_r (see addSeconds(CivilDateTime)).
 		The output pointers parameters (pulDestYear, pulDestMonth, ...)
 		could be also the same addresses of the input parameters
 		(ulSrcYear, ulSrcMonth, ...)
@@ -142,17 +508,370 @@ public:
 		unsigned long *pulDay, unsigned long *pulHour, unsigned long *pulMinutes, unsigned long *pulSeconds, bool *pbDaylightSavingTime
 	);
 
+	/**
+		Compact local date time of the calendar arithmetic below (month 1-12, day 1-31).
+		isDst is as tm_isdst: 0/1 chooses the offset of an ambiguous time (end of the DST), -1 unknown.
+		The results have isDst 0 or 1.
+	*/
+	struct CivilDateTime
+	{
+		int32_t year;
+		uint8_t month;
+		uint8_t day;
+		uint8_t hour;
+		uint8_t minute;
+		uint8_t second;
+		int8_t isDst = -1;
+
+		bool operator==(const CivilDateTime &) const = default;
+	};
+
+	/**
+		How addDays/addMonths resolve a local time that the DST skips (gap) or repeats (ambiguous):
+			Compatible:	gap: shifted forward by the gap (as mktime), ambiguous: the earlier instant
+			Earlier:	gap: shifted backward by the gap, ambiguous: the earlier instant
+			Later:		gap: shifted forward by the gap, ambiguous: the later instant
+			Reject:		throws in both cases
+	*/
+	enum class DstPolicy : uint8_t
+	{
+		Compatible,
+		Earlier,
+		Later,
+		Reject
+	};
+
+	/**
+		Calendar arithmetic in the process local zone or in timeZone, without mktime/localtime_r
+		(the offsets come from the cached zone table).
+		addSeconds adds elapsed seconds (an hour across a DST change is an hour).
+		addDays and addMonths move the wall clock: same time of the day, the day of addMonths is
+		clamped to the last day of the month (2024-01-31 + 1 month is 2024-02-29),
+		the result is resolved by dstPolicy.
+		They throw if a field is out of range.
+	*/
+	static CivilDateTime addSeconds(const CivilDateTime &dateTime, int64_t seconds);
+	static CivilDateTime addSeconds(const CivilDateTime &dateTime, int64_t seconds, const TimeZone &timeZone);
+	static CivilDateTime addDays(const CivilDateTime &dateTime, int64_t days, DstPolicy dstPolicy = DstPolicy::Compatible);
+	static CivilDateTime addDays(const CivilDateTime &dateTime, int64_t days, const TimeZone &timeZone, DstPolicy dstPolicy = DstPolicy::Compatible);
+	static CivilDateTime addMonths(const CivilDateTime &dateTime, int64_t months, DstPolicy dstPolicy = DstPolicy::Compatible);
+	static CivilDateTime addMonths(
+		const CivilDateTime &dateTime, int64_t months, const TimeZone &timeZone, DstPolicy dstPolicy = DstPolicy::Compatible
+	);
+
+	/**
+		Compiled recurring local time rule of a schedule: every day, on some week days or on some
+		month days at hour:minute of the process local zone or of timeZone.
+		The occurrences are computed on the cached zone table (no mktime/localtime_r): the offset of
+		the last occurrence is reused until the next transition, only the occurrences near a transition
+		go through the DST resolution of addDays. A local time skipped or repeated by the DST is resolved
+		by dstPolicy as addDays does, except Reject that drops the occurrence instead of throwing.
+		The constructors throw if the rule is not valid (fields out of range, no week/month day).
+	*/
+	class Recurrence
+	{
+	  public:
+		enum class Frequency : uint8_t
+		{
+			Daily,
+			Weekly,
+			Monthly
+		};
+
+		struct Rule
+		{
+			Frequency frequency = Frequency::Daily;
+			uint8_t hour = 0;
+			uint8_t minute = 0;
+			// Weekly: bit i is the week day i (0 sunday, as tm_wday)
+			uint8_t weekDays = 0;
+			// Monthly: bit i is the day i (1-31) of the month, bit 0 the last day of the month.
+			// A day missing in a month (i.e. 31) is skipped, as the RFC 5545 BYMONTHDAY
+			uint32_t monthDays = 0;
+			DstPolicy dstPolicy = DstPolicy::Compatible;
+		};
+
+		// the process local zone, read at every call
+		explicit Recurrence(const Rule &rule);
+		Recurrence(const Rule &rule, const TimeZone &timeZone);
+
+		const Rule &rule() const { return _rule; }
+
+		// the first occurrence after afterUtcInMilliSecs (excluded), in epoch milliseconds
+		int64_t next(int64_t afterUtcInMilliSecs) const;
+		// the first occurrences.size() occurrences after afterUtcInMilliSecs (excluded), in increasing order
+		void next(int64_t afterUtcInMilliSecs, std::span<int64_t> occurrences) const;
+		/**
+			Batch version for the schedules of many channels: the count occurrences of recurrences[i]
+			go to occurrences[i * count, (i + 1) * count), it throws if occurrences is too small.
+			The rules of the same zone share the offset interval, as the occurrences of a single rule do.
+		*/
+		static void next(std::span<const Recurrence> recurrences, int64_t afterUtcInMilliSecs, size_t count, std::span<int64_t> occurrences);
+
+	  private:
+		Rule _rule;
+		// nullptr: the process local zone
+		const TimeZone::Table *_timeZone;
+	};
+
 	static void isLeapYear(unsigned long ulYear, bool *pbIsLeapYear);
 
 	static void getLastDayOfMonth(unsigned long ulYear, unsigned long ulMonth, unsigned long *pulLastDayOfMonth);
 
+	/**
+		constexpr proleptic gregorian calendar (http://howardhinnant.github.io/date_algorithms.html)
+		shared by all the UTC conversions in place of timegm/gmtime_r, usable in static_assert too.
+		Days are counted from 1970-01-01, month is 1-12, weekDay 0 is sunday.
+	*/
+	static constexpr bool isLeapYear(int64_t year) noexcept { return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0); }
+
+	static constexpr int getLastDayOfMonth(int64_t year, int month) noexcept
+	{
+		return month == 2 ? 28 + isLeapYear(year) : 30 + ((month + month / 8) & 1);
+	}
+
+	// it is linear in day, so out of range days are normalized as timegm does
+	static constexpr int64_t daysFromCivil(int64_t year, int month, int day) noexcept
+	{
+		year -= month <= 2;
+		const int64_t era = (year >= 0 ? year : year - 399) / 400;
+		const int64_t yoe = year - era * 400;
+		const int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+		const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+		return era * 146097 + doe - 719468;
+	}
+
+	static constexpr void civilFromDays(int64_t days, int64_t *pYear, int *pMonth, int *pDay) noexcept
+	{
+		days += 719468;
+		const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+		const int64_t doe = days - era * 146097;
+		const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+		const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+		const int64_t mp = (5 * doy + 2) / 153;
+		*pDay = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+		*pMonth = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+		*pYear = yoe + era * 400 + (*pMonth <= 2);
+	}
+
+	// 1970-01-01 was a thursday
+	static constexpr int weekDayFromDays(int64_t days) noexcept { return static_cast<int>(days >= -4 ? (days + 4) % 7 : (days + 5) % 7 + 6); }
+
+	/**
+		timegm: UTC fields to seconds since epoch, the out of range fields
+		(i.e. month 13, second 60) are normalized as timegm does
+	*/
+	static constexpr int64_t civilToUtcInSecs(int64_t year, int month, int day, int hour, int minute, int second) noexcept
+	{
+		year += (month - 1) / 12;
+		month = (month - 1) % 12;
+		if (month < 0)
+		{
+			year--;
+			month += 12;
+		}
+		return (daysFromCivil(year, month + 1, 1) + day - 1) * 86400 + static_cast<int64_t>(hour) * 3600 + static_cast<int64_t>(minute) * 60 + second;
+	}
+
+	// HH:MM, the same results as sscanf("%2d:%2d"); parseDuration for the other layouts
 	static long sTimeToMilliSecs(std::string sTime);
 	static time_t parseStringToUtcInSecs(const std::string &datetime, const std::string& inputFormat = "%Y-%m-%dT%H:%M:%SZ");
 	static int64_t parseUtcStringToUtcInMillisecs(const std::string &datetime);
 	static int64_t sDateMilliSecondsToUtc(std::string sDate);
+
+	/**
+		Allocation-free parsers for the fixed ISO layouts:
+			parseIsoUtcInSecs:		2021-02-26T15:41:15Z
+			parseIsoUtcInMillisecs:	2021-02-26T15:41:15.765Z
+		They do not use streams, locale or libc. They return false,
+		without logging or throwing, if datetime does not match the layout.
+	*/
+	static bool parseIsoUtcInSecs(std::string_view datetime, time_t *pUtcInSecs) noexcept;
+	static bool parseIsoUtcInMillisecs(std::string_view datetime, int64_t *pUtcInMillisecs) noexcept;
+
+	enum class ParseErrorKind : uint8_t
+	{
+		Length,	   // the input does not have the length of the layout
+		Digit,	   // a digit was expected at position
+		Separator, // a separator ('-', 'T', ':', '.', 'Z', '+'/'-') was expected at position
+		Range,	   // the field starting at position is out of range (i.e. month 13)
+		Format	   // get_time did not match inputFormat, position is where it stopped
+	};
+
+	struct ParseError
+	{
+		ParseErrorKind kind;
+		size_t position;
+	};
+
+	/**
+		Optional log of the errors of the try* functions, called by the parsing thread.
+		It must not throw. nullptr (the default) disables it, i.e.:
+			Datetime::setParseErrorCallback([](std::string_view function, std::string_view input, const Datetime::ParseError &error) {
+				LOG_ERROR("{} failed, input: {}, error: {} at {}", function, input, Datetime::parseErrorKindName(error.kind), error.position);
+			});
+	*/
+	using ParseErrorCallback = void (*)(std::string_view function, std::string_view input, const ParseError &error);
+	static void setParseErrorCallback(ParseErrorCallback callback) noexcept;
+	static const char *parseErrorKindName(ParseErrorKind kind) noexcept;
+
+	/**
+		noexcept variants of parseStringToUtcInSecs, sDateMilliSecondsToUtc, iso8610ToUtc and getLastDayOfMonth
+		for the bulk validation: a malformed input costs as a good one, no exception and no LOG_ERROR,
+		the error kind and its position in the input are returned (position is 0 for tryGetLastDayOfMonth).
+		The ISO layouts are parsed without libc and only in their canonical form (no spaces, 2 digits fields),
+		the other inputFormat by get_time.
+	*/
+	static std::expected<int64_t, ParseError> tryParseStringToUtcInSecs(
+		std::string_view datetime, std::string_view inputFormat = "%Y-%m-%dT%H:%M:%SZ"
+	) noexcept;
+	static std::expected<int64_t, ParseError> trySDateMilliSecondsToUtc(std::string_view sDate) noexcept;
+	static std::expected<int64_t, ParseError> tryIso8610ToUtc(std::string_view datetime, bool millisecondsPrecision = false) noexcept;
+	static std::expected<int64_t, ParseError> tryGetLastDayOfMonth(int64_t year, int64_t month) noexcept;
+
+	/**
+		Single pass ISO 8601 / RFC 3339 parser, returns the nanoseconds since epoch:
+			YYYY-MM-DD(T|t| )HH:MM:SS[(.|,)fraction][Z|z|(+|-)HH[:]MM]
+		fraction has 1 to 9 digits, without the offset the time is UTC.
+		It covers the inputs of parseUtcStringToUtcInMillisecs, sDateMilliSecondsToUtc and iso8610ToUtc,
+		does not allocate and reports the errors as the try* functions (the time has to fit in int64_t nanoseconds,
+		years 1677-2262).
+	*/
+	static std::expected<int64_t, ParseError> parseIso8601ToUtcInNanosecs(std::string_view datetime) noexcept;
+	/**
+		The same parser returning the time since epoch in the unit of precision
+		(i.e. Micros: microseconds, Days: days), the fraction digits finer than precision are truncated.
+		The range is the int64_t of the unit (years 1677-2262 only for Nanos).
+	*/
+	static std::expected<int64_t, ParseError> parseIso8601ToUtc(std::string_view datetime, Precision precision) noexcept;
+
+	enum class DurationFormat : uint8_t
+	{
+		Clock,	// [-]HH:MM[:SS[.fraction]], the hours have 2 digits at least
+		Iso8601 // [-]PT1H30M5.5S, the hours are not folded in days
+	};
+
+	/**
+		Allocation-free duration parser (no sscanf, no locale), the errors are reported as the try* functions:
+			clock:		[-]H...:MM[:SS[(.|,)fraction]]				i.e. 1:30, 01:30:05.500 (minutes and seconds 00-59)
+			ISO 8601:	[-]P[nW|nD][T[nH][nM][n[(.|,)fraction]S]]	i.e. PT1H30M5.5S, P1DT2H (a day is 24 hours)
+		fraction has 1 to 9 digits and only the seconds have it. Years and months (not fixed lengths)
+		are not accepted. The duration has to fit in int64_t nanoseconds (about 292 years).
+	*/
+	static std::expected<std::chrono::nanoseconds, ParseError> parseDuration(std::string_view duration) noexcept;
+	/**
+		Writes duration truncated to precision:
+			Clock: HH:MM for Minutes and coarser, HH:MM:SS for Seconds, plus 3/6/9 fraction digits
+				for Millis/Micros/Nanos (Native: the digits of the system_clock)
+			Iso8601: only the components different from 0 (PT0S for 0), the fraction without trailing zeros
+		Returns the number of chars written (no terminating NUL), throws if output is too small
+		(64 chars are always enough).
+	*/
+	static size_t formatDuration(
+		std::span<char> output, std::chrono::nanoseconds duration, DurationFormat format = DurationFormat::Clock, Precision precision = Precision::Millis
+	);
+	static std::string formatDuration(
+		std::chrono::nanoseconds duration, DurationFormat format = DurationFormat::Clock, Precision precision = Precision::Millis
+	);
+	/**
+		Column variants, in the Arrow string layout of Formatter::formatColumn (the i-th string is
+		chars[offsets[i], offsets[i + 1]), offsets has a row more than durations).
+		parseDurationColumn sets durations[i] and valid[i] to 1, or to 0 and 0 if the string is malformed,
+		and returns the number of valid rows; it throws if offsets is out of chars or the output spans are too small.
+		formatDurationColumn appends to chars and offsets as formatColumn does.
+	*/
+	static size_t parseDurationColumn(
+		std::string_view chars, std::span<const int32_t> offsets, std::span<std::chrono::nanoseconds> durations, std::span<uint8_t> valid
+	);
+	static void formatDurationColumn(
+		std::span<const std::chrono::nanoseconds> durations, std::string &chars, std::vector<int32_t> &offsets,
+		DurationFormat format = DurationFormat::Clock, Precision precision = Precision::Millis
+	);
+
+	/**
+		Batch parser for a column of fixed width timestamps, fieldWidth could be:
+			- 24: 2021-02-26T15:41:15.765Z
+			- 28: 2021-02-26T15:41:15.477+0100 (ISO8610)
+		The i-th field starts at fields[i * fieldStride] (fieldStride 0 means fieldWidth).
+		utcInMillisecs[i] receives the epoch milliseconds and valid[i] is 1, or
+		utcInMillisecs[i] is 0 and valid[i] is 0 if the field is malformed.
+		The digits are validated and converted by SSE4.1/AVX2 kernels selected at runtime,
+		with a scalar fallback on the other CPUs; kernel forces one of them (i.e. to compare them with the scalar one),
+		it throws if the CPU does not support it.
+		Returns the number of valid rows.
+	*/
+	enum class BatchKernel : uint8_t
+	{
+		Auto,
+		Scalar,
+		Sse41,
+		Avx2
+	};
+	static size_t parseUtcInMillisecsBatch(
+		std::span<const char> fields, size_t fieldWidth, std::span<int64_t> utcInMillisecs, std::span<uint8_t> valid, size_t fieldStride = 0,
+		BatchKernel kernel = BatchKernel::Auto
+	);
+
+	/**
+		Compressed sequence of epoch milliseconds (i.e. the results of sDateMilliSecondsToUtc), Gorilla style:
+		the values are split in blocks of blockSize, the header of a block keeps its first value and the offset
+		of its bytes, the other values are the zigzag varint of the delta of delta
+		(1 byte per value for a regular series, 1-3 bytes for events some seconds apart).
+		operator[] and decodeBlock decode only the block of the value; decodeBlock takes 8 one byte
+		varints at a time. Any int64_t sequence is stored losslessly, sorted or not.
+		serialize/deserialize give a little endian image of the column, deserialize throws if it is malformed.
+	*/
+	class TimestampColumn
+	{
+	  public:
+		static constexpr size_t blockSize = 256;
+
+		TimestampColumn() = default;
+		explicit TimestampColumn(std::span<const int64_t> utcInMillisecs);
+
+		void append(int64_t utcInMillisecs);
+		void append(std::span<const int64_t> utcInMillisecs);
+
+		size_t size() const { return _size; }
+		size_t blocks() const { return _blocks.size(); }
+		// headers and varints
+		size_t bytes() const { return _blocks.size() * sizeof(Block) + _data.size(); }
+
+		int64_t operator[](size_t index) const;
+		// values of block into utcInMillisecs (at least blockSize long), returns their number
+		size_t decodeBlock(size_t block, std::span<int64_t> utcInMillisecs) const;
+		// all the values, utcInMillisecs has to be size() long
+		void decode(std::span<int64_t> utcInMillisecs) const;
+		// values of block rendered as Formatter::formatColumn does, without a decoded copy of the column
+		void formatBlock(size_t block, const Formatter &formatter, std::string &chars, std::vector<int32_t> &offsets) const;
+
+		std::vector<uint8_t> serialize() const;
+		static TimestampColumn deserialize(std::span<const uint8_t> image);
+
+	  private:
+		struct Block
+		{
+			int64_t first;
+			// offset in _data of the varints of the block
+			uint64_t offset;
+		};
+
+		std::vector<Block> _blocks;
+		std::vector<uint8_t> _data;
+		size_t _size = 0;
+		// encoder state: last value and last delta of the last block
+		int64_t _last = 0;
+		int64_t _lastDelta = 0;
+	};
+
 	static std::string utcToUtcString(time_t utc, const std::string& outputFormat = "%Y-%m-%dT%H:%M:%SZ",
 		const std::string& outputPrecision = "seconds");
+	static std::string utcToUtcString(time_t utc, std::string_view outputFormat, Precision outputPrecision);
 	static std::string utcToLocalString(time_t utc, const std::string& outputFormat = "%Y-%m-%dT%H:%M:%S");
 
 	static uint64_t iso8610ToUtc(const std::string& datetime, const bool millisecondsPrecision = false);
+
+  private:
+	// plans cached per thread, used by the dateTimeFormat overloads
+	static const Formatter &formatter(std::string_view outputFormat, Precision outputPrecision);
 };
@@ -0,0 +1,347 @@
+/*
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either
+ version 2 of the License, or (at your option) any later
+ version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ Commercial use other than under the terms of the GNU General Public
+ License is allowed only after express negotiation of conditions
+ with the authors.
+*/
+
+/*
+	Conformance checks of the Datetime fast paths against their references.
+	Usage: datetime_check [--zoneinfo=/usr/share/zoneinfo] [--filter=<zone substring>]
+		- zones: utcSecondsToLocalTime, TimeZone::toLocal and TimeZone::toUtc against localtime_r/mktime
+		  (TZ set to the zone) for every zone of the zoneinfo directory, years 1900-2100 and the seconds
+		  around every transition found
+		- batch: the parseUtcInMillisecsBatch kernels supported by the CPU against the scalar one,
+		  on valid and corrupted fields of both widths
+		- column: TimestampColumn serialize/deserialize round trip
+	A line for each check is printed on stdout:
+		check,cases,mismatches
+	and the first mismatches on stderr. The exit code is 1 if any check has mismatches.
+*/
+
+#include "Datetime.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+string zoneInfoDirectory = "/usr/share/zoneinfo";
+string zoneFilter;
+
+// mismatches printed on stderr for each check
+constexpr uint64_t reportedMismatches = 10;
+
+struct Check
+{
+	const char *name;
+	uint64_t cases = 0;
+	uint64_t mismatches = 0;
+
+	void expect(const bool matches, const string &what)
+	{
+		cases++;
+		if (matches)
+			return;
+		if (mismatches++ < reportedMismatches)
+			cerr << name << ": " << what << endl;
+	}
+};
+
+void parseOptions(const int argc, char **argv)
+{
+	for (int index = 1; index < argc; index++)
+	{
+		const string option = argv[index];
+		if (option.starts_with("--zoneinfo="))
+			zoneInfoDirectory = option.substr(strlen("--zoneinfo="));
+		else if (option.starts_with("--filter="))
+			zoneFilter = option.substr(strlen("--filter="));
+		else
+		{
+			cerr << "Usage: " << argv[0] << " [--zoneinfo=/usr/share/zoneinfo] [--filter=<zone substring>]" << endl;
+			exit(2);
+		}
+	}
+}
+
+// the TZif files of the directory, without the posix/ and right/ copies
+vector<string> zoneNames()
+{
+	vector<string> names;
+	error_code errorCode;
+	for (filesystem::recursive_directory_iterator it(zoneInfoDirectory, errorCode), end; it != end; it.increment(errorCode))
+	{
+		const string name = filesystem::relative(it->path(), zoneInfoDirectory).string();
+		if (it->is_directory())
+		{
+			if (name == "posix" || name == "right")
+				it.disable_recursion_pending();
+			continue;
+		}
+		if (!it->is_regular_file() || name == "localtime" || name.find(zoneFilter) == string::npos)
+			continue;
+		char magic[4] = {};
+		ifstream(it->path(), ios::binary).read(magic, sizeof(magic));
+		if (memcmp(magic, "TZif", sizeof(magic)) == 0)
+			names.push_back(name);
+	}
+	sort(names.begin(), names.end());
+	return names;
+}
+
+string tmToString(const tm &tmDateTime)
+{
+	return format(
+		"{:0>4}-{:0>2}-{:0>2} {:0>2}:{:0>2}:{:0>2} wday {} yday {} isdst {} gmtoff {} zone {}", tmDateTime.tm_year + 1900, tmDateTime.tm_mon + 1,
+		tmDateTime.tm_mday, tmDateTime.tm_hour, tmDateTime.tm_min, tmDateTime.tm_sec, tmDateTime.tm_wday, tmDateTime.tm_yday,
+		tmDateTime.tm_isdst, tmDateTime.tm_gmtoff, tmDateTime.tm_zone != nullptr ? tmDateTime.tm_zone : ""
+	);
+}
+
+bool sameTm(const tm &a, const tm &b)
+{
+	return a.tm_year == b.tm_year && a.tm_mon == b.tm_mon && a.tm_mday == b.tm_mday && a.tm_hour == b.tm_hour && a.tm_min == b.tm_min &&
+		   a.tm_sec == b.tm_sec && a.tm_wday == b.tm_wday && a.tm_yday == b.tm_yday && (a.tm_isdst > 0) == (b.tm_isdst > 0) &&
+		   a.tm_gmtoff == b.tm_gmtoff && strcmp(a.tm_zone != nullptr ? a.tm_zone : "", b.tm_zone != nullptr ? b.tm_zone : "") == 0;
+}
+
+void checkZones(Check &toLocalCheck, Check &toUtcCheck)
+{
+	// 1900-01-01 - 2100-01-01, il passo non e' un multiplo dell'ora per variare anche l'ora del giorno
+	constexpr time_t firstUtc = -2208988800;
+	constexpr time_t lastUtc = 4102444800;
+	constexpr time_t step = 7 * 86400 + 3541;
+
+	for (const string &zone : zoneNames())
+	{
+		setenv("TZ", zone.c_str(), 1);
+		tzset();
+		Datetime::reloadLocalTimeZone();
+		const Datetime::TimeZone timeZone = Datetime::TimeZone::locate(zone);
+
+		const auto checkUtc = [&](const time_t utcTime)
+		{
+			tm expected;
+			localtime_r(&utcTime, &expected);
+			const tm local = Datetime::utcSecondsToLocalTime(utcTime);
+			toLocalCheck.expect(
+				sameTm(local, expected), format("{} utcSecondsToLocalTime({}): {}, localtime_r: {}", zone, utcTime, tmToString(local), tmToString(expected))
+			);
+			const tm zoneLocal = timeZone.toLocal(utcTime);
+			toLocalCheck.expect(
+				sameTm(zoneLocal, expected),
+				format("{} TimeZone::toLocal({}): {}, localtime_r: {}", zone, utcTime, tmToString(zoneLocal), tmToString(expected))
+			);
+			return expected;
+		};
+		// beforeOffset/afterOffset: gli offset intorno a localSeconds. Un'ora locale unica e' confrontata con mktime,
+		// una ripetuta o saltata con la regola di toUtc (la prima, spostata in avanti): mktime la sceglie dai tm_isdst
+		const auto checkLocal = [&](const time_t localSeconds, const long beforeOffset, const long afterOffset)
+		{
+			tm localTime;
+			gmtime_r(&localSeconds, &localTime);
+			localTime.tm_isdst = -1;
+			const auto localAt = [&](const time_t utcTime)
+			{
+				tm localAtUtc;
+				localtime_r(&utcTime, &localAtUtc);
+				return localAtUtc.tm_gmtoff == localSeconds - utcTime;
+			};
+			const time_t beforeUtc = localSeconds - beforeOffset;
+			const time_t afterUtc = localSeconds - afterOffset;
+			const bool beforeValid = localAt(beforeUtc);
+			const bool afterValid = localAt(afterUtc);
+
+			time_t expected;
+			const char *reference;
+			if (beforeValid && afterValid && beforeUtc != afterUtc)
+			{
+				expected = min(beforeUtc, afterUtc);
+				reference = "repeated, first";
+			}
+			else if (!beforeValid && !afterValid)
+			{
+				expected = beforeUtc;
+				reference = "skipped, forward";
+			}
+			else
+			{
+				tm mktimeLocalTime = localTime;
+				expected = mktime(&mktimeLocalTime);
+				reference = "mktime";
+			}
+			const time_t utcTime = timeZone.toUtc(localTime);
+			toUtcCheck.expect(
+				utcTime == expected, format("{} TimeZone::toUtc({}): {}, {}: {}", zone, tmToString(localTime), utcTime, reference, expected)
+			);
+		};
+
+		tm previous = checkUtc(firstUtc);
+		for (time_t utcTime = firstUtc + step; utcTime < lastUtc; utcTime += step)
+		{
+			const tm current = checkUtc(utcTime);
+			checkLocal(utcTime + current.tm_gmtoff, current.tm_gmtoff, current.tm_gmtoff);
+			if (current.tm_gmtoff != previous.tm_gmtoff || current.tm_isdst != previous.tm_isdst)
+			{
+				// la transizione per bisezione, poi i secondi e le ore locali intorno
+				time_t before = utcTime - step;
+				time_t after = utcTime;
+				while (after - before > 1)
+				{
+					const time_t middle = before + (after - before) / 2;
+					tm middleTm;
+					localtime_r(&middle, &middleTm);
+					(middleTm.tm_gmtoff == previous.tm_gmtoff && middleTm.tm_isdst == previous.tm_isdst ? before : after) = middle;
+				}
+				checkUtc(after - 1);
+				const tm afterTm = checkUtc(after);
+				checkUtc(after + 1);
+				for (time_t delta = -2 * 3600; delta <= 2 * 3600; delta += 900)
+					checkLocal(after + previous.tm_gmtoff + delta, previous.tm_gmtoff, afterTm.tm_gmtoff);
+			}
+			previous = current;
+		}
+	}
+	unsetenv("TZ");
+	tzset();
+	Datetime::reloadLocalTimeZone();
+}
+
+void checkBatchKernels(Check &check)
+{
+	mt19937_64 random(20210226);
+	for (const size_t fieldWidth : {24, 28})
+	{
+		// campi validi con ms e offset casuali, poi un byte corrotto in una riga su due
+		constexpr size_t rows = 20000;
+		string fields;
+		for (size_t row = 0; row < rows; row++)
+		{
+			const int64_t utcInMillisecs = static_cast<int64_t>(random() % 4102444800000ULL);
+			tm tmDateTime;
+			Datetime::convertFromUTCInSecondsToBreakDownUTC(utcInMillisecs / 1000, &tmDateTime);
+			string field = format(
+				"{:0>4}-{:0>2}-{:0>2}T{:0>2}:{:0>2}:{:0>2}.{:0>3}", tmDateTime.tm_year + 1900, tmDateTime.tm_mon + 1, tmDateTime.tm_mday, tmDateTime.tm_hour,
+				tmDateTime.tm_min, tmDateTime.tm_sec, utcInMillisecs % 1000
+			);
+			field += fieldWidth == 24 ? string("Z") : format("{}{:0>2}{:0>2}", random() % 2 ? '+' : '-', random() % 26, random() % 62);
+			if (row % 2)
+				field[random() % fieldWidth] = "0123456789-:T.Z+x 9"[random() % 19];
+			fields += field;
+		}
+
+		vector<int64_t> expectedUtcInMillisecs(rows);
+		vector<uint8_t> expectedValid(rows);
+		Datetime::parseUtcInMillisecsBatch(fields, fieldWidth, expectedUtcInMillisecs, expectedValid, 0, Datetime::BatchKernel::Scalar);
+
+		for (const auto &[kernel, kernelName] :
+			 {pair(Datetime::BatchKernel::Sse41, "sse4.1"), pair(Datetime::BatchKernel::Avx2, "avx2"), pair(Datetime::BatchKernel::Auto, "auto")})
+		{
+			vector<int64_t> utcInMillisecs(rows);
+			vector<uint8_t> valid(rows);
+			try
+			{
+				Datetime::parseUtcInMillisecsBatch(fields, fieldWidth, utcInMillisecs, valid, 0, kernel);
+			}
+			catch (const runtime_error &)
+			{
+				// kernel non supportato dalla CPU
+				continue;
+			}
+			for (size_t row = 0; row < rows; row++)
+				check.expect(
+					utcInMillisecs[row] == expectedUtcInMillisecs[row] && valid[row] == expectedValid[row],
+					format(
+						"{} '{}': {} valid {}, scalar: {} valid {}", kernelName, fields.substr(row * fieldWidth, fieldWidth), utcInMillisecs[row], valid[row],
+						expectedUtcInMillisecs[row], expectedValid[row]
+					)
+				);
+		}
+	}
+}
+
+void checkTimestampColumn(Check &check)
+{
+	mt19937_64 random(1614354075);
+	const auto roundTrip = [&](const string &series, const vector<int64_t> &utcInMillisecs)
+	{
+		const Datetime::TimestampColumn column(utcInMillisecs);
+		const vector<uint8_t> image = column.serialize();
+		const Datetime::TimestampColumn restored = Datetime::TimestampColumn::deserialize(image);
+		vector<int64_t> decoded(restored.size());
+		restored.decode(decoded);
+		check.expect(
+			restored.size() == utcInMillisecs.size() && decoded == utcInMillisecs && restored.serialize() == image,
+			format("{} ({} values): size {}, image {} bytes", series, utcInMillisecs.size(), restored.size(), image.size())
+		);
+		for (size_t index = 0; index < utcInMillisecs.size(); index += 97)
+			check.expect(restored[index] == utcInMillisecs[index], format("{} [{}]: {}, expected {}", series, index, restored[index], utcInMillisecs[index]));
+	};
+
+	for (const size_t size : {size_t(0), size_t(1), Datetime::TimestampColumn::blockSize - 1, Datetime::TimestampColumn::blockSize,
+							  Datetime::TimestampColumn::blockSize + 1, size_t(10000)})
+	{
+		vector<int64_t> regular, jittered, unsorted, extremes;
+		for (size_t index = 0; index < size; index++)
+		{
+			regular.push_back(1614354075000 + static_cast<int64_t>(index) * 1000);
+			jittered.push_back((jittered.empty() ? 1614354075000 : jittered.back()) + static_cast<int64_t>(random() % 5000));
+			unsorted.push_back(static_cast<int64_t>(random() % 4102444800000ULL) - 2208988800000);
+			extremes.push_back(index % 2 ? numeric_limits<int64_t>::min() + static_cast<int64_t>(index) : numeric_limits<int64_t>::max() - static_cast<int64_t>(index));
+		}
+		roundTrip("regular", regular);
+		roundTrip("jittered", jittered);
+		roundTrip("unsorted", unsorted);
+		roundTrip("extremes", extremes);
+	}
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+	parseOptions(argc, argv);
+
+	Check toLocalCheck{"zones toLocal"};
+	Check toUtcCheck{"zones toUtc"};
+	checkZones(toLocalCheck, toUtcCheck);
+	Check batchCheck{"batch kernels"};
+	checkBatchKernels(batchCheck);
+	Check columnCheck{"timestamp column"};
+	checkTimestampColumn(columnCheck);
+
+	cout << "check,cases,mismatches" << endl;
+	bool passed = true;
+	for (const Check &check : {toLocalCheck, toUtcCheck, batchCheck, columnCheck})
+	{
+		cout << check.name << "," << check.cases << "," << check.mismatches << endl;
+		passed = passed && check.mismatches == 0;
+	}
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,403 @@
+/*
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either
+ version 2 of the License, or (at your option) any later
+ version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ Commercial use other than under the terms of the GNU General Public
+ License is allowed only after express negotiation of conditions
+ with the authors.
+*/
+
+/*
+	Rewrites the timestamps of a log or CSV file to UTC.
+	Usage: datetime_rewrite [options] <input> [<output>]
+		--column=N		the timestamp is the N-th field (0 based) of the line, fields separated by --separator
+		--separator=C	field separator of --column (default ',')
+		--pattern=P		the timestamp starts where P matches ('d' a digit, '?' any char, the others literal),
+						default dddd-dd-ddTdd:dd:dd, the first match of every line is rewritten
+		--to=iso|ms|ns	UTC ISO with Z and the fraction digits of the input (default), epoch milliseconds or nanoseconds
+		--threads=N		worker threads (default the hardware threads)
+	Without --column the pattern is used. The timestamp is parsed by Datetime::parseIso8601ToUtcInNanosecs,
+	a field that does not parse is left as it is (the count is printed on stderr).
+	The input is memory-mapped and split in chunks (on line boundaries) converted by the workers,
+	the chunks are written in order with one write per chunk. Without output, stdout is used.
+*/
+
+#include "Datetime.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <format>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+enum class Output
+{
+	Iso,
+	MilliSecs,
+	NanoSecs
+};
+
+struct Options
+{
+	long column = -1;
+	char separator = ',';
+	string pattern = "dddd-dd-ddTdd:dd:dd";
+	Output output = Output::Iso;
+	size_t threads = max(thread::hardware_concurrency(), 1u);
+	string inputPath;
+	string outputPath;
+};
+
+constexpr size_t chunkSize = 8 * 1024 * 1024;
+
+inline bool isDigit(const char c) { return c >= '0' && c <= '9'; }
+
+// end of the fraction and of the offset that could follow the date time at position
+size_t timestampEnd(const string_view line, size_t position)
+{
+	if (position + 1 < line.size() && (line[position] == '.' || line[position] == ',') && isDigit(line[position + 1]))
+	{
+		position++;
+		while (position < line.size() && isDigit(line[position]))
+			position++;
+	}
+	if (position < line.size() && (line[position] == 'Z' || line[position] == 'z'))
+		return position + 1;
+	if (position + 4 < line.size() && (line[position] == '+' || line[position] == '-') && isDigit(line[position + 1]) && isDigit(line[position + 2]))
+	{
+		const size_t minutes = position + 3 + (line[position + 3] == ':');
+		if (minutes + 1 < line.size() && isDigit(line[minutes]) && isDigit(line[minutes + 1]))
+			return minutes + 2;
+	}
+	return position;
+}
+
+inline bool matchPattern(const char *p, const string_view pattern)
+{
+	for (size_t index = 0; index < pattern.size(); index++)
+	{
+		const char c = p[index];
+		if (pattern[index] == 'd' ? c < '0' || c > '9' : pattern[index] != '?' && pattern[index] != c)
+			return false;
+	}
+	return true;
+}
+
+inline char *writeDigits(char *output, uint64_t value, int width)
+{
+	for (int index = width - 1; index >= 0; index--, value /= 10)
+		output[index] = static_cast<char>('0' + value % 10);
+	return output + width;
+}
+
+// the number of fraction digits of the timestamp, to keep them in the ISO output
+size_t fractionDigits(const string_view timestamp)
+{
+	if (timestamp.size() <= 20 || (timestamp[19] != '.' && timestamp[19] != ','))
+		return 0;
+	size_t digits = 0;
+	while (20 + digits < timestamp.size() && timestamp[20 + digits] >= '0' && timestamp[20 + digits] <= '9')
+		digits++;
+	return digits;
+}
+
+// appends the converted timestamp, returns false (nothing appended) if it does not parse
+bool appendConverted(string &out, const string_view timestamp, const Output output)
+{
+	const auto utcInNanosecs = Datetime::parseIso8601ToUtcInNanosecs(timestamp);
+	if (!utcInNanosecs)
+		return false;
+
+	char buffer[40];
+	char *end;
+	if (output == Output::NanoSecs)
+		end = format_to(buffer, "{}", *utcInNanosecs);
+	else if (output == Output::MilliSecs)
+		end = format_to(buffer, "{}", *utcInNanosecs >= 0 ? *utcInNanosecs / 1000000 : (*utcInNanosecs - 999999) / 1000000);
+	else
+	{
+		int64_t utcInSecs = *utcInNanosecs / 1000000000;
+		int64_t nanoSecs = *utcInNanosecs % 1000000000;
+		if (nanoSecs < 0)
+		{
+			utcInSecs--;
+			nanoSecs += 1000000000;
+		}
+		int64_t days = utcInSecs / 86400;
+		int64_t secondsOfDay = utcInSecs % 86400;
+		if (secondsOfDay < 0)
+		{
+			days--;
+			secondsOfDay += 86400;
+		}
+		int64_t year;
+		int month;
+		int day;
+		Datetime::civilFromDays(days, &year, &month, &day);
+
+		end = writeDigits(buffer, year, 4);
+		*end++ = '-';
+		end = writeDigits(end, month, 2);
+		*end++ = '-';
+		end = writeDigits(end, day, 2);
+		*end++ = 'T';
+		end = writeDigits(end, secondsOfDay / 3600, 2);
+		*end++ = ':';
+		end = writeDigits(end, secondsOfDay / 60 % 60, 2);
+		*end++ = ':';
+		end = writeDigits(end, secondsOfDay % 60, 2);
+		if (const size_t digits = fractionDigits(timestamp))
+		{
+			*end++ = '.';
+			uint64_t fraction = nanoSecs;
+			for (size_t index = digits; index < 9; index++)
+				fraction /= 10;
+			end = writeDigits(end, fraction, static_cast<int>(digits));
+		}
+		*end++ = 'Z';
+	}
+	out.append(buffer, end - buffer);
+	return true;
+}
+
+// converts the lines of chunk into out, returns the number of timestamps that did not parse
+size_t rewriteChunk(const string_view chunk, const Options &options, string &out)
+{
+	size_t failures = 0;
+	out.clear();
+	out.reserve(chunk.size() + chunk.size() / 8);
+
+	size_t lineStart = 0;
+	while (lineStart < chunk.size())
+	{
+		size_t lineEnd = chunk.find('\n', lineStart);
+		lineEnd = lineEnd == string_view::npos ? chunk.size() : lineEnd + 1;
+		const string_view line = chunk.substr(lineStart, lineEnd - lineStart);
+		lineStart = lineEnd;
+
+		size_t fieldStart = string_view::npos;
+		size_t fieldEnd = 0;
+		if (options.column >= 0)
+		{
+			size_t start = 0;
+			for (long column = 0; column < options.column && start != string_view::npos; column++)
+			{
+				start = line.find(options.separator, start);
+				if (start != string_view::npos)
+					start++;
+			}
+			if (start != string_view::npos)
+			{
+				fieldStart = start;
+				fieldEnd = start;
+				while (fieldEnd < line.size() && line[fieldEnd] != options.separator && line[fieldEnd] != '\n' && line[fieldEnd] != '\r')
+					fieldEnd++;
+				// "2021-02-26T15:41:15.477+0100"
+				if (fieldEnd - fieldStart >= 2 && line[fieldStart] == '"' && line[fieldEnd - 1] == '"')
+				{
+					fieldStart++;
+					fieldEnd--;
+				}
+			}
+		}
+		else if (line.size() >= options.pattern.size())
+		{
+			for (size_t start = 0; start + options.pattern.size() <= line.size(); start++)
+				if (matchPattern(line.data() + start, options.pattern))
+				{
+					fieldStart = start;
+					fieldEnd = timestampEnd(line, start + options.pattern.size());
+					break;
+				}
+		}
+
+		if (fieldStart == string_view::npos)
+		{
+			out.append(line);
+			continue;
+		}
+
+		const size_t previousSize = out.size();
+		out.append(line.substr(0, fieldStart));
+		if (!appendConverted(out, line.substr(fieldStart, fieldEnd - fieldStart), options.output))
+		{
+			failures++;
+			out.resize(previousSize);
+			out.append(line);
+			continue;
+		}
+		out.append(line.substr(fieldEnd));
+	}
+
+	return failures;
+}
+
+bool writeAll(const int fd, const string_view data)
+{
+	size_t written = 0;
+	while (written < data.size())
+	{
+		const ssize_t result = write(fd, data.data() + written, data.size() - written);
+		if (result < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		written += result;
+	}
+	return true;
+}
+
+bool parseOptions(const int argc, char **argv, Options *pOptions)
+{
+	vector<string> paths;
+	for (int index = 1; index < argc; index++)
+	{
+		const string_view argument = argv[index];
+		if (argument.starts_with("--column="))
+			pOptions->column = stol(string(argument.substr(9)));
+		else if (argument.starts_with("--separator=") && argument.size() == 13)
+			pOptions->separator = argument[12];
+		else if (argument.starts_with("--pattern=") && argument.size() > 10)
+			pOptions->pattern = argument.substr(10);
+		else if (argument == "--to=iso")
+			pOptions->output = Output::Iso;
+		else if (argument == "--to=ms")
+			pOptions->output = Output::MilliSecs;
+		else if (argument == "--to=ns")
+			pOptions->output = Output::NanoSecs;
+		else if (argument.starts_with("--threads="))
+			pOptions->threads = max<size_t>(stoul(string(argument.substr(10))), 1);
+		else if (!argument.starts_with("--"))
+			paths.emplace_back(argument);
+		else
+			return false;
+	}
+	if (paths.empty() || paths.size() > 2)
+		return false;
+	pOptions->inputPath = paths[0];
+	if (paths.size() == 2)
+		pOptions->outputPath = paths[1];
+	return true;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+	Options options;
+	try
+	{
+		if (!parseOptions(argc, argv, &options))
+		{
+			cerr << "Usage: " << argv[0]
+				 << " [--column=N] [--separator=C] [--pattern=P] [--to=iso|ms|ns] [--threads=N] <input> [<output>]" << endl;
+			return 1;
+		}
+	}
+	catch (exception &e)
+	{
+		cerr << "Wrong option: " << e.what() << endl;
+		return 1;
+	}
+
+	const int inputFd = open(options.inputPath.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat inputStat;
+	if (inputFd == -1 || fstat(inputFd, &inputStat) == -1)
+	{
+		cerr << format("open {} failed: {}", options.inputPath, strerror(errno)) << endl;
+		return 1;
+	}
+	const size_t inputSize = static_cast<size_t>(inputStat.st_size);
+	const char *input = nullptr;
+	if (inputSize > 0)
+	{
+		void *mapped = mmap(nullptr, inputSize, PROT_READ, MAP_PRIVATE, inputFd, 0);
+		if (mapped == MAP_FAILED)
+		{
+			cerr << format("mmap {} failed: {}", options.inputPath, strerror(errno)) << endl;
+			return 1;
+		}
+		madvise(mapped, inputSize, MADV_SEQUENTIAL);
+		input = static_cast<const char *>(mapped);
+	}
+	close(inputFd);
+
+	const int outputFd = options.outputPath.empty() ? STDOUT_FILENO : open(options.outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (outputFd == -1)
+	{
+		cerr << format("open {} failed: {}", options.outputPath, strerror(errno)) << endl;
+		return 1;
+	}
+
+	// chunks of about chunkSize ending on a line boundary
+	vector<string_view> chunks;
+	for (size_t start = 0; start < inputSize;)
+	{
+		size_t end = min(start + chunkSize, inputSize);
+		if (end < inputSize)
+		{
+			const void *newLine = memchr(input + end, '\n', inputSize - end);
+			end = newLine == nullptr ? inputSize : static_cast<const char *>(newLine) - input + 1;
+		}
+		chunks.emplace_back(input + start, end - start);
+		start = end;
+	}
+
+	// the chunks are converted a batch at a time (one chunk per worker) and written in order
+	atomic<size_t> failures = 0;
+	vector<string> outputs(options.threads);
+	for (size_t batchStart = 0; batchStart < chunks.size(); batchStart += options.threads)
+	{
+		const size_t batchSize = min(options.threads, chunks.size() - batchStart);
+		vector<thread> workers;
+		for (size_t index = 1; index < batchSize; index++)
+			workers.emplace_back([&, index]() { failures += rewriteChunk(chunks[batchStart + index], options, outputs[index]); });
+		failures += rewriteChunk(chunks[batchStart], options, outputs[0]);
+		for (thread &worker : workers)
+			worker.join();
+
+		for (size_t index = 0; index < batchSize; index++)
+			if (!writeAll(outputFd, outputs[index]))
+			{
+				cerr << format("write failed: {}", strerror(errno)) << endl;
+				return 1;
+			}
+	}
+
+	if (input != nullptr)
+		munmap(const_cast<char *>(input), inputSize);
+	if (outputFd != STDOUT_FILENO && close(outputFd) == -1)
+	{
+		cerr << format("close {} failed: {}", options.outputPath, strerror(errno)) << endl;
+		return 1;
+	}
+	if (failures > 0)
+		cerr << format("{} timestamps not converted", failures.load()) << endl;
+
+	return 0;
+}